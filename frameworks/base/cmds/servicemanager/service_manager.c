@@ -88,21 +88,44 @@ int svc_can_register(unsigned uid, uint16_t *name)
 
 struct svcinfo 
 {
-    struct svcinfo *next;
+    struct svcinfo *next;   /* next in hash bucket */
     void *ptr;
     struct binder_death death;
+    unsigned hash;
     unsigned len;
     uint16_t name[0];
 };
 
-struct svcinfo *svclist = 0;
+/* Services are never removed, a dead one only loses its ptr. They are
+ * found by name through a hash table, and listed through an array in
+ * registration order.
+ */
+#define SVC_HASH_SIZE 256   /* power of two, well above the services of a device */
+
+struct svcinfo *svchash[SVC_HASH_SIZE];
+struct svcinfo **svcvec = 0;
+unsigned svccount = 0;
+unsigned svcalloc = 0;
+
+/* FNV-1a over the UTF-16 code units */
+unsigned svc_hash(uint16_t *s16, unsigned len)
+{
+    unsigned h = 2166136261u;
+
+    while (len--) {
+        h ^= *s16++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
 struct svcinfo *find_svc(uint16_t *s16, unsigned len)
 {
     struct svcinfo *si;
+    unsigned hash = svc_hash(s16, len);
 
-    for (si = svclist; si; si = si->next) {
-        if ((len == si->len) &&
+    for (si = svchash[hash & (SVC_HASH_SIZE - 1)]; si; si = si->next) {
+        if ((hash == si->hash) && (len == si->len) &&
             !memcmp(s16, si->name, len * sizeof(uint16_t))) {
             return si;
         }
@@ -164,6 +187,17 @@ int do_add_service(struct binder_state *bs,
         }
         si->ptr = ptr;
     } else {
+        if (svccount == svcalloc) {
+            unsigned n = svcalloc ? svcalloc * 2 : 64;
+            struct svcinfo **vec = realloc(svcvec, n * sizeof(*vec));
+            if (!vec) {
+                LOGE("add_service('%s',%p) uid=%d - OUT OF MEMORY\n",
+                     str8(s), ptr, uid);
+                return -1;
+            }
+            svcvec = vec;
+            svcalloc = n;
+        }
         si = malloc(sizeof(*si) + (len + 1) * sizeof(uint16_t));
         if (!si) {
             LOGE("add_service('%s',%p) uid=%d - OUT OF MEMORY\n",
@@ -176,8 +210,10 @@ int do_add_service(struct binder_state *bs,
         si->name[len] = '\0';
         si->death.func = svcinfo_death;
         si->death.ptr = si;
-        si->next = svclist;
-        svclist = si;
+        si->hash = svc_hash(s, len);
+        si->next = svchash[si->hash & (SVC_HASH_SIZE - 1)];
+        svchash[si->hash & (SVC_HASH_SIZE - 1)] = si;
+        svcvec[svccount++] = si;
     }
 
     binder_acquire(bs, ptr);
@@ -229,10 +265,9 @@ int svcmgr_handler(struct binder_state *bs,
     case SVC_MGR_LIST_SERVICES: {
         unsigned n = bio_get_uint32(msg);
 
-        si = svclist;
-        while ((n-- > 0) && si)
-            si = si->next;
-        if (si) {
+        /* newest first */
+        if (n < svccount) {
+            si = svcvec[svccount - 1 - n];
             bio_put_string16(reply, si->name);
             return 0;
         }
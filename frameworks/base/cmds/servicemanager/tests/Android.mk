@@ -0,0 +1,19 @@
+LOCAL_PATH:= $(call my-dir)
+
+# Boot time lookup storm against service_manager.c, driven in-process
+# through a fake binder transport.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := service_manager_bench.c fake_binder.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lrt -lpthread
+
+ifeq ($(BOARD_USE_LVMX),true)
+    LOCAL_CFLAGS += -DLVMX
+endif
+
+LOCAL_MODULE := service_manager_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
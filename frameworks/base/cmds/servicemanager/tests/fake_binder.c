@@ -0,0 +1,210 @@
+/* Copyright 2010 The Android Open Source Project
+ */
+
+/* In-process stand-in for binder.c: the binder_io marshalling works on
+ * plain memory and the driver calls only count the references taken, so
+ * that svcmgr_handler() can be driven without /dev/binder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binder.h"
+#include "fake_binder.h"
+
+#define BIO_F_OVERFLOW 0x02
+
+unsigned fake_binder_refs = 0;
+unsigned fake_binder_deaths = 0;
+
+struct binder_state *binder_open(unsigned mapsize)
+{
+    return 0;
+}
+
+void binder_close(struct binder_state *bs)
+{
+}
+
+int binder_become_context_manager(struct binder_state *bs)
+{
+    return 0;
+}
+
+void binder_loop(struct binder_state *bs, binder_handler func)
+{
+}
+
+void binder_acquire(struct binder_state *bs, void *ptr)
+{
+    fake_binder_refs++;
+}
+
+void binder_release(struct binder_state *bs, void *ptr)
+{
+    fake_binder_refs--;
+}
+
+void binder_link_to_death(struct binder_state *bs, void *ptr,
+                          struct binder_death *death)
+{
+    fake_binder_deaths++;
+}
+
+void bio_init(struct binder_io *bio, void *data,
+              uint32_t maxdata, uint32_t maxoffs)
+{
+    uint32_t n = maxoffs * sizeof(uint32_t);
+
+    if (n > maxdata) {
+        bio->flags = BIO_F_OVERFLOW;
+        bio->data_avail = 0;
+        bio->offs_avail = 0;
+        return;
+    }
+
+    bio->data = bio->data0 = (char *) data + n;
+    bio->offs = bio->offs0 = data;
+    bio->data_avail = maxdata - n;
+    bio->offs_avail = maxoffs;
+    bio->flags = 0;
+}
+
+/* the written part becomes the part to read, as the driver would deliver it */
+void fake_bio_rewind(struct binder_io *bio)
+{
+    bio->data_avail = bio->data - bio->data0;
+    bio->offs_avail = bio->offs - bio->offs0;
+    bio->data = bio->data0;
+    bio->offs = bio->offs0;
+}
+
+static void *bio_alloc(struct binder_io *bio, uint32_t size)
+{
+    size = (size + 3) & (~3);
+    if (size > bio->data_avail) {
+        bio->flags |= BIO_F_OVERFLOW;
+        return 0;
+    } else {
+        void *ptr = bio->data;
+        bio->data += size;
+        bio->data_avail -= size;
+        return ptr;
+    }
+}
+
+static void *bio_get(struct binder_io *bio, uint32_t size)
+{
+    size = (size + 3) & (~3);
+    if (bio->data_avail < size) {
+        bio->data_avail = 0;
+        bio->flags |= BIO_F_OVERFLOW;
+        return 0;
+    } else {
+        void *ptr = bio->data;
+        bio->data += size;
+        bio->data_avail -= size;
+        return ptr;
+    }
+}
+
+void bio_put_uint32(struct binder_io *bio, uint32_t n)
+{
+    uint32_t *ptr = bio_alloc(bio, sizeof(n));
+    if (ptr)
+        *ptr = n;
+}
+
+uint32_t bio_get_uint32(struct binder_io *bio)
+{
+    uint32_t *ptr = bio_get(bio, sizeof(*ptr));
+    return ptr ? *ptr : 0;
+}
+
+/* a reference travels as a flat object, its offset recorded for the driver */
+static void bio_put_object(struct binder_io *bio, void *ptr, uint32_t type)
+{
+    struct binder_object *obj;
+
+    if (!bio->offs_avail) {
+        bio->flags |= BIO_F_OVERFLOW;
+        return;
+    }
+    obj = bio_alloc(bio, sizeof(*obj));
+    if (!obj)
+        return;
+    obj->type = type;
+    obj->flags = 0;
+    obj->pointer = ptr;
+    obj->cookie = 0;
+    *bio->offs++ = ((char *) obj) - ((char *) bio->data0);
+    bio->offs_avail--;
+}
+
+void bio_put_obj(struct binder_io *bio, void *ptr)
+{
+    bio_put_object(bio, ptr, 0);
+}
+
+void bio_put_ref(struct binder_io *bio, void *ptr)
+{
+    bio_put_object(bio, ptr, 1);
+}
+
+void *bio_get_obj(struct binder_io *bio)
+{
+    struct binder_object *obj = bio_get(bio, sizeof(*obj));
+    return obj ? obj->pointer : 0;
+}
+
+void *bio_get_ref(struct binder_io *bio)
+{
+    return bio_get_obj(bio);
+}
+
+void bio_put_string16(struct binder_io *bio, const uint16_t *str)
+{
+    uint32_t len;
+    uint16_t *ptr;
+
+    if (!str) {
+        bio_put_uint32(bio, 0xffffffff);
+        return;
+    }
+    len = 0;
+    while (str[len])
+        len++;
+    bio_put_uint32(bio, len);
+    ptr = bio_alloc(bio, (len + 1) * sizeof(uint16_t));
+    if (ptr)
+        memcpy(ptr, str, (len + 1) * sizeof(uint16_t));
+}
+
+void bio_put_string16_x(struct binder_io *bio, const char *_str)
+{
+    unsigned char *str = (unsigned char*) _str;
+    uint32_t len;
+    uint16_t *ptr;
+
+    if (!str) {
+        bio_put_uint32(bio, 0xffffffff);
+        return;
+    }
+    len = strlen(_str);
+    bio_put_uint32(bio, len);
+    ptr = bio_alloc(bio, (len + 1) * sizeof(uint16_t));
+    if (!ptr)
+        return;
+    while (*str)
+        *ptr++ = *str++;
+    *ptr++ = 0;
+}
+
+uint16_t *bio_get_string16(struct binder_io *bio, uint32_t *sz)
+{
+    uint32_t len = bio_get_uint32(bio);
+    if (sz)
+        *sz = len;
+    return bio_get(bio, (len + 1) * sizeof(uint16_t));
+}
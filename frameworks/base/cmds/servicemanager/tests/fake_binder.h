@@ -0,0 +1,16 @@
+/* Copyright 2010 The Android Open Source Project
+ */
+
+#ifndef _FAKE_BINDER_H_
+#define _FAKE_BINDER_H_
+
+#include "binder.h"
+
+/* references held and death notifications requested by the service manager */
+extern unsigned fake_binder_refs;
+extern unsigned fake_binder_deaths;
+
+/* hands what was written to a binder_io over to its reader */
+void fake_bio_rewind(struct binder_io *bio);
+
+#endif
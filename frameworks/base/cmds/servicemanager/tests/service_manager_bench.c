@@ -0,0 +1,335 @@
+/* Copyright 2010 The Android Open Source Project
+ */
+
+/* Boot time lookup storm against the service manager, through
+ * svcmgr_handler() and the in-process transport of fake_binder.c.
+ *
+ * The services of a device are registered, then every process started at
+ * boot looks up the dozen services the framework needs. The lookups and the
+ * listing of all services are timed with the hash index and array of
+ * service_manager.c, and with the linked list scan they replaced, rebuilt
+ * here over the same names. Fails if a lookup or the listing returns a
+ * wrong service.
+ *
+ * usage: service_manager_bench [processes [extra services]]
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+/* the service manager itself, without its binder loop */
+#define main svcmgr_main
+#include "../service_manager.c"
+#undef main
+
+#include "fake_binder.h"
+
+/* registered by system_server, mediaserver and the phone process */
+static const char *services[] = {
+    "SurfaceFlinger", "media.audio_flinger", "media.audio_policy",
+    "media.player", "media.camera", "entropy", "power", "batteryinfo",
+    "usagestats", "sensor", "activity", "meminfo", "cpuinfo", "permission",
+    "telephony.registry", "package", "account", "content", "battery",
+    "hardware", "alarm", "checkin", "window", "bluetooth", "bluetooth_a2dp",
+    "statusbar", "clipboard", "input_method", "netstat", "network_management",
+    "connectivity", "wifi", "throttle", "accessibility", "mount",
+    "notification", "devicestoragemonitor", "location", "search",
+    "dropbox", "wallpaper", "audio", "headset", "dock", "backup",
+    "appwidget", "uimode", "diskstats", "vibrator",
+    "isms", "iphonesubinfo", "simphonebook", "phone", "device_policy",
+};
+
+/* looked up by each process at boot, through the framework managers */
+static const char *boot_lookups[] = {
+    "activity", "package", "window", "power", "permission", "content",
+    "account", "input_method", "clipboard", "audio", "connectivity",
+    "SurfaceFlinger",
+};
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+#define MAX_NAME 64
+
+static unsigned nservices;
+static uint16_t (*names)[MAX_NAME];
+static unsigned *lens;
+static uint16_t interface[MAX_NAME];
+static int failures;
+/* keeps the timed loops from being optimized away */
+static volatile uintptr_t sink;
+
+static void fail(const char *what, const uint16_t *name)
+{
+    printf("FAIL %s: %s\n", what, str8((uint16_t *) name));
+    failures++;
+}
+
+static unsigned to16(uint16_t *dst, const char *src)
+{
+    unsigned len = 0;
+    while (src[len] && len < MAX_NAME - 1) {
+        dst[len] = src[len];
+        len++;
+    }
+    dst[len] = 0;
+    return len;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *service_ptr(unsigned n)
+{
+    return (void *) (uintptr_t) (0x1000 + n * 16);
+}
+
+/* one transaction to the service manager, returns the handler status */
+static int transact(uint32_t code, const uint16_t *name, void *ptr, uint32_t n,
+                    struct binder_io *reply, void *rdata, unsigned rsize)
+{
+    unsigned mdata[128];
+    struct binder_io msg;
+    struct binder_txn txn;
+
+    bio_init(&msg, mdata, sizeof(mdata), 4);
+    bio_put_string16(&msg, interface);
+    if (code == SVC_MGR_LIST_SERVICES) {
+        bio_put_uint32(&msg, n);
+    } else {
+        bio_put_string16(&msg, name);
+    }
+    if (code == SVC_MGR_ADD_SERVICE)
+        bio_put_ref(&msg, ptr);
+    fake_bio_rewind(&msg);
+
+    memset(&txn, 0, sizeof(txn));
+    txn.target = svcmgr_handle;
+    txn.code = code;
+    txn.sender_euid = 0;
+    bio_init(reply, rdata, rsize, 4);
+    if (svcmgr_handler(0, &txn, &msg, reply))
+        return -1;
+    fake_bio_rewind(reply);
+    return 0;
+}
+
+/* the previous index: a list scanned from the newest service */
+struct listinfo {
+    struct listinfo *next;
+    void *ptr;
+    unsigned len;
+    uint16_t *name;
+};
+
+static struct listinfo *list;
+
+static struct listinfo *list_find(uint16_t *s16, unsigned len)
+{
+    struct listinfo *li;
+
+    for (li = list; li; li = li->next) {
+        if ((len == li->len) &&
+            !memcmp(s16, li->name, len * sizeof(uint16_t))) {
+            return li;
+        }
+    }
+    return 0;
+}
+
+static struct listinfo *list_nth(unsigned n)
+{
+    struct listinfo *li = list;
+    while ((n-- > 0) && li)
+        li = li->next;
+    return li;
+}
+
+static void register_services(unsigned extra)
+{
+    unsigned n;
+    unsigned rdata[32];
+    struct binder_io reply;
+    struct listinfo *li;
+
+    nservices = NELEM(services) + extra;
+    names = calloc(nservices, sizeof(*names));
+    lens = calloc(nservices, sizeof(*lens));
+    for (n = 0; n < nservices; n++) {
+        char buf[MAX_NAME];
+        if (n < NELEM(services)) {
+            snprintf(buf, sizeof(buf), "%s", services[n]);
+        } else {
+            snprintf(buf, sizeof(buf), "vendor.service%u", n);
+        }
+        lens[n] = to16(names[n], buf);
+    }
+
+    for (n = 0; n < nservices; n++) {
+        if (transact(SVC_MGR_ADD_SERVICE, names[n], service_ptr(n), 0,
+                     &reply, rdata, sizeof(rdata)) != 0) {
+            fail("add_service refused", names[n]);
+            continue;
+        }
+
+        li = malloc(sizeof(*li));
+        li->next = list;
+        li->ptr = service_ptr(n);
+        li->len = lens[n];
+        li->name = names[n];
+        list = li;
+    }
+}
+
+static unsigned lookup_index(const char *name)
+{
+    unsigned n;
+    uint16_t s16[MAX_NAME];
+    unsigned len = to16(s16, name);
+
+    for (n = 0; n < nservices; n++) {
+        if (lens[n] == len && !memcmp(names[n], s16, len * 2))
+            return n;
+    }
+    return 0;
+}
+
+static void storm(unsigned processes)
+{
+    unsigned idx[NELEM(boot_lookups)];
+    unsigned rdata[32];
+    struct binder_io reply;
+    unsigned p, i, total = processes * NELEM(boot_lookups);
+    int64_t t, list_ns, hash_ns, txn_ns;
+
+    for (i = 0; i < NELEM(boot_lookups); i++)
+        idx[i] = lookup_index(boot_lookups[i]);
+
+    t = now_ns();
+    for (p = 0; p < processes; p++) {
+        for (i = 0; i < NELEM(boot_lookups); i++) {
+            sink = (uintptr_t) list_find(names[idx[i]], lens[idx[i]]);
+        }
+    }
+    list_ns = now_ns() - t;
+
+    t = now_ns();
+    for (p = 0; p < processes; p++) {
+        for (i = 0; i < NELEM(boot_lookups); i++) {
+            sink = (uintptr_t) find_svc(names[idx[i]], lens[idx[i]]);
+        }
+    }
+    hash_ns = now_ns() - t;
+
+    t = now_ns();
+    for (p = 0; p < processes; p++) {
+        for (i = 0; i < NELEM(boot_lookups); i++) {
+            unsigned n = idx[i];
+            if (transact(SVC_MGR_CHECK_SERVICE, names[n], 0, 0,
+                         &reply, rdata, sizeof(rdata)) != 0 ||
+                bio_get_ref(&reply) != service_ptr(n)) {
+                fail("check_service", names[n]);
+                return;
+            }
+        }
+    }
+    txn_ns = now_ns() - t;
+
+    printf("lookup storm: %u processes x %u lookups among %u services\n",
+           processes, (unsigned) NELEM(boot_lookups), svccount);
+    printf("  index         total (usecs)  per lookup (nsecs)\n");
+    printf("  list scan     %13lld  %18lld\n",
+           (long long) list_ns / 1000, (long long) list_ns / total);
+    printf("  hash          %13lld  %18lld\n",
+           (long long) hash_ns / 1000, (long long) hash_ns / total);
+    printf("  transaction   %13lld  %18lld\n",
+           (long long) txn_ns / 1000, (long long) txn_ns / total);
+}
+
+/* every service listed once, newest first, as by the list it replaces */
+static void listing(unsigned rounds)
+{
+    unsigned rdata[64];
+    struct binder_io reply;
+    struct listinfo *li;
+    unsigned r, n, len;
+    uint16_t *s;
+    int64_t t, list_ns, vec_ns;
+
+    for (n = 0; ; n++) {
+        li = list_nth(n);
+        if (transact(SVC_MGR_LIST_SERVICES, 0, 0, n,
+                     &reply, rdata, sizeof(rdata)) != 0) {
+            if (li)
+                fail("list_services ended early", li->name);
+            break;
+        }
+        s = bio_get_string16(&reply, &len);
+        if (!li || !s || len != li->len || memcmp(s, li->name, len * 2)) {
+            fail("list_services order", s);
+            return;
+        }
+    }
+
+    /* the old handler walked the list up to the n-th service */
+    t = now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (n = 0; (li = list_nth(n)) != 0; n++)
+            sink = (uintptr_t) li->name;
+    }
+    list_ns = now_ns() - t;
+
+    t = now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (n = 0; n < svccount; n++)
+            sink = (uintptr_t) svcvec[svccount - 1 - n]->name;
+    }
+    vec_ns = now_ns() - t;
+
+    printf("listing the %u services, %u times:\n", svccount, rounds);
+    printf("  list walk     %13lld usecs\n", (long long) list_ns / 1000);
+    printf("  array         %13lld usecs\n", (long long) vec_ns / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned processes = (argc > 1) ? strtoul(argv[1], 0, 0) : 200;
+    unsigned extra = (argc > 2) ? strtoul(argv[2], 0, 0) : 0;
+    unsigned rdata[32];
+    struct binder_io reply;
+    uint16_t unknown[MAX_NAME];
+
+    if (processes == 0) {
+        fprintf(stderr, "usage: %s [processes [extra services]]\n", argv[0]);
+        return 1;
+    }
+
+    svcmgr_handle = BINDER_SERVICE_MANAGER;
+    to16(interface, "android.os.IServiceManager");
+    register_services(extra);
+    if (fake_binder_refs != svccount)
+        fail("a reference per service", interface);
+
+    /* a live service can not be registered twice */
+    if (transact(SVC_MGR_ADD_SERVICE, names[0], service_ptr(nservices), 0,
+                 &reply, rdata, sizeof(rdata)) == 0)
+        fail("add_service accepted a duplicate", names[0]);
+
+    to16(unknown, "no.such.service");
+    if (transact(SVC_MGR_CHECK_SERVICE, unknown, 0, 0,
+                 &reply, rdata, sizeof(rdata)) != 0 ||
+        bio_get_uint32(&reply) != 0)
+        fail("check_service of an unknown name", unknown);
+
+    storm(processes);
+    listing(processes / 10 + 1);
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -15,6 +15,7 @@
  */
 
 #include <math.h>
+#include <unistd.h>
 
 //#define LOG_NDEBUG 0
 #define LOG_TAG "A2dpAudioInterface"
@@ -27,6 +28,10 @@
 
 namespace android {
 
+// a write later than this after its deadline restarts the pacing clock instead
+// of writing the late buffers in a burst
+static const nsecs_t kMaxWriteDelay = milliseconds(100);
+
 // ----------------------------------------------------------------------------
 
 A2dpAudioInterface::A2dpAudioInterface() :
@@ -123,7 +128,10 @@ status_t A2dpAudioInterface::doRouting()
 
 status_t A2dpAudioInterface::dump(int fd, const Vector<String16>& args)
 {
-    return 0;
+    if (mOutput) {
+        mOutput->dump(fd, args);
+    }
+    return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
@@ -132,7 +140,8 @@ A2dpAudioInterface::A2dpAudioStreamOut::A2dpAudioStreamOut() :
     mFd(-1), mStandby(true), mStartCount(0), mRetryCount(0), mData(NULL),
     // assume BT enabled to start, this is safe because its only the
     // enabled->disabled transition we are worried about
-    mBluetoothEnabled(true)
+    mBluetoothEnabled(true), mNextWrite(0), mLastWrite(0), mDrift(0), mMaxDrift(0),
+    mJitter(0), mNumWrites(0), mNumResyncs(0)
 {
     // use any address by default
     strcpy(mA2dpAddress, "00:00:00:00:00:00");
@@ -190,16 +199,58 @@ ssize_t A2dpAudioInterface::A2dpAudioStreamOut::write(const void* buffer, size_t
     }
 
     mStandby = false;
+    pace_l(bytes);
 
     return bytes;
 
 Error:
     // Simulate audio output timing in case of error
-    usleep(bytes * 1000000 / frameSize() / sampleRate());
+    pace_l(bytes);
 
     return status;
 }
 
+// pace_l() must be called with mLock held, after bytes were written
+void A2dpAudioInterface::A2dpAudioStreamOut::pace_l(size_t bytes)
+{
+    nsecs_t period = seconds((nsecs_t)bytes / frameSize()) / sampleRate();
+    nsecs_t now = systemTime();
+
+    if (mNextWrite == 0) {
+        // first write after standby: the clock starts now
+        mNextWrite = now;
+        mLastWrite = now;
+    } else {
+        nsecs_t deviation = (now - mLastWrite) - period;
+        if (deviation < 0) deviation = -deviation;
+        // average over about 16 writes
+        mJitter += (deviation - mJitter) / 16;
+        mLastWrite = now;
+    }
+    mNumWrites++;
+
+    mDrift = now - mNextWrite;
+    if (mDrift > mMaxDrift) {
+        mMaxDrift = mDrift;
+    }
+    if (mDrift > kMaxWriteDelay) {
+        LOGW("A2DP write %lld us late, resyncing", ns2us(mDrift));
+        mNumResyncs++;
+        mNextWrite = now;
+    }
+
+    mNextWrite += period;
+    nsecs_t delay = mNextWrite - now;
+    if (delay > 0) {
+        usleep(ns2us(delay));
+    }
+}
+
+void A2dpAudioInterface::A2dpAudioStreamOut::resetPacing_l()
+{
+    mNextWrite = 0;
+}
+
 status_t A2dpAudioInterface::A2dpAudioStreamOut::init()
 {
     if (!mData) {
@@ -226,6 +277,7 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::standby()
         if (result == 0)
             mStandby = true;
     }
+    resetPacing_l();
 
     return result;
 }
@@ -274,6 +326,18 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::close_l()
 
 status_t A2dpAudioInterface::A2dpAudioStreamOut::dump(int fd, const Vector<String16>& args)
 {
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    Mutex::Autolock lock(mLock);
+    snprintf(buffer, SIZE, "A2dpAudioStreamOut: standby %d, bluetooth enabled %d, address %s\n",
+            mStandby, mBluetoothEnabled, mA2dpAddress);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\twrites %u, resyncs %u, drift %lld us (max %lld us), jitter %lld us\n",
+            mNumWrites, mNumResyncs, ns2us(mDrift), ns2us(mMaxDrift), ns2us(mJitter));
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
 
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 #include <hardware_legacy/AudioHardwareBase.h>
 
@@ -93,6 +94,8 @@ private:
                 status_t    close_l();
                 status_t    setAddress(const char* address);
                 status_t    setBluetoothEnabled(bool enabled);
+                void        pace_l(size_t bytes);
+                void        resetPacing_l();
 
     private:
                 int         mFd;
@@ -103,6 +106,19 @@ private:
                 void*       mData;
                 Mutex       mLock;
                 bool        mBluetoothEnabled;
+
+                // Writes are paced against an absolute deadline advanced by the
+                // duration of each buffer, so that the time spent in a2dp_write
+                // does not add up. mNextWrite is 0 in standby.
+                nsecs_t     mNextWrite;
+                nsecs_t     mLastWrite;
+                // lateness of the last write relative to its deadline, and the
+                // average deviation of the write period, in ns
+                nsecs_t     mDrift;
+                nsecs_t     mMaxDrift;
+                nsecs_t     mJitter;
+                uint32_t    mNumWrites;
+                uint32_t    mNumResyncs;
     };
 
     A2dpAudioStreamOut*     mOutput;
@@ -86,11 +86,17 @@ LOCAL_SRC_FILES:=               \
     AudioDSP.cpp.arm            \
     AudioFlinger.cpp            \
     AudioMixer.cpp.arm          \
+    AudioMixerSimd.cpp.arm      \
+    AudioMixerPool.cpp.arm      \
     AudioResampler.cpp.arm      \
     AudioResamplerSinc.cpp.arm  \
     AudioResamplerCubic.cpp.arm \
+    AudioResamplerPolyphase.cpp.arm \
     AudioPolicyService.cpp      \
-    AudioHardwareWrapper.cpp
+    AudioHardwareWrapper.cpp    \
+    AudioStreamTap.cpp          \
+    AudioClientHeap.cpp         \
+    StandbyPolicy.cpp
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
@@ -103,6 +109,10 @@ ifeq ($(ARCH_ARM_HAVE_VFP),true)
     LOCAL_CFLAGS += -D__ARM_HAVE_VFP
 endif
 
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+    LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+
 ifeq ($(strip $(BOARD_USES_GENERIC_AUDIO)),true)
   LOCAL_STATIC_LIBRARIES += libaudiointerface libaudiopolicybase
   LOCAL_CFLAGS += -DGENERIC_AUDIO
@@ -150,3 +160,5 @@ ifeq ($(BOARD_USE_LVMX),true)
 endif
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioClientHeap"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <utils/Log.h>
+
+#include "AudioClientHeap.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// first chunk of a client, enough for a few tracks
+static const size_t kFirstChunkSize = 64 * 1024;
+// size of the chunks added when the heap is full
+static const size_t kChunkSize = 256 * 1024;
+// the heap does not grow beyond this size
+static const size_t kMaxHeapSize = 4 * 1024 * 1024;
+// free blocks kept in each size class
+static const size_t kMaxFreeBlocks = 4;
+// smallest size class, the others are 1.5 and 2 times the previous one
+static const size_t kMinClassSize = 4096;
+static const size_t kPageSize = 4096;
+
+static inline size_t roundUp(size_t size, size_t unit)
+{
+    return ((size + unit - 1) / unit) * unit;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioClientHeap::AudioClientHeap(const char* name)
+    :   mName(name), mCapacity(0), mInUse(0), mRequested(0), mFree(0), mHighWater(0),
+        mNumAllocations(0), mNumReuses(0), mNumFailures(0)
+{
+}
+
+AudioClientHeap::~AudioClientHeap()
+{
+    // every Allocation holds a reference on the heap: only free blocks are left
+    purgeFreeLists_l();
+    for (size_t i = 0; i < mChunks.size(); i++) {
+        delete mChunks[i];
+    }
+}
+
+// size classes are 4K, 6K, 8K, 12K, 16K... up to 768K
+size_t AudioClientHeap::classSize(int sizeClass)
+{
+    size_t size = kMinClassSize << (sizeClass / 2);
+    return (sizeClass & 1) ? size + size / 2 : size;
+}
+
+// returns -1 above the largest class, these blocks are not kept once freed
+int AudioClientHeap::sizeClass(size_t size)
+{
+    for (int i = 0; i < kNumSizeClasses; i++) {
+        if (size <= classSize(i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+sp<IMemory> AudioClientHeap::allocate(size_t size)
+{
+    Mutex::Autolock _l(mLock);
+
+    int cls = sizeClass(size);
+    size_t blockSize = (cls >= 0) ? classSize(cls) : roundUp(size, kPageSize);
+    block_t block;
+
+    if (cls >= 0 && !mFreeBlocks[cls].isEmpty()) {
+        block = mFreeBlocks[cls].top();
+        mFreeBlocks[cls].pop();
+        mFree -= blockSize;
+        mNumReuses++;
+    } else if (!allocateBlock_l(blockSize, &block)) {
+        mNumFailures++;
+        return 0;
+    }
+
+    block.chunk->live++;
+    mInUse += blockSize;
+    mRequested += size;
+    if (mInUse > mHighWater) {
+        mHighWater = mInUse;
+    }
+    mNumAllocations++;
+    return new Allocation(this, block, cls, size);
+}
+
+bool AudioClientHeap::allocateBlock_l(size_t size, block_t* block)
+{
+    for (size_t i = 0; i < mChunks.size(); i++) {
+        chunk_t* chunk = mChunks[i];
+        block->memory = chunk->dealer->allocate(size);
+        if (block->memory != 0) {
+            block->chunk = chunk;
+            chunk->used++;
+            return true;
+        }
+    }
+
+    size_t chunkSize = roundUp(size, mChunks.isEmpty() ? kFirstChunkSize : kChunkSize);
+    if (mCapacity + chunkSize > kMaxHeapSize) {
+        // the free blocks may be in the way of this allocation
+        if (mFree == 0) {
+            return false;
+        }
+        purgeFreeLists_l();
+        return allocateBlock_l(size, block);
+    }
+
+    chunk_t* chunk = new chunk_t;
+#ifdef USE_ECLAIR_MEMORYDEALER
+    chunk->dealer = new MemoryDealer(chunkSize);
+#else
+    chunk->dealer = new MemoryDealer(chunkSize, mName.string());
+#endif
+    chunk->size = chunkSize;
+    chunk->used = 0;
+    chunk->live = 0;
+    block->memory = chunk->dealer->allocate(size);
+    if (block->memory == 0) {
+        delete chunk;
+        return false;
+    }
+    block->chunk = chunk;
+    chunk->used++;
+    mChunks.add(chunk);
+    mCapacity += chunkSize;
+    LOGV("%s: new chunk of %d bytes, capacity %d", mName.string(), chunkSize, mCapacity);
+    return true;
+}
+
+// release() is called by the Allocation destructor, from any thread
+void AudioClientHeap::release(const block_t& block, int sizeClass, size_t size)
+{
+    Mutex::Autolock _l(mLock);
+
+    chunk_t* chunk = block.chunk;
+    size_t blockSize = (sizeClass >= 0) ? classSize(sizeClass) : roundUp(size, kPageSize);
+    mInUse -= blockSize;
+    mRequested -= size;
+    chunk->live--;
+
+    // the blocks of a chunk not used anymore are not kept, so that the chunk
+    // can be released. The first chunk is always kept.
+    bool keepChunk = (chunk->live != 0 || chunk == mChunks[0]);
+    if (sizeClass >= 0 && keepChunk && mFreeBlocks[sizeClass].size() < kMaxFreeBlocks) {
+        mFreeBlocks[sizeClass].push(block);
+        mFree += blockSize;
+        return;
+    }
+
+    // dropping the last reference gives the block back to the dealer
+    chunk->used--;
+    if (!keepChunk) {
+        releaseChunk_l(chunk);
+    }
+}
+
+// releaseChunk_l() frees the blocks of chunk found in the free lists, and the
+// chunk itself if that leaves it empty
+void AudioClientHeap::releaseChunk_l(chunk_t* chunk)
+{
+    for (int i = 0; i < kNumSizeClasses; i++) {
+        Vector<block_t>& blocks = mFreeBlocks[i];
+        for (size_t j = blocks.size(); j > 0; ) {
+            j--;
+            if (blocks[j].chunk == chunk) {
+                blocks.removeAt(j);
+                mFree -= classSize(i);
+                chunk->used--;
+            }
+        }
+    }
+    if (chunk->used != 0) {
+        return;
+    }
+    for (size_t i = 0; i < mChunks.size(); i++) {
+        if (mChunks[i] == chunk) {
+            mChunks.removeAt(i);
+            break;
+        }
+    }
+    mCapacity -= chunk->size;
+    LOGV("%s: released chunk of %d bytes, capacity %d", mName.string(), chunk->size, mCapacity);
+    delete chunk;
+}
+
+void AudioClientHeap::purgeFreeLists_l()
+{
+    for (int i = 0; i < kNumSizeClasses; i++) {
+        Vector<block_t>& blocks = mFreeBlocks[i];
+        for (size_t j = 0; j < blocks.size(); j++) {
+            blocks[j].chunk->used--;
+        }
+        blocks.clear();
+    }
+    mFree = 0;
+}
+
+void AudioClientHeap::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    Mutex::Autolock _l(mLock);
+    // internal fragmentation is lost to the rounding of the size classes,
+    // external is the part of the chunks neither used nor kept in free lists
+    size_t internal = mInUse ? ((mInUse - mRequested) * 100) / mInUse : 0;
+    size_t external = mCapacity ? ((mCapacity - mInUse - mFree) * 100) / mCapacity : 0;
+    snprintf(buffer, SIZE, "    heap: %d chunks, %d KB, in use %d KB (high water %d KB), "
+            "free lists %d KB\n",
+            mChunks.size(), mCapacity / 1024, mInUse / 1024, mHighWater / 1024, mFree / 1024);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "    allocations %u, reused %u, failed %u, fragmentation %d%% internal "
+            "%d%% external\n",
+            mNumAllocations, mNumReuses, mNumFailures, internal, external);
+    result.append(buffer);
+}
+
+void AudioClientHeap::dumpChunks(const char* what) const
+{
+    Mutex::Autolock _l(mLock);
+    LOGW("%s: %d chunks, %d bytes, %d in use", what, mChunks.size(), mCapacity, mInUse);
+    for (size_t i = 0; i < mChunks.size(); i++) {
+        mChunks[i]->dealer->dump(what);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+AudioClientHeap::Allocation::Allocation(const sp<AudioClientHeap>& heap, const block_t& block,
+        int sizeClass, size_t size)
+    :   MemoryBase(block.memory->getMemory(), block.memory->offset(), block.memory->size()),
+        mHeap(heap), mBlock(block), mSizeClass(sizeClass), mRequested(size)
+{
+}
+
+AudioClientHeap::Allocation::~Allocation()
+{
+    mHeap->release(mBlock, mSizeClass, mRequested);
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
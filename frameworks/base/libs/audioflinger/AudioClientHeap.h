@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_CLIENT_HEAP_H
+#define ANDROID_AUDIO_CLIENT_HEAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+#include <binder/IMemory.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryDealer.h>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Shared memory of the control blocks and buffers of one AudioFlinger client.
+ *
+ * The heap starts with one small MemoryDealer chunk and adds chunks when an
+ * allocation does not fit, up to a maximum size. Allocations are rounded up
+ * to size classes. A freed block goes to the free list of its class and is
+ * handed out again by the next allocation of the same class, so clients
+ * creating and deleting the same tracks over and over do not fragment the
+ * chunks. A chunk is released when none of its blocks is used.
+ */
+class AudioClientHeap : public RefBase
+{
+public:
+                        AudioClientHeap(const char* name);
+    virtual             ~AudioClientHeap();
+
+            sp<IMemory> allocate(size_t size);
+
+            void        dump(String8& result) const;
+            // logs the chunks, called when an allocation fails
+            void        dumpChunks(const char* what) const;
+
+private:
+                        AudioClientHeap(const AudioClientHeap&);
+                        AudioClientHeap& operator = (const AudioClientHeap&);
+
+    struct chunk_t {
+        sp<MemoryDealer>    dealer;
+        size_t              size;
+        // blocks allocated from the dealer including the free ones, and
+        // blocks used by the client
+        size_t              used;
+        size_t              live;
+    };
+
+    struct block_t {
+        sp<IMemory>         memory;
+        chunk_t*            chunk;
+    };
+
+    // memory returned to the client, gives its block back to the heap when
+    // the last reference is dropped
+    class Allocation : public MemoryBase {
+    public:
+                            Allocation(const sp<AudioClientHeap>& heap, const block_t& block,
+                                    int sizeClass, size_t size);
+        virtual             ~Allocation();
+    private:
+        sp<AudioClientHeap> mHeap;
+        block_t             mBlock;
+        int                 mSizeClass;
+        size_t              mRequested;
+    };
+
+    static  int         sizeClass(size_t size);
+    static  size_t      classSize(int sizeClass);
+
+            bool        allocateBlock_l(size_t size, block_t* block);
+            void        release(const block_t& block, int sizeClass, size_t size);
+            void        releaseChunk_l(chunk_t* chunk);
+            void        purgeFreeLists_l();
+
+    static const int kNumSizeClasses = 16;
+
+    mutable Mutex       mLock;
+    String8             mName;
+    Vector<chunk_t*>    mChunks;
+    Vector<block_t>     mFreeBlocks[kNumSizeClasses];
+
+    // chunks size, bytes of the blocks in use, bytes asked for by the
+    // clients of these blocks, bytes in free lists
+    size_t              mCapacity;
+    size_t              mInUse;
+    size_t              mRequested;
+    size_t              mFree;
+    size_t              mHighWater;
+    uint32_t            mNumAllocations;
+    uint32_t            mNumReuses;
+    uint32_t            mNumFailures;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_CLIENT_HEAP_H
@@ -41,6 +41,7 @@
 #include "AudioHardwareWrapper.h"
 
 #include "AudioMixer.h"
+#include "AudioMixerSimd.h"
 #include "AudioFlinger.h"
 
 #ifdef WITH_A2DP
@@ -82,6 +83,57 @@ static const int kDumpLockSleep = 20000;
 
 static const nsecs_t kWarningThrottle = seconds(5);
 
+// mixer standby policy parameters, see setStandbyPolicyParameters()
+static const char* kKeyStandbyPolicy = "standby_policy";
+static const char* kKeyStandbyDelay = "standby_delay_ms";
+static const char* kKeyStandbyDelayMin = "standby_delay_min_ms";
+static const char* kKeyStandbyDelayMax = "standby_delay_max_ms";
+static const char* kKeyMaxPeriodRatio = "max_period_ratio";
+static const char* kKeyMixerPoolThreshold = "mixer_pool_threshold";
+// default resampler quality of a thread: "fast", "default" or "high"
+static const char* kKeyResamplerQuality = "resampler_quality";
+// a destroyed track slot not reused within this delay is freed
+static const nsecs_t kTrackSlotMaxAge = seconds(5);
+// deep buffer batch duration of a mixer output, 0 to disable the mode
+static const char* kKeyDeepBuffer = "deep_buffer_ms";
+// "begin" a parameter transaction with getParameters() or "commit" it with
+// setParameters(), see ThreadBase::beginParameters()
+static const char* kKeyParameterTransaction = "parameter_transaction";
+// id of the transaction returned by the begin, carried by the requests of the
+// transaction and by its commit
+static const char* kKeyParameterTransactionId = "parameter_transaction_id";
+// a transaction still open after this delay is applied without waiting for its commit
+static const nsecs_t kParamTransactionTimeout = seconds(1);
+// frames clamped and channel converted at a time by the record thread
+static const size_t kRecordConvertBlockFrames = 256;
+// input frames a record resampler is never asked to use, covers the look ahead
+// of the highest quality resampler
+static const size_t kRecordResamplerMargin = 32;
+// share of the mixer period above which resampling is considered too slow,
+// and below which the tier lowered because of it can be raised again, in %
+static const int kResampleLoadHigh = 25;
+static const int kResampleLoadLow = 10;
+// consecutive periods above the high limit before the tier is lowered, and
+// below the low limit before it is raised
+static const int kResampleOverloadPeriods = 16;
+static const int kResampleRecoverPeriods = 1000;
+// upper bound of the record thread wait for a track being started
+static const nsecs_t kRecordStartTimeout = milliseconds(10);
+// fast tracks mix and write periods in ro.audio.fast_subperiods parts
+static const int kDefaultFastSubPeriods = 4;
+static const int kMaxFastSubPeriods = 8;
+// openOutput() flag asking for a mixer output in deep buffer mode, with a
+// batch duration read from ro.audio.deep_buffer_ms
+static const uint32_t kOutputFlagDeepBuffer = 0x00010000;
+static const uint32_t kDefaultDeepBufferMs = 200;
+static const uint32_t kMaxDeepBufferMs = 1000;
+// frames a deep buffer batch leaves in each track, covers the look ahead of
+// the resamplers
+static const size_t kDeepBufferMargin = 32;
+// longest wait of Track::flush() for the mixer thread to reset an active
+// track, more than a deep buffer batch written at once
+static const nsecs_t kFlushResetTimeout = milliseconds(2 * kMaxDeepBufferMs);
+
 
 #define AUDIOFLINGER_SECURITY_ENABLED 1
 
@@ -120,17 +172,19 @@ static bool settingsAllowed() {
 }
 
 // ----------------------------------------------------------------------------
-AudioFlinger::AudioFlinger()
+AudioFlinger::AudioFlinger(AudioHardwareWrapper* hardware)
     : BnAudioFlinger(),
 #ifdef HAVE_FM_RADIO
-        mAudioHardware(0), mMasterVolume(1.0f), mMasterMute(false), mNextThreadId(0),  mFmOn(false)
+        mAudioHardware(0), mMasterVolume(1.0f), mMasterMute(false), mNextThreadId(0),
+        mStandalone(hardware != 0), mFmOn(false)
 #else
-        mAudioHardware(0), mMasterVolume(1.0f), mMasterMute(false), mNextThreadId(0)
+        mAudioHardware(0), mMasterVolume(1.0f), mMasterMute(false), mNextThreadId(0),
+        mStandalone(hardware != 0)
 #endif
 {
     mHardwareStatus = AUDIO_HW_IDLE;
 
-    mAudioHardware = AudioHardwareWrapper::create();
+    mAudioHardware = (hardware != 0) ? hardware : AudioHardwareWrapper::create();
 
     mHardwareStatus = AUDIO_HW_INIT;
     if (mAudioHardware->initCheck() == NO_ERROR) {
@@ -165,22 +219,69 @@ AudioFlinger::~AudioFlinger()
 
 
 
+static bool tryLock(Mutex& mutex)
+{
+    bool locked = false;
+    for (int i = 0; i < kDumpLockRetries; ++i) {
+        if (mutex.tryLock() == NO_ERROR) {
+            locked = true;
+            break;
+        }
+        usleep(kDumpLockSleep);
+    }
+    return locked;
+}
+
 status_t AudioFlinger::dumpClients(int fd, const Vector<String16>& args)
 {
     const size_t SIZE = 256;
     char buffer[SIZE];
     String8 result;
 
-    result.append("Clients:\n");
+    // cost of the deleted tracks of each client, then of its tracks on all
+    // the outputs. mTracks of an output is only read with its mLock held, the
+    // tracks of an output whose lock cannot be taken are not counted.
+    Vector< sp<Client> > clients;
+    Vector<track_cost_t> costs;
     for (size_t i = 0; i < mClients.size(); ++i) {
-        wp<Client> wClient = mClients.valueAt(i);
-        if (wClient != 0) {
-            sp<Client> client = wClient.promote();
-            if (client != 0) {
-                snprintf(buffer, SIZE, "  pid: %d\n", client->pid());
-                result.append(buffer);
+        sp<Client> client = mClients.valueAt(i).promote();
+        if (client != 0) {
+            clients.add(client);
+            costs.add(client->trackCost());
+        }
+    }
+    String8 skipped;
+    for (size_t j = 0; j < mPlaybackThreads.size(); j++) {
+        sp<PlaybackThread> thread = mPlaybackThreads.valueAt(j);
+        if (!tryLock(thread->mLock)) {
+            snprintf(buffer, SIZE, " %d", mPlaybackThreads.keyAt(j));
+            skipped.append(buffer);
+            continue;
+        }
+        const SortedVector< sp<PlaybackThread::Track> >& tracks = thread->mTracks;
+        for (size_t k = 0; k < tracks.size(); k++) {
+            for (size_t i = 0; i < clients.size(); i++) {
+                if (tracks[k]->mClient == clients[i]) {
+                    costs.editItemAt(i).add(tracks[k]->mCost);
+                    break;
+                }
             }
         }
+        thread->mLock.unlock();
+    }
+
+    result.append("Clients:\n");
+    if (skipped.length() != 0) {
+        snprintf(buffer, SIZE, "  outputs locked, tracks not counted:%s\n", skipped.string());
+        result.append(buffer);
+    }
+    for (size_t i = 0; i < clients.size(); ++i) {
+        snprintf(buffer, SIZE, "  pid: %d\n", clients[i]->pid());
+        result.append(buffer);
+        clients[i]->heap()->dump(result);
+        result.append("    cpu: ");
+        costs[i].dump(buffer, SIZE);
+        result.append(buffer);
     }
     write(fd, result.string(), result.size());
     return NO_ERROR;
@@ -214,22 +315,9 @@ status_t AudioFlinger::dumpPermissionDenial(int fd, const Vector<String16>& args
     return NO_ERROR;
 }
 
-static bool tryLock(Mutex& mutex)
-{
-    bool locked = false;
-    for (int i = 0; i < kDumpLockRetries; ++i) {
-        if (mutex.tryLock() == NO_ERROR) {
-            locked = true;
-            break;
-        }
-        usleep(kDumpLockSleep);
-    }
-    return locked;
-}
-
 status_t AudioFlinger::dump(int fd, const Vector<String16>& args)
 {
-    if (checkCallingPermission(String16("android.permission.DUMP")) == false) {
+    if (!mStandalone && checkCallingPermission(String16("android.permission.DUMP")) == false) {
         dumpPermissionDenial(fd, args);
     } else {
         // get state of hardware lock
@@ -316,7 +404,7 @@ sp<IAudioTrack> AudioFlinger::createTrack(
             mClients.add(pid, client);
         }
         track = thread->createTrack_l(client, streamType, sampleRate, format,
-                channelCount, frameCount, sharedBuffer, &lStatus);
+                channelCount, frameCount, flags, sharedBuffer, &lStatus);
     }
     if (lStatus == NO_ERROR) {
         trackHandle = new TrackHandle(track);
@@ -689,6 +777,32 @@ String8 AudioFlinger::getParameters(int ioHandle, const String8& keys)
         return mAudioHardware->getParameters(keys);
     }
 
+    AudioParameter param = AudioParameter(keys);
+    String8 value;
+    if (param.get(String8(kKeyParameterTransaction), value) == NO_ERROR) {
+        // the begin of a transaction returns its id, and may wait for the
+        // transaction of another client: mLock is not held meanwhile
+        if (value != "begin" || !settingsAllowed()) {
+            return String8("");
+        }
+        sp<ThreadBase> thread;
+        {
+            Mutex::Autolock _l(mLock);
+            thread = checkPlaybackThread_l(ioHandle);
+            if (thread == NULL) {
+                thread = checkRecordThread_l(ioHandle);
+            }
+        }
+        if (thread == NULL) {
+            return String8("");
+        }
+        int id = 0;
+        param.getInt(String8(kKeyParameterTransactionId), id);
+        AudioParameter reply = AudioParameter();
+        reply.addInt(String8(kKeyParameterTransactionId), thread->beginParameters(id));
+        return reply.toString();
+    }
+
     Mutex::Autolock _l(mLock);
 
     PlaybackThread *playbackThread = checkPlaybackThread_l(ioHandle);
@@ -869,17 +983,102 @@ void AudioFlinger::removeClient_l(pid_t pid)
 
 // ----------------------------------------------------------------------------
 
+// bucket 2n covers [2^n, 1.5*2^n) usecs and bucket 2n+1 covers [1.5*2^n, 2^(n+1))
+int AudioFlinger::LatencyHistogram::bucketIndex(uint32_t us)
+{
+    if (us < 2) return us;
+    int log2 = 31 - __builtin_clz(us);
+    return 2 * log2 + ((us >> (log2 - 1)) & 1);
+}
+
+uint32_t AudioFlinger::LatencyHistogram::bucketMax(int index)
+{
+    if (index < 2) return index;
+    int log2 = index / 2;
+    uint32_t half = 1 << (log2 - 1);
+    return (1 << log2) + (index & 1) * half + half - 1;
+}
+
+void AudioFlinger::LatencyHistogram::add(nsecs_t duration)
+{
+    nsecs_t us = duration / 1000;
+    if (us < 0) us = 0;
+    if (us > 0x7FFFFFFF) us = 0x7FFFFFFF;
+    mBuckets[bucketIndex((uint32_t)us)]++;
+    mCount++;
+    if ((uint32_t)us > mMax) mMax = (uint32_t)us;
+}
+
+void AudioFlinger::LatencyHistogram::reset()
+{
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+// returns the upper bound of the bucket containing the given percentile
+uint32_t AudioFlinger::LatencyHistogram::percentile(uint32_t percent) const
+{
+    if (mCount == 0) return 0;
+    uint64_t target = ((uint64_t)mCount * percent + 99) / 100;
+    uint64_t sum = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        sum += mBuckets[i];
+        if (sum >= target) {
+            uint32_t value = bucketMax(i);
+            return (value < mMax) ? value : mMax;
+        }
+    }
+    return mMax;
+}
+
+void AudioFlinger::LatencyHistogram::dump(char* buffer, size_t size, const char* name) const
+{
+    snprintf(buffer, size, "  %-8s %9u %7u %7u %7u\n",
+            name,
+            mCount,
+            percentile(50),
+            percentile(99),
+            mMax);
+}
+
+// ----------------------------------------------------------------------------
+
+void AudioFlinger::track_cost_t::dump(char* buffer, size_t size) const
+{
+    // load in 1/100 of percent of the played duration
+    nsecs_t total = resample + ramp + mix;
+    uint32_t load = played ? (uint32_t)((total * 10000) / played) : 0;
+    uint32_t estimatedShare = total ? (uint32_t)((estimated * 100) / total) : 0;
+    snprintf(buffer, size, "resample %llu ramp %llu mix %llu usecs, played %llu msecs, "
+            "load %u.%02u%% (%u%% estimated)\n",
+            (unsigned long long)(resample / 1000),
+            (unsigned long long)(ramp / 1000),
+            (unsigned long long)(mix / 1000),
+            (unsigned long long)ns2ms(played),
+            load / 100, load % 100, estimatedShare);
+}
+
+// ----------------------------------------------------------------------------
+
 AudioFlinger::ThreadBase::ThreadBase(const sp<AudioFlinger>& audioFlinger, int id)
     :   Thread(false),
         mAudioFlinger(audioFlinger), mSampleRate(0), mFrameCount(0), mChannelCount(0),
-        mFormat(0), mFrameSize(1), mStandby(false), mId(id), mExiting(false)
+        mFormat(0), mFrameSize(1), mStandby(false), mId(id), mExiting(false),
+        mPendingRequests(0), mParamSeq(0), mParamReplySeq(0), mParamTransactionDepth(0),
+        mLastParamTransactionId(0), mParamTransactionId(0), mParamTransactionStart(0),
+        mParamTransactionRequests(0), mParamTransactionReconfigs(0), mParamTransactionOpen(0),
+        mExpiredTransactionId(0), mNumParamTransactions(0), mNumMergedParams(0),
+        mNumExpiredTransactions(0), mNumStandbyCyclesSaved(0)
 {
 }
 
 AudioFlinger::ThreadBase::~ThreadBase()
 {
     mParamCond.broadcast();
+    mParamTransactionCond.broadcast();
     mNewParameters.clear();
+    mNewParametersSeq.clear();
 }
 
 void AudioFlinger::ThreadBase::exit()
@@ -920,24 +1119,300 @@ size_t AudioFlinger::ThreadBase::frameCount() const
 
 status_t AudioFlinger::ThreadBase::setParameters(const String8& keyValuePairs)
 {
-    status_t status;
-
     LOGV("ThreadBase::setParameters() %s", keyValuePairs.string());
     Mutex::Autolock _l(mLock);
 
+    // a transaction only merges the requests carrying its id: the callers
+    // in mediaserver all share its pid
+    AudioParameter param = AudioParameter(keyValuePairs);
+    String8 others = keyValuePairs;
+    String8 key = String8(kKeyParameterTransactionId);
+    int id = 0;
+    if (param.getInt(key, id) == NO_ERROR) {
+        param.remove(key);
+        others = param.toString();
+    }
+    key = String8(kKeyParameterTransaction);
+    String8 value;
+    if (param.get(key, value) == NO_ERROR) {
+        // the other pairs of the request are part of the transaction. The
+        // begin is a getParameters() returning the id.
+        if (value != "commit") {
+            return BAD_VALUE;
+        }
+        param.remove(key);
+        others = param.toString();
+        if (others.length() != 0 && mParamTransactionDepth != 0 &&
+                mParamTransactionId == id) {
+            mergeParameters_l(others);
+        }
+        return commitParameters_l(id);
+    }
+
+    if (mParamTransactionDepth != 0 && mParamTransactionId == id) {
+        // the status of the request is returned by the commit
+        mergeParameters_l(others);
+        return NO_ERROR;
+    }
+    // other requests are applied after the transaction and get their own status
+    waitParameterTransaction_l(id);
+    return queueParameters_l(others);
+}
+
+int AudioFlinger::ThreadBase::beginParameters(int id)
+{
+    Mutex::Autolock _l(mLock);
+    return beginParameters_l(id);
+}
+
+status_t AudioFlinger::ThreadBase::commitParameters(int id)
+{
+    Mutex::Autolock _l(mLock);
+    return commitParameters_l(id);
+}
+
+// beginParameters_l() must be called with ThreadBase::mLock held
+int AudioFlinger::ThreadBase::beginParameters_l(int id)
+{
+    waitParameterTransaction_l(id);
+    if (mParamTransactionDepth++ == 0) {
+        // never 0, which no transaction matches
+        if (++mLastParamTransactionId <= 0) {
+            mLastParamTransactionId = 1;
+        }
+        mParamTransactionId = mLastParamTransactionId;
+        mParamTransactionStart = systemTime();
+        mParamTransaction = AudioParameter();
+        mParamTransactionRequests = 0;
+        mParamTransactionReconfigs = 0;
+        mExpiredTransactionId = 0;
+        android_atomic_write(1, &mParamTransactionOpen);
+        // an idle thread loop goes back to sleep with the transaction timeout
+        mWaitWorkCV.signal();
+    }
+    return mParamTransactionId;
+}
+
+// commitParameters_l() must be called with ThreadBase::mLock held
+status_t AudioFlinger::ThreadBase::commitParameters_l(int id)
+{
+    if (mParamTransactionDepth == 0 || mParamTransactionId != id) {
+        if (id != 0 && mExpiredTransactionId == id) {
+            // the requests were applied when the transaction expired
+            mExpiredTransactionId = 0;
+            return TIMED_OUT;
+        }
+        return INVALID_OPERATION;
+    }
+    if (--mParamTransactionDepth != 0) {
+        return NO_ERROR;
+    }
+
+    String8 keyValuePairs = endParameterTransaction_l();
+    if (keyValuePairs.length() == 0) {
+        return NO_ERROR;
+    }
+    return queueParameters_l(keyValuePairs);
+}
+
+// endParameterTransaction_l() must be called with ThreadBase::mLock held. Closes the
+// open transaction, wakes up the clients waiting for it and returns the merged
+// key value pairs, empty if nothing was set.
+String8 AudioFlinger::ThreadBase::endParameterTransaction_l()
+{
+    String8 keyValuePairs;
+    if (mParamTransactionRequests != 0) {
+        keyValuePairs = mParamTransaction.toString();
+        LOGV("commitParameters() %d requests merged: %s", mParamTransactionRequests,
+                keyValuePairs.string());
+        mNumParamTransactions++;
+        mNumMergedParams += mParamTransactionRequests;
+        // each request reconfiguring the output would have had its own standby cycle
+        if (mParamTransactionReconfigs > 1) {
+            mNumStandbyCyclesSaved += mParamTransactionReconfigs - 1;
+        }
+    }
+    mParamTransaction = AudioParameter();
+    mParamTransactionRequests = 0;
+    mParamTransactionReconfigs = 0;
+    mParamTransactionDepth = 0;
+    mParamTransactionId = 0;
+    android_atomic_write(0, &mParamTransactionOpen);
+    mParamTransactionCond.broadcast();
+    return keyValuePairs;
+}
+
+// expireParameters_l() must be called with ThreadBase::mLock held. Queues the requests
+// of a transaction not committed in time without waiting for them to be applied:
+// the client opening it may have died. A late commit returns TIMED_OUT.
+void AudioFlinger::ThreadBase::expireParameters_l()
+{
+    LOGW("parameter transaction %d of thread %d not committed, applying %d requests",
+            mParamTransactionId, mId, mParamTransactionRequests);
+    mNumExpiredTransactions++;
+    mExpiredTransactionId = mParamTransactionId;
+    String8 keyValuePairs = endParameterTransaction_l();
+    if (keyValuePairs.length() != 0) {
+        mNewParameters.add(keyValuePairs);
+        mNewParametersSeq.add(0);
+        android_atomic_inc(&mPendingRequests);
+        mWaitWorkCV.signal();
+    }
+}
+
+// waitParameterTransaction_l() must be called with ThreadBase::mLock held. Returns once
+// no transaction other than id is open, expiring it if it is not committed in time.
+void AudioFlinger::ThreadBase::waitParameterTransaction_l(int id)
+{
+    while (mParamTransactionDepth != 0 && mParamTransactionId != id) {
+        nsecs_t left = mParamTransactionStart + kParamTransactionTimeout - systemTime();
+        if (left <= 0) {
+            expireParameters_l();
+            break;
+        }
+        mParamTransactionCond.waitRelative(mLock, left);
+    }
+}
+
+// checkParameterTransaction_l() must be called with ThreadBase::mLock held, by the
+// thread loop so that a transaction expires even if no other request comes
+void AudioFlinger::ThreadBase::checkParameterTransaction_l()
+{
+    if (mParamTransactionDepth != 0 &&
+            systemTime() - mParamTransactionStart >= kParamTransactionTimeout) {
+        expireParameters_l();
+    }
+}
+
+// same as checkParameterTransaction_l() for the thread loops not taking mLock
+// on each period: mLock is only taken while a transaction is open
+void AudioFlinger::ThreadBase::checkParameterTransaction()
+{
+    if (mParamTransactionOpen != 0) {
+        Mutex::Autolock _l(mLock);
+        checkParameterTransaction_l();
+    }
+}
+
+// waitWork_l() must be called with ThreadBase::mLock held: the idle wait of the thread
+// loops, bounded by the timeout of an open parameter transaction
+void AudioFlinger::ThreadBase::waitWork_l()
+{
+    if (mParamTransactionDepth == 0) {
+        mWaitWorkCV.wait(mLock);
+        return;
+    }
+    nsecs_t left = mParamTransactionStart + kParamTransactionTimeout - systemTime();
+    if (left > 0) {
+        mWaitWorkCV.waitRelative(mLock, left);
+    }
+}
+
+// mergeParameters_l() must be called with ThreadBase::mLock held. The value of a key
+// already in the transaction is replaced.
+void AudioFlinger::ThreadBase::mergeParameters_l(const String8& keyValuePairs)
+{
+    static const char* const reconfigKeys[] = {
+        AudioParameter::keyRouting,
+        AudioParameter::keySamplingRate,
+        AudioParameter::keyFormat,
+        AudioParameter::keyChannels,
+        AudioParameter::keyFrameCount
+    };
+
+    bool reconfig = false;
+    char *str = strdup(keyValuePairs.string());
+    char *last;
+    for (char *pair = strtok_r(str, ";", &last); pair != NULL;
+            pair = strtok_r(NULL, ";", &last)) {
+        String8 key;
+        String8 value;
+        char *eq = strchr(pair, '=');
+        if (eq != NULL) {
+            key = String8(pair, eq - pair);
+            value = String8(eq + 1);
+        } else {
+            key = String8(pair);
+        }
+        if (key.length() == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(reconfigKeys) / sizeof(reconfigKeys[0]); i++) {
+            if (key == reconfigKeys[i]) {
+                reconfig = true;
+            }
+        }
+        mParamTransaction.remove(key);
+        mParamTransaction.add(key, value);
+    }
+    free(str);
+
+    mParamTransactionRequests++;
+    if (reconfig) {
+        mParamTransactionReconfigs++;
+    }
+}
+
+// queueParameters_l() must be called with ThreadBase::mLock held. Returns the status
+// of this request: several clients can wait at the same time, each request has
+// a sequence number matched by replyParameters_l().
+status_t AudioFlinger::ThreadBase::queueParameters_l(const String8& keyValuePairs)
+{
+    if (++mParamSeq == 0) {
+        // 0 is for the requests nobody waits for
+        mParamSeq = 1;
+    }
+    uint32_t seq = mParamSeq;
+
     mNewParameters.add(keyValuePairs);
+    mNewParametersSeq.add(seq);
+    android_atomic_inc(&mPendingRequests);
     mWaitWorkCV.signal();
     // wait condition with timeout in case the thread loop has exited
     // before the request could be processed
-    if (mParamCond.waitRelative(mLock, seconds(2)) == NO_ERROR) {
-        status = mParamStatus;
-        mWaitWorkCV.signal();
-    } else {
-        status = TIMED_OUT;
+    nsecs_t deadline = systemTime() + seconds(2);
+    while (mParamReplySeq != seq) {
+        nsecs_t left = deadline - systemTime();
+        if (left <= 0 || mParamCond.waitRelative(mLock, left) != NO_ERROR) {
+            if (mParamReplySeq == seq) {
+                break;
+            }
+            return TIMED_OUT;
+        }
     }
+    status_t status = mParamStatus;
+    mParamReplySeq = 0;
+    mWaitWorkCV.signal();
     return status;
 }
 
+// replyParameters_l() must be called with ThreadBase::mLock held, by the
+// checkForNewParameters_l() pass that applied the first pending request
+void AudioFlinger::ThreadBase::replyParameters_l(status_t status)
+{
+    uint32_t seq = mNewParametersSeq[0];
+    mNewParameters.removeAt(0);
+    mNewParametersSeq.removeAt(0);
+    if (seq == 0) {
+        // an expired transaction, see expireParameters_l()
+        if (status != NO_ERROR) {
+            LOGW("expired parameter transaction of thread %d failed: %d", mId, status);
+        }
+        return;
+    }
+
+    mParamStatus = status;
+    mParamReplySeq = seq;
+    mParamCond.broadcast();
+    // wait for the client to read mParamStatus, unless it timed out and left
+    while (mParamReplySeq == seq) {
+        if (mWaitWorkCV.waitRelative(mLock, seconds(2)) != NO_ERROR) {
+            mParamReplySeq = 0;
+            break;
+        }
+    }
+}
+
 void AudioFlinger::ThreadBase::sendConfigEvent(int event, int param)
 {
     Mutex::Autolock _l(mLock);
@@ -951,6 +1426,7 @@ void AudioFlinger::ThreadBase::sendConfigEvent_l(int event, int param)
     configEvent->mEvent = event;
     configEvent->mParam = param;
     mConfigEvents.add(configEvent);
+    android_atomic_inc(&mPendingRequests);
     LOGV("sendConfigEvent() num events %d event %d, param %d", mConfigEvents.size(), event, param);
     mWaitWorkCV.signal();
 }
@@ -998,6 +1474,18 @@ status_t AudioFlinger::ThreadBase::dumpBase(int fd, const Vector<String16>& args
     snprintf(buffer, SIZE, "Frame size: %d\n", mFrameSize);
     result.append(buffer);
 
+    snprintf(buffer, SIZE, "Parameter transactions: %u, merged requests: %u, "
+            "expired: %u, standby cycles saved: %u\n",
+            mNumParamTransactions, mNumMergedParams, mNumExpiredTransactions,
+            mNumStandbyCyclesSaved);
+    result.append(buffer);
+    if (mParamTransactionDepth != 0) {
+        snprintf(buffer, SIZE, "Open transaction: id %d, depth %d, %u requests, %lld ms old\n",
+                mParamTransactionId, mParamTransactionDepth, mParamTransactionRequests,
+                ns2ms(systemTime() - mParamTransactionStart));
+        result.append(buffer);
+    }
+
     snprintf(buffer, SIZE, "\nPending setParameters commands: \n");
     result.append(buffer);
     result.append(" Index Command");
@@ -1031,7 +1519,10 @@ status_t AudioFlinger::ThreadBase::dumpBase(int fd, const Vector<String16>& args
 AudioFlinger::PlaybackThread::PlaybackThread(const sp<AudioFlinger>& audioFlinger, AudioStreamOutWrapper* output, int id)
     :   ThreadBase(audioFlinger, id),
         mMixBuffer(0), mSuspended(0), mBytesWritten(0), mOutput(output),
-        mLastWriteTime(0), mNumWrites(0), mNumDelayedWrites(0), mInWrite(false)
+        mUseTrackCommands(false), mTrackResync(0), mNumTrackCommands(0),
+        mNumDeferredRemovals(0), mNumTrackResyncs(0), mResetLatency(0),
+        mLastWriteTime(0), mNumWrites(0), mNumDelayedWrites(0), mInWrite(false),
+        mNumSlotHits(0), mNumSlotMisses(0), mNumSlotEvictions(0)
 {
     readOutputParameters();
 
@@ -1088,6 +1579,20 @@ status_t AudioFlinger::PlaybackThread::dumpTracks(int fd, const Vector<String16>
             }
         }
     }
+
+    snprintf(buffer, SIZE, "Output thread %p track CPU time\n", this);
+    result.append(buffer);
+    // the periods mixed directly are timed per track, the AudioMixer ones
+    // are split equally between the tracks mixed
+    result.append("   (time of AudioMixer periods is split equally, shown as estimated)\n");
+    result.append("   Name Clien Cost\n");
+    for (size_t i = 0; i < mTracks.size(); ++i) {
+        sp<Track> track = mTracks[i];
+        if (track != 0) {
+            track->dumpCost(buffer, SIZE);
+            result.append(buffer);
+        }
+    }
     write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -1110,6 +1615,38 @@ status_t AudioFlinger::PlaybackThread::dumpInternals(int fd, const Vector<String
     result.append(buffer);
     snprintf(buffer, SIZE, "suspend count: %d\n", mSuspended);
     result.append(buffer);
+    uint32_t lookups = mNumSlotHits + mNumSlotMisses;
+    snprintf(buffer, SIZE, "track slots: %d cached, %u hits, %u misses (%u%% hit rate), "
+            "%u evicted\n",
+            mTrackSlots.size(), mNumSlotHits, mNumSlotMisses,
+            lookups ? (mNumSlotHits * 100) / lookups : 0, mNumSlotEvictions);
+    result.append(buffer);
+
+    result.append("period latency (usecs):\n");
+    result.append("  stage        count     p50     p99     max\n");
+    mConfigLatency.dump(buffer, SIZE, "config");
+    result.append(buffer);
+    mPrepareLatency.dump(buffer, SIZE, "prepare");
+    result.append(buffer);
+    mMixLatency.dump(buffer, SIZE, "mix");
+    result.append(buffer);
+    mWriteLatency.dump(buffer, SIZE, "write");
+    result.append(buffer);
+    if (mCreateLatency.count() != 0) {
+        result.append("createTrack latency (usecs):\n");
+        result.append("  stage        count     p50     p99     max\n");
+        mCreateLatency.dump(buffer, SIZE, "create");
+        result.append(buffer);
+    }
+
+    // "dumpsys media.audio_flinger --reset-latency" clears the histograms
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == String16("--reset-latency")) {
+            android_atomic_or(1, &mResetLatency);
+            result.append("period latency reset requested\n");
+            break;
+        }
+    }
     write(fd, result.string(), result.size());
 
     dumpBase(fd, args);
@@ -1146,11 +1683,13 @@ sp<AudioFlinger::PlaybackThread::Track>  AudioFlinger::PlaybackThread::createTra
         int format,
         int channelCount,
         int frameCount,
+        uint32_t flags,
         const sp<IMemory>& sharedBuffer,
         status_t *status)
 {
     sp<Track> track;
     status_t lStatus;
+    nsecs_t start = systemTime();
 
     if (mType == DIRECT) {
         if (sampleRate != mSampleRate || format != mFormat || channelCount != mChannelCount) {
@@ -1177,13 +1716,37 @@ sp<AudioFlinger::PlaybackThread::Track>  AudioFlinger::PlaybackThread::createTra
 
     { // scope for mLock
         Mutex::Autolock _l(mLock);
+        if (flags & TrackBase::FAST_TRACK) {
+            // fast tracks are mixed as is by a mixer thread: anything else
+            // plays as a normal track
+            int fastTracks = 0;
+            for (size_t i = 0; i < mTracks.size(); i++) {
+                if (mTracks[i]->isFastTrack()) {
+                    fastTracks++;
+                }
+            }
+            if (mType != MIXER || sampleRate != mSampleRate ||
+                    format != AudioSystem::PCM_16_BIT || channelCount > 2 ||
+                    fastTracks >= kMaxFastTracks) {
+                LOGW("createTrack_l() fast track refused: sampleRate %d format %d, "
+                        "channelCount %d, %d fast tracks on output %p",
+                        sampleRate, format, channelCount, fastTracks, mOutput);
+                flags &= ~TrackBase::FAST_TRACK;
+            }
+        }
+        sp<IMemory> cblkMemory;
+        if (client != 0 && sharedBuffer == 0) {
+            cblkMemory = takeTrackSlot_l(client, frameCount, format, channelCount);
+        }
         track = new Track(this, client, streamType, sampleRate, format,
-                channelCount, frameCount, sharedBuffer);
+                channelCount, frameCount, flags, sharedBuffer, cblkMemory);
         if (track->getCblk() == NULL || track->name() < 0) {
             lStatus = NO_MEMORY;
             goto Exit;
         }
+        allocateTrackBuffers_l(track.get());
         mTracks.add(track);
+        mCreateLatency.add(systemTime() - start);
     }
     lStatus = NO_ERROR;
 
@@ -1307,6 +1870,7 @@ status_t AudioFlinger::PlaybackThread::addTrack_l(const sp<Track>& track)
         track->mFillingUpStatus = Track::FS_FILLING;
         track->mResetDone = false;
         mActiveTracks.add(track);
+        postTrackCommand(TrackCommandQueue::ADD, track);
 
 	int stream = track->type();
         mAudioFlinger->mAudioHardware->setStreamMute(stream, streamMute(stream));
@@ -1321,6 +1885,85 @@ status_t AudioFlinger::PlaybackThread::addTrack_l(const sp<Track>& track)
     return status;
 }
 
+// checkLatencyReset() is called by the playback thread at the beginning of each period
+void AudioFlinger::PlaybackThread::checkLatencyReset()
+{
+    if (UNLIKELY(android_atomic_swap(0, &mResetLatency) != 0)) {
+        mConfigLatency.reset();
+        mPrepareLatency.reset();
+        mMixLatency.reset();
+        mWriteLatency.reset();
+        mFastLatencyEstimate.reset();
+    }
+}
+
+// cacheTrackSlot_l() is called by the Track destructor with ThreadBase::mLock held
+void AudioFlinger::PlaybackThread::cacheTrackSlot_l(const Track* track)
+{
+    if (track->mClient == 0 || track->mSharedBuffer != 0 ||
+            track->mCblkMemory == 0 || track->mCblk == NULL) {
+        return;
+    }
+    nsecs_t now = systemTime();
+    expireTrackSlots_l(now);
+    if (mTrackSlots.size() >= kMaxTrackSlots) {
+        // slots are in destruction order: drop the oldest
+        mTrackSlots.removeAt(0);
+        mNumSlotEvictions++;
+    }
+    track_slot_t slot;
+    slot.heap = track->mClient->heap().get();
+    slot.memory = track->mCblkMemory;
+    slot.frameCount = track->mCblk->frameCount;
+    slot.format = track->mFormat;
+    slot.channelCount = track->mCblk->channels;
+    slot.time = now;
+    mTrackSlots.add(slot);
+}
+
+// takeTrackSlot_l() must be called with ThreadBase::mLock held. The memory
+// returned is reset by the TrackBase constructor.
+sp<IMemory> AudioFlinger::PlaybackThread::takeTrackSlot_l(const sp<Client>& client,
+        int frameCount, int format, int channelCount)
+{
+    expireTrackSlots_l(systemTime());
+    // the memory of a slot is mapped by its client only
+    AudioClientHeap* heap = client->heap().get();
+    for (size_t i = mTrackSlots.size(); i > 0; ) {
+        i--;
+        const track_slot_t& slot = mTrackSlots[i];
+        if (slot.heap == heap && slot.frameCount == frameCount &&
+                slot.format == format && slot.channelCount == channelCount) {
+            sp<IMemory> memory = slot.memory;
+            mTrackSlots.removeAt(i);
+            mNumSlotHits++;
+            return memory;
+        }
+    }
+    mNumSlotMisses++;
+    return 0;
+}
+
+// expireTrackSlots_l() must be called with ThreadBase::mLock held
+void AudioFlinger::PlaybackThread::expireTrackSlots_l(nsecs_t now)
+{
+    while (!mTrackSlots.isEmpty() && now - mTrackSlots[0].time > kTrackSlotMaxAge) {
+        mTrackSlots.removeAt(0);
+    }
+}
+
+// postTrackCommand() is called with ThreadBase::mLock held after mActiveTracks
+// was modified. It never blocks: if the queue is full the mixer thread is told
+// to rebuild its track list from mActiveTracks.
+void AudioFlinger::PlaybackThread::postTrackCommand(int command, const sp<Track>& track)
+{
+    if (!mUseTrackCommands) return;
+    if (!mTrackCommands.push(command, track)) {
+        LOGW("track command queue full on thread %p, requesting resync", this);
+        android_atomic_or(1, &mTrackResync);
+    }
+}
+
 // destroyTrack_l() must be called with ThreadBase::mLock held
 void AudioFlinger::PlaybackThread::destroyTrack_l(const sp<Track>& track)
 {
@@ -1395,12 +2038,60 @@ status_t AudioFlinger::PlaybackThread::getRenderPosition(uint32_t *halFrames, ui
 
 // ----------------------------------------------------------------------------
 
+// resampler tier of the tracks not asking for one, from ro.audio.resampler_quality
+static int defaultResamplerTier()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.audio.resampler_quality", value, "default");
+    int tier = AudioResamplerPolyphase::tierFromString(value);
+    if (tier < 0) {
+        LOGW("unknown resampler quality %s", value);
+        tier = AudioResamplerPolyphase::TIER_DEFAULT;
+    }
+    return tier;
+}
+
 AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, AudioStreamOutWrapper* output, int id)
     :   PlaybackThread(audioFlinger, output, id),
-        mAudioMixer(0)
+        mAudioMixer(0), mTrackNames(0), mDeletedNames(0),
+        mStandbyPolicy(kStandbyTimeInNsecs), mMixerPool(0), mPoolThreshold(0),
+        mResamplerTier(AudioResamplerPolyphase::TIER_DEFAULT),
+        mMaxResamplerTier(AudioResamplerPolyphase::TIER_HIGH),
+        mResampleBuffer(0), mResampleLoad(0),
+        mResampleLoadPeriods(0), mNumTierChanges(0), mMixerTracksReady(false),
+        mFastSubPeriods(kDefaultFastSubPeriods), mFastUpmixBuffer(0),
+        mNumFastTaps(0), mNumFastTracks(0), mNumFastUnderruns(0),
+        mNumSkippedTracks(0), mNumSkippedFrames(0), mNumSkippedMixes(0),
+        mDeepBufferMs(0), mDeepBuffer(0), mDeepBufferFrames(0), mNumDeepBatches(0),
+        mNumDeepPeriods(0), mDirectMix(true), mDirectPeriod(false), mNumDirectJobs(0),
+        mMixSums(0), mMixTemp(0), mNumDirectPeriods(0)
 {
     mType = PlaybackThread::MIXER;
+    mUseTrackCommands = true;
+    memset(&mDither, 0, sizeof(mDither));
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.audio.mixer_pool_threshold", value, "0");
+    mPoolThreshold = atoi(value);
+
+    property_get("ro.audio.direct_mix", value, "1");
+    mDirectMix = (atoi(value) != 0);
+
+    property_get("ro.audio.fast_subperiods", value, "4");
+    mFastSubPeriods = atoi(value);
+    if (mFastSubPeriods < 1 || mFastSubPeriods > kMaxFastSubPeriods) {
+        mFastSubPeriods = kDefaultFastSubPeriods;
+    }
+
+    mResamplerTier = defaultResamplerTier();
+    memset(mResampleCpu, 0, sizeof(mResampleCpu));
+    memset(mResampleFrames, 0, sizeof(mResampleFrames));
+    AudioResamplerPolyphase::preloadTables(mSampleRate, mResamplerTier);
+
+    AudioMixerSimd::init();
     mAudioMixer = new AudioMixer(mFrameCount, mSampleRate, audioFlinger->mDsp);
+    allocateMixBuffers();
+    mStandbyPolicy.setPeriod(seconds(mFrameCount) / mSampleRate);
 
     // FIXME - Current mixer implementation only supports stereo output
     if (mChannelCount == 1) {
@@ -1410,7 +2101,56 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
 
 AudioFlinger::MixerThread::~MixerThread()
 {
+    delete mMixerPool;
     delete mAudioMixer;
+    delete[] mResampleBuffer;
+    delete[] mFastUpmixBuffer;
+    delete[] mDeepBuffer;
+    delete[] mMixSums;
+    delete[] mMixTemp;
+}
+
+// allocateMixBuffers() allocates the buffers that depend on the output frame
+// count, so that none is allocated by the mixer thread while it mixes
+void AudioFlinger::MixerThread::allocateMixBuffers()
+{
+    delete[] mMixSums;
+    delete[] mMixTemp;
+    delete[] mResampleBuffer;
+    delete[] mFastUpmixBuffer;
+    mMixSums = new int32_t[mFrameCount * 2];
+    mMixTemp = new int32_t[mFrameCount * 2];
+    mResampleBuffer = new int32_t[mFrameCount * 2];
+    mFastUpmixBuffer = new int16_t[mFrameCount * 2];
+    allocateDeepBuffer();
+}
+
+// allocateDeepBuffer() sizes mDeepBuffer for a batch of deepBufferPeriods(),
+// at most kMaxDeepBufferMs of audio, and frees it when the mode is off. Called
+// when the duration or the output frame count or rate change.
+void AudioFlinger::MixerThread::allocateDeepBuffer()
+{
+    int periods = deepBufferPeriods();
+    size_t frames = (periods > 1) ? periods * mFrameCount : 0;
+    if (frames != mDeepBufferFrames) {
+        delete[] mDeepBuffer;
+        mDeepBuffer = (frames != 0) ? new int16_t[frames * 2] : NULL;
+        mDeepBufferFrames = frames;
+    }
+}
+
+// must be called before the thread is started
+void AudioFlinger::MixerThread::setDeepBuffer(uint32_t ms)
+{
+    mDeepBufferMs = ms;
+    allocateDeepBuffer();
+}
+
+// allocateTrackBuffers_l() must be called with ThreadBase::mLock held, by the
+// binder threads adding the track or after the output frame count or rate changed
+void AudioFlinger::MixerThread::allocateTrackBuffers_l(Track* track)
+{
+    track->allocateResampler(mFrameCount, mSampleRate, track->resamplerTier(mResamplerTier));
 }
 
 bool AudioFlinger::MixerThread::threadLoop()
@@ -1420,54 +2160,83 @@ bool AudioFlinger::MixerThread::threadLoop()
     uint32_t mixerStatus = MIXER_IDLE;
     nsecs_t standbyTime = systemTime();
     size_t mixBufferSize = mFrameCount * mFrameSize;
-    // FIXME: Relaxed timing because of a certain device that can't meet latency
-    // Should be reduced to 2x after the vendor fixes the driver issue
-    nsecs_t maxPeriod = seconds(mFrameCount) / mSampleRate * 3;
+    nsecs_t maxPeriod = mStandbyPolicy.maxPeriod();
     nsecs_t lastWarning = 0;
     bool longStandbyExit = false;
+    bool active = false;
     uint32_t activeSleepTime = activeSleepTimeUs();
     uint32_t idleSleepTime = idleSleepTimeUs();
     uint32_t sleepTime = idleSleepTime;
+    int deepPeriods = deepBufferPeriods();
 
     while (!exitPending())
     {
-        processConfigEvents();
+        checkLatencyReset();
+        nsecs_t periodStart = systemTime();
 
-        mixerStatus = MIXER_IDLE;
-        { // scope for mLock
+        // mLock is only taken when a binder thread queued a request for this
+        // thread or before going idle, so that a slow binder call holding it
+        // can not delay a mix period.
+        checkParameterTransaction();
+        if (android_atomic_swap(0, &mPendingRequests) != 0) {
+            processConfigEvents();
 
             Mutex::Autolock _l(mLock);
 
             if (checkForNewParameters_l()) {
                 mixBufferSize = mFrameCount * mFrameSize;
-                // FIXME: Relaxed timing because of a certain device that can't meet latency
-                // Should be reduced to 2x after the vendor fixes the driver issue
-                maxPeriod = seconds(mFrameCount) / mSampleRate * 3;
+                maxPeriod = mStandbyPolicy.maxPeriod();
                 activeSleepTime = activeSleepTimeUs();
                 idleSleepTime = idleSleepTimeUs();
+                deepPeriods = deepBufferPeriods();
             }
+            updateMixerPool();
+        }
 
-            const SortedVector< wp<Track> >& activeTracks = mActiveTracks;
+        processTrackCommands();
 
-            // put audio hardware into standby after short delay
-            if UNLIKELY((!activeTracks.size() && systemTime() > standbyTime) ||
-                        mSuspended) {
-                if (!mStandby) {
-                    LOGV("Audio hardware entering standby, mixer %p, mSuspended %d\n", this, mSuspended);
-                    mOutput->standby();
-                    mStandby = true;
-                    mBytesWritten = 0;
-                }
+        nsecs_t prepareStart = systemTime();
+        mConfigLatency.add(prepareStart - periodStart);
 
-                if (!activeTracks.size() && mConfigEvents.isEmpty()) {
-                    // we're about to wait, flush the binder command buffer
+        mixerStatus = MIXER_IDLE;
+        const SortedVector< wp<Track> >& activeTracks = mMixerTracks;
+
+        // let the standby policy observe the gaps between tracks
+        if (active != (activeTracks.size() != 0)) {
+            active = !active;
+            if (active) {
+                mStandbyPolicy.onActive(prepareStart);
+            } else {
+                mStandbyPolicy.onIdle(prepareStart);
+            }
+            idleSleepTime = idleSleepTimeUs();
+        }
+
+        // put audio hardware into standby after short delay
+        if UNLIKELY((!activeTracks.size() && systemTime() > standbyTime) ||
+                    mSuspended) {
+            if (!mStandby) {
+                LOGV("Audio hardware entering standby, mixer %p, mSuspended %d\n", this, mSuspended);
+                mOutput->standby();
+                mStandby = true;
+                mBytesWritten = 0;
+            }
+
+            if (!activeTracks.size()) {
+                Mutex::Autolock _l(mLock);
+
+                // binder threads post track commands and config events with
+                // mLock held: check again before waiting
+                if (mTrackCommands.isEmpty() && !mTrackResync && mDeletedNames == 0 &&
+                        mConfigEvents.isEmpty() && mNewParameters.isEmpty()) {
+                    // we're about to wait, flush the binder command buffer
                     IPCThreadState::self()->flushCommands();
 
                     if (exitPending()) break;
 
                     // wait until we have something to do...
                     LOGV("MixerThread %p TID %d going to sleep\n", this, gettid());
-                    mWaitWorkCV.wait(mLock);
+                    waitWork_l();
                     LOGV("MixerThread %p TID %d waking up\n", this, gettid());
 
                     if (mMasterMute == false) {
@@ -1479,20 +2248,48 @@ bool AudioFlinger::MixerThread::threadLoop()
                         }
                     }
 
-                    standbyTime = systemTime() + kStandbyTimeInNsecs;
+                    standbyTime = systemTime() + mStandbyPolicy.standbyDelay();
                     sleepTime = idleSleepTime;
                     continue;
                 }
             }
+        }
 
-            mixerStatus = prepareTracks_l(activeTracks, &tracksToRemove);
-       }
+        mixerStatus = prepareTracks(activeTracks, &tracksToRemove);
+
+        nsecs_t mixStart = systemTime();
+        mPrepareLatency.add(mixStart - prepareStart);
 
+        curBuf = mMixBuffer;
+        size_t batchPeriods = 1;
         if (LIKELY(mixerStatus == MIXER_TRACKS_READY)) {
+            // in deep buffer mode, periods are mixed back to back and written
+            // at once for as long as only latency tolerant tracks play
+            // mDeepBuffer is allocated when the mode is configured
+            if (deepPeriods > 1 && mFastTracks.isEmpty() && deepBatchReady(activeTracks, 2)) {
+                curBuf = mDeepBuffer;
+            }
             // mix buffers...
-            mAudioMixer->process(curBuf);
+            mixPeriod(curBuf, mixBufferSize);
+            if (curBuf == mDeepBuffer) {
+                while (batchPeriods < (size_t)deepPeriods && tracksToRemove.isEmpty()) {
+                    // a latency sensitive track started since the batch began
+                    // ends it: it is mixed by the next normal period
+                    processTrackCommands();
+                    if (!deepBatchReady(activeTracks, 1) ||
+                            prepareTracks(activeTracks, &tracksToRemove) != MIXER_TRACKS_READY) {
+                        break;
+                    }
+                    mixPeriod(curBuf + batchPeriods * mFrameCount * 2, mixBufferSize);
+                    batchPeriods++;
+                }
+                mNumDeepBatches++;
+                mNumDeepPeriods += batchPeriods;
+            }
+            nsecs_t mixEnd = systemTime();
+            mMixLatency.add(mixEnd - mixStart);
             sleepTime = 0;
-            standbyTime = systemTime() + kStandbyTimeInNsecs;
+            standbyTime = mixEnd + mStandbyPolicy.standbyDelay();
         } else {
             // If no tracks are ready, sleep once for the duration of an output
             // buffer size, then write 0s to the output
@@ -1515,22 +2312,32 @@ bool AudioFlinger::MixerThread::threadLoop()
         }
         // sleepTime == 0 means we must write to audio hardware
         if (sleepTime == 0) {
+            size_t writeSize = mixBufferSize * batchPeriods;
             mLastWriteTime = systemTime();
             mInWrite = true;
-            mBytesWritten += mixBufferSize;
+            mBytesWritten += writeSize;
+            int bytesWritten;
+            if (mFastTracks.isEmpty()) {
 #ifdef LVMX
-            int audioOutputType = LifeVibes::getMixerType(mId, mType);
-            if (LifeVibes::audioOutputTypeIsLifeVibes(audioOutputType)) {
-               LifeVibes::process(audioOutputType, curBuf, mixBufferSize);
-            }
+                int audioOutputType = LifeVibes::getMixerType(mId, mType);
+                if (LifeVibes::audioOutputTypeIsLifeVibes(audioOutputType)) {
+                   LifeVibes::process(audioOutputType, curBuf, writeSize);
+                }
 #endif
-            int bytesWritten = (int)mOutput->write(curBuf, mixBufferSize);
-            if (bytesWritten < 0) mBytesWritten -= mixBufferSize;
+                bytesWritten = (int)mOutput->write(curBuf, writeSize);
+            } else {
+                bytesWritten = (int)writeFastSubPeriods(curBuf);
+            }
+            if (bytesWritten < 0) mBytesWritten -= writeSize;
             mNumWrites++;
             mInWrite = false;
             nsecs_t now = systemTime();
             nsecs_t delta = now - mLastWriteTime;
-            if (delta > maxPeriod) {
+            mWriteLatency.add(delta);
+            if (mStandby) {
+                mStandbyPolicy.onStandbyExit(delta);
+            }
+            if (delta > maxPeriod * (nsecs_t)batchPeriods) {
                 mNumDelayedWrites++;
                 if ((now - lastWarning) > kWarningThrottle) {
                     LOGW("write blocked for %llu msecs, %d delayed writes, thread %p",
@@ -1550,6 +2357,7 @@ bool AudioFlinger::MixerThread::threadLoop()
         // since we can't guarantee the destructors won't acquire that
         // same lock.
         tracksToRemove.clear();
+        mFastTracks.clear();
     }
 
     if (!mStandby) {
@@ -1560,8 +2368,57 @@ bool AudioFlinger::MixerThread::threadLoop()
     return false;
 }
 
-// prepareTracks_l() must be called with ThreadBase::mLock held
-uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track> >& activeTracks, Vector< sp<Track> > *tracksToRemove)
+// processTrackCommands() is called by the mixer thread at the beginning of each
+// period to apply the changes made to mActiveTracks since the previous period
+// to mMixerTracks.
+void AudioFlinger::MixerThread::processTrackCommands()
+{
+    int command;
+    sp<Track> track;
+
+    // the track of a deleted name was removed from mActiveTracks before, so
+    // its removal is seen below and the name is only freed once the track
+    // is out of mMixerTracks
+    int32_t deletedNames = android_atomic_swap(0, &mDeletedNames);
+
+    if (UNLIKELY(android_atomic_swap(0, &mTrackResync) != 0)) {
+        // the queue overflowed: discard it and copy mActiveTracks. Commands
+        // posted after the copy are replayed next period, which is harmless
+        // as adding or removing a track twice has no effect.
+        while (mTrackCommands.pop(&command, &track)) {
+        }
+        track.clear();
+
+        Mutex::Autolock _l(mLock);
+        mMixerTracks = mActiveTracks;
+        mNumTrackResyncs++;
+    } else {
+        while (mTrackCommands.pop(&command, &track)) {
+            switch (command) {
+            case TrackCommandQueue::ADD:
+                mMixerTracks.add(track);
+                break;
+            case TrackCommandQueue::REMOVE:
+                mMixerTracks.remove(track);
+                break;
+            }
+            mNumTrackCommands++;
+        }
+    }
+
+    if (UNLIKELY(deletedNames != 0)) {
+        for (uint32_t n = 0; n < AudioMixer::MAX_NUM_TRACKS; n++) {
+            if (deletedNames & (1 << n)) {
+                mAudioMixer->deleteTrackName(AudioMixer::TRACK0 + n);
+            }
+        }
+        android_atomic_and(~deletedNames, &mTrackNames);
+    }
+}
+
+// prepareTracks() is called by the mixer thread without ThreadBase::mLock held.
+// activeTracks must be mMixerTracks.
+uint32_t AudioFlinger::MixerThread::prepareTracks(const SortedVector< wp<Track> >& activeTracks, Vector< sp<Track> > *tracksToRemove)
 {
 
     uint32_t mixerStatus = MIXER_IDLE;
@@ -1570,6 +2427,32 @@ uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track
 
     float masterVolume = mMasterVolume;
     bool  masterMute = mMasterMute;
+    mResampleLoad = 0;
+    mFastTracks.clear();
+    mMixedTracks.clear();
+    mPoolTracks.clear();
+    mMixerTracksReady = false;
+    bool tracksSkipped = false;
+
+    // AudioMixer mixes the whole period if one track needs it: the outputs of
+    // AudioMixer and of mixDirect() are both clamped and cannot be summed
+    // without changing the result
+    bool directMix = mDirectMix;
+    for (size_t i = 0; directMix && i < count; i++) {
+        sp<Track> t = activeTracks[i].promote();
+        if (t == 0) continue;
+        uint32_t sampleRate = t->cblk()->sampleRate;
+        if (t->format() != AudioSystem::PCM_16_BIT || (sampleRate != mSampleRate &&
+                !AudioResamplerPolyphase::isSupported(sampleRate, mSampleRate))) {
+            directMix = false;
+        }
+    }
+    mDirectPeriod = directMix;
+    mNumDirectJobs = 0;
+    // the worker pool mixes resampled tracks when there are enough of them,
+    // its accumulators are added to the sums of mixDirect(), which go through
+    // the AudioDSP chain and the dithering once
+    bool usePool = (directMix && mMixerPool != NULL && count > (size_t)mPoolThreshold);
 
 #ifdef LVMX
     bool tracksConnectedChanged = false;
@@ -1600,7 +2483,22 @@ uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track
         // The first time a track is added we wait
         // for all its buffers to be filled before processing it
         mAudioMixer->setActiveTrack(track->name());
-        if (cblk->framesReady() && (track->isReady() || track->isStopped()) &&
+        if (UNLIKELY(track->mFlushPending)) {
+            // flushed while active: its buffer is not read again, it is reset
+            // and removed below with mLock held
+            mAudioMixer->disable(AudioMixer::MIXING);
+            track->mMixerState.enabled = false;
+            tracksToRemove->add(track);
+            continue;
+        }
+        bool framesReady = (cblk->framesReady() != 0);
+        if (!framesReady && directMix && track->isFastTrack() &&
+                track->mFillingUpStatus == Track::FS_ACTIVE &&
+                track->mRetryCount > 0 && !track->isStopped()) {
+            // frames written during the period are mixed on the next sub-period
+            framesReady = true;
+        }
+        if (framesReady && (track->isReady() || track->isStopped()) &&
                 !track->isPaused() && !track->isTerminated())
         {
             //LOGV("track %d u=%08x, s=%08x [OK] on thread %p", track->name(), cblk->user, cblk->server, this);
@@ -1636,16 +2534,16 @@ uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track
                 right = int16_t(v_clamped);
             }
 
-            // XXX: these things DON'T need to be done each time
-            mAudioMixer->setBufferProvider(track);
-            mAudioMixer->enable(AudioMixer::MIXING);
+            Track::mixer_state_t& state = track->mMixerState;
 
             int param = AudioMixer::VOLUME;
+            // first period after a start or a flush
+            bool restarted = (track->mFillingUpStatus == Track::FS_FILLED);
             if (track->mFillingUpStatus == Track::FS_FILLED) {
                 // no ramp for the first volume setting
                 track->mFillingUpStatus = Track::FS_ACTIVE;
-                if (track->mState == TrackBase::RESUMING) {
-                    track->mState = TrackBase::ACTIVE;
+                if (audioAtomicCmpxchg(TrackBase::RESUMING, TrackBase::ACTIVE,
+                        (volatile int32_t *)&track->mState) == 0) {
                     param = AudioMixer::RAMP_VOLUME;
                 }
             } else if (cblk->server != 0) {
@@ -1660,36 +2558,158 @@ uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track
                  param = AudioMixer::VOLUME;
             }
 #endif
-            mAudioMixer->setParameter(param, AudioMixer::VOLUME0, left);
-            mAudioMixer->setParameter(param, AudioMixer::VOLUME1, right);
-            mAudioMixer->setParameter(
-                AudioMixer::TRACK,
-                AudioMixer::FORMAT, track->format());
-            mAudioMixer->setParameter(
-                AudioMixer::TRACK,
-                AudioMixer::CHANNEL_COUNT, track->channelCount());
-            mAudioMixer->setParameter(
-                AudioMixer::RESAMPLE,
-                AudioMixer::SAMPLE_RATE,
-                int(cblk->sampleRate));
+            // a client changing the rate of a fast track makes it a normal one.
+            // Fast tracks are summed with the period before its output stage,
+            // so AudioMixer mixes them with the others when it mixes the period.
+            if (directMix && track->isFastTrack() && cblk->sampleRate == mSampleRate) {
+                if (state.enabled) {
+                    mAudioMixer->disable(AudioMixer::MIXING);
+                    state.enabled = false;
+                }
+                track->mFastVolume[0] = left;
+                track->mFastVolume[1] = right;
+                // retries count the periods without a frame, not the
+                // periods starting without a frame
+                if (track->mFastMixed || cblk->framesReady()) {
+                    track->mRetryCount = kMaxTrackRetries;
+                } else {
+                    track->mRetryCount--;
+                }
+                track->mFastMixed = false;
+                mFastTracks.add(t);
+                mixerStatus = MIXER_TRACKS_READY;
+                continue;
+            }
+
+            // the first period at zero volume is mixed to complete the ramp
+            // down, the next ones only consume the track
+            bool wasSkipped = (track->mSilentPeriods >= 2);
+            if (left == 0 && right == 0 && !restarted) {
+                if (track->mSilentPeriods < 2) {
+                    track->mSilentPeriods++;
+                }
+            } else {
+                track->mSilentPeriods = 0;
+            }
+            if (track->mSilentPeriods >= 2) {
+                if (state.enabled) {
+                    mAudioMixer->disable(AudioMixer::MIXING);
+                    state.enabled = false;
+                }
+                // the volume kept by AudioMixer is 0: the track ramps up
+                // from silence when it is mixed again
+                track->mMixedDirect = false;
+                mNumSkippedFrames += skipTrack(track);
+                mNumSkippedTracks++;
+                tracksSkipped = true;
+                track->mRetryCount = kMaxTrackRetries;
+                mixerStatus = MIXER_TRACKS_READY;
+                continue;
+            }
+            if (usePool && track->format() == AudioSystem::PCM_16_BIT &&
+                    cblk->sampleRate != mSampleRate &&
+                    queuePoolJob(track, left, right, param)) {
+                // the track is mixed by the worker pool for this period
+                mPoolTracks.add(t);
+                track->mRetryCount = kMaxTrackRetries;
+                mixerStatus = MIXER_TRACKS_READY;
+                mMixerTracksReady = true;
+                continue;
+            }
+            if (track->mMixedDirect && !directMix) {
+                // AudioMixer does not know the volume used by the pool or
+                // mixDirect()
+                track->mMixedDirect = false;
+                param = AudioMixer::VOLUME;
+            }
+
+            // tracks at another rate are resampled here when possible so that
+            // they are mixed as stereo tracks at the output rate
+            AudioBufferProvider* provider = track;
+            int channelCount = track->channelCount();
+            uint32_t sampleRate = cblk->sampleRate;
+            if (sampleRate != mSampleRate && resampleTrack(track, restarted || wasSkipped)) {
+                provider = &track->mResampled;
+                channelCount = 2;
+                sampleRate = mSampleRate;
+            }
+
+            if (directMix) {
+                // a track changing to a rate that cannot be resampled here
+                // since the scan above is mixed by AudioMixer from the next
+                // period on
+                if (sampleRate == mSampleRate &&
+                        queueDirectJob(track, provider, channelCount, left, right, param)) {
+                    mMixedTracks.add(t);
+                    mMixerTracksReady = true;
+                }
+                track->mRetryCount = kMaxTrackRetries;
+                mixerStatus = MIXER_TRACKS_READY;
+                continue;
+            }
+
+            // only reconfigure the mixer for what changed since the last period
+            if (!state.valid || provider != state.provider) {
+                mAudioMixer->setBufferProvider(provider);
+                state.provider = provider;
+                state.enabled = false;
+            }
+            if (!state.enabled) {
+                mAudioMixer->enable(AudioMixer::MIXING);
+                state.enabled = true;
+            }
+            track->mCostRamp = (state.valid && param == AudioMixer::RAMP_VOLUME &&
+                    (left != state.volume[0] || right != state.volume[1]));
+            track->mCostResampled = (sampleRate != mSampleRate);
+            mMixedTracks.add(t);
+
+            // a ramp to the current volume is a no-op but VOLUME must always be
+            // applied as it also cancels any ramp in progress
+            if (!state.valid || param == AudioMixer::VOLUME ||
+                    left != state.volume[0] || right != state.volume[1]) {
+                mAudioMixer->setParameter(param, AudioMixer::VOLUME0, left);
+                mAudioMixer->setParameter(param, AudioMixer::VOLUME1, right);
+                state.volume[0] = left;
+                state.volume[1] = right;
+            }
+            if (!state.valid || track->format() != state.format) {
+                mAudioMixer->setParameter(
+                    AudioMixer::TRACK,
+                    AudioMixer::FORMAT, track->format());
+                state.format = track->format();
+            }
+            if (!state.valid || channelCount != state.channelCount) {
+                mAudioMixer->setParameter(
+                    AudioMixer::TRACK,
+                    AudioMixer::CHANNEL_COUNT, channelCount);
+                state.channelCount = channelCount;
+            }
+            if (!state.valid || sampleRate != state.sampleRate) {
+                mAudioMixer->setParameter(
+                    AudioMixer::RESAMPLE,
+                    AudioMixer::SAMPLE_RATE,
+                    int(sampleRate));
+                state.sampleRate = sampleRate;
+            }
+            state.valid = true;
 
             // reset retry count
             track->mRetryCount = kMaxTrackRetries;
             mixerStatus = MIXER_TRACKS_READY;
+            mMixerTracksReady = true;
         } else {
             //LOGV("track %d u=%08x, s=%08x [NOT READY] on thread %p", track->name(), cblk->user, cblk->server, this);
-            if (track->isStopped()) {
-                track->reset();
-            }
             if (track->isTerminated() || track->isStopped() || track->isPaused()) {
                 // We have consumed all the buffers of this track.
-                // Remove it from the list of active tracks.
+                // Remove it from the list of active tracks. A stopped
+                // track is reset when it is removed, with mLock held.
                 tracksToRemove->add(track);
                 mAudioMixer->disable(AudioMixer::MIXING);
+                track->mMixerState.enabled = false;
             } else {
                 // No buffers for this track. Give it a few chances to
                 // fill a buffer, then remove it from active list.
-                if (--(track->mRetryCount) <= 0) {
+                if (track->mRetryCount <= 0 || --(track->mRetryCount) <= 0) {
                     LOGV("BUFFER TIMEOUT: remove(%d) from active list on thread %p", track->name(), this);
                     tracksToRemove->add(track);
                 } else if (mixerStatus != MIXER_TRACKS_READY) {
@@ -1697,26 +2717,515 @@ uint32_t AudioFlinger::MixerThread::prepareTracks_l(const SortedVector< wp<Track
                 }
 
                 mAudioMixer->disable(AudioMixer::MIXING);
+                track->mMixerState.enabled = false;
             }
         }
     }
 
+    updateResamplerLoad();
+    mNumFastTracks = mFastTracks.size();
+    if (tracksSkipped && !mMixerTracksReady && mFastTracks.isEmpty()) {
+        // all the tracks are silent: the period is written as zeros
+        mNumSkippedMixes++;
+    }
+
     // remove all the tracks that need to be...
     count = tracksToRemove->size();
     if (UNLIKELY(count)) {
-        for (size_t i=0 ; i<count ; i++) {
-            const sp<Track>& track = tracksToRemove->itemAt(i);
-            mActiveTracks.remove(track);
-            if (track->isTerminated()) {
-                mTracks.remove(track);
-                deleteTrackName_l(track->mName);
+        // do not wait for mLock: if a binder thread holds it, the tracks stay
+        // in mMixerTracks and are removed during one of the next periods
+        if (mLock.tryLock() == NO_ERROR) {
+            bool flushed = false;
+            for (size_t i=0 ; i<count ; i++) {
+                const sp<Track>& track = tracksToRemove->itemAt(i);
+                // reset() must not race with start(), stop() or flush() from
+                // a binder thread: the state is only stable with mLock held
+                if (track->mFlushPending) {
+                    audio_track_cblk_t* cblk = track->cblk();
+                    cblk->lock.lock();
+                    track->reset();
+                    cblk->lock.unlock();
+                    track->mFlushPending = false;
+                    flushed = true;
+                }
+                // the track was chosen without mLock: start() may have been
+                // called since, and it did not add the track again as it was
+                // still active
+                if (!track->isTerminated() && !track->isStopped() && !track->isPaused() &&
+                        track->mRetryCount > 0) {
+                    continue;
+                }
+                if (track->isStopped()) {
+                    track->reset();
+                }
+                mActiveTracks.remove(track);
+                mMixerTracks.remove(track);
+                if (track->isTerminated()) {
+                    mTracks.remove(track);
+                    deleteTrackName_l(track->mName);
+                }
             }
+            if (flushed) {
+                mFlushCond.broadcast();
+            }
+            mLock.unlock();
+        } else {
+            mNumDeferredRemovals++;
         }
     }
 
     return mixerStatus;
 }
 
+// queuePoolJob() is called by prepareTracks() to have the track resampled and
+// mixed by a pool worker. Returns false if the track must go through AudioMixer.
+bool AudioFlinger::MixerThread::queuePoolJob(Track* track, int16_t left, int16_t right, int param)
+{
+    audio_track_cblk_t* cblk = track->cblk();
+
+    // the resampler is allocated with the track, never here
+    if (track->mResampler == NULL || track->mResampled.mFrames != mFrameCount) {
+        return false;
+    }
+    int tier = track->resamplerTier(mResamplerTier);
+    if (tier > mMaxResamplerTier) {
+        tier = mMaxResamplerTier;
+    }
+    if (cblk->sampleRate != track->mResamplerInputRate) {
+        track->mResampler->setSampleRate(cblk->sampleRate);
+        track->mResamplerInputRate = cblk->sampleRate;
+    }
+    track->mResampler->setTier(tier);
+
+    AudioMixerPool::Job job;
+    job.provider = track;
+    job.resampler = track->mResampler;
+    job.channelCount = track->channelCount();
+    job.mixTime = 0;
+    job.rampTime = 0;
+    setJobVolume(track, &job, left, right, param);
+    if (!mMixerPool->addJob(job)) {
+        return false;
+    }
+    track->mDirectVolume[0] = left;
+    track->mDirectVolume[1] = right;
+    track->mMixedDirect = true;
+    return true;
+}
+
+// queueDirectJob() is called by prepareTracks() to have the track mixed by
+// mixDirect(). provider is the track or its period resampled to the output rate.
+bool AudioFlinger::MixerThread::queueDirectJob(Track* track, AudioBufferProvider* provider,
+        int channelCount, int16_t left, int16_t right, int param)
+{
+    if (mNumDirectJobs >= AudioMixer::MAX_NUM_TRACKS) {
+        return false;
+    }
+    AudioMixerPool::Job& job = mDirectJobs[mNumDirectJobs++];
+    job.provider = provider;
+    job.resampler = NULL;
+    job.channelCount = channelCount;
+    job.mixTime = 0;
+    job.rampTime = 0;
+    setJobVolume(track, &job, left, right, param);
+
+    track->mDirectVolume[0] = left;
+    track->mDirectVolume[1] = right;
+    track->mMixedDirect = true;
+    return true;
+}
+
+// setJobVolume() sets the volume of a job mixing the track outside AudioMixer.
+// A ramp starts from the volume of the previous period, mixed by the pool,
+// mixDirect() or AudioMixer.
+void AudioFlinger::MixerThread::setJobVolume(Track* track, AudioMixerPool::Job* job,
+        int16_t left, int16_t right, int param)
+{
+    Track::mixer_state_t& state = track->mMixerState;
+
+    job->volume[0] = left;
+    job->volume[1] = right;
+    if (param == AudioMixer::RAMP_VOLUME && track->mMixedDirect) {
+        job->prevVolume[0] = track->mDirectVolume[0];
+        job->prevVolume[1] = track->mDirectVolume[1];
+    } else if (param == AudioMixer::RAMP_VOLUME && state.valid) {
+        job->prevVolume[0] = state.volume[0];
+        job->prevVolume[1] = state.volume[1];
+    } else {
+        job->prevVolume[0] = left;
+        job->prevVolume[1] = right;
+    }
+    // AudioMixer is configured again from scratch when it mixes the track
+    if (state.enabled) {
+        mAudioMixer->disable(AudioMixer::MIXING);
+    }
+    state = Track::mixer_state_t();
+}
+
+// updateMixerPool() is called by the mixer thread to create or delete the
+// worker pool after a change of threshold or output configuration
+void AudioFlinger::MixerThread::updateMixerPool()
+{
+    bool wanted = (mPoolThreshold > 0 && mType == MIXER);
+
+    if (mMixerPool != NULL && (!wanted || mMixerPool->frameCount() != mFrameCount)) {
+        delete mMixerPool;
+        mMixerPool = NULL;
+    }
+    if (wanted && mMixerPool == NULL) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus <= 1) {
+            LOGW("mixer worker pool disabled on single core system");
+            mPoolThreshold = 0;
+            return;
+        }
+        mMixerPool = new AudioMixerPool(mFrameCount, (int)cpus - 1);
+        if (mMixerPool->initCheck() != NO_ERROR) {
+            LOGE("could not create mixer worker pool");
+            delete mMixerPool;
+            mMixerPool = NULL;
+            mPoolThreshold = 0;
+        }
+    }
+}
+
+// resampleTrack() is called by prepareTracks() to convert one period of a track
+// to the output rate in track->mResampled, restarted discards the input history
+// of the resampler. Returns false if the track must be resampled by AudioMixer.
+bool AudioFlinger::MixerThread::resampleTrack(Track* track, bool restarted)
+{
+    audio_track_cblk_t* cblk = track->cblk();
+
+    if (track->format() != AudioSystem::PCM_16_BIT ||
+            !AudioResamplerPolyphase::isSupported(cblk->sampleRate, mSampleRate)) {
+        return false;
+    }
+
+    int tier = track->resamplerTier(mResamplerTier);
+    if (tier > mMaxResamplerTier) {
+        tier = mMaxResamplerTier;
+    }
+    // the resampler and mResampled are allocated with the track, never here
+    if (track->mResampler == NULL || track->mResampled.mFrames != mFrameCount) {
+        return false;
+    }
+    // the worker pool sets the track volume when it mixes the track
+    track->mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
+    if (cblk->sampleRate != track->mResamplerInputRate) {
+        track->mResampler->setSampleRate(cblk->sampleRate);
+        track->mResamplerInputRate = cblk->sampleRate;
+    }
+    track->mResampler->setTier(tier);
+    if (restarted) {
+        track->mResampler->init();
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    // frames missing in the track are left silent
+    memset(mResampleBuffer, 0, mFrameCount * 2 * sizeof(int32_t));
+    track->mResampler->resample(mResampleBuffer, mFrameCount, track);
+    AudioMixerSimd::clampStereo16((int32_t *)track->mResampled.mData, mResampleBuffer, mFrameCount);
+    track->mResampled.mPos = 0;
+    nsecs_t cost = systemTime(SYSTEM_TIME_THREAD) - start;
+
+    mResampleLoad += cost;
+    mResampleCpu[tier] += cost;
+    track->mCost.resample += cost;
+    mResampleFrames[tier] += mFrameCount;
+    return true;
+}
+
+// updateResamplerLoad() is called once per period by prepareTracks(): lowers the
+// highest resampler tier when resampling takes too much of the period for a
+// while, and raises it back after a longer while under the low limit.
+void AudioFlinger::MixerThread::updateResamplerLoad()
+{
+    nsecs_t period = seconds(mFrameCount) / mSampleRate;
+
+    if (mResampleLoad * 100 > period * kResampleLoadHigh) {
+        if (mResampleLoadPeriods < 0) {
+            mResampleLoadPeriods = 0;
+        }
+        if (++mResampleLoadPeriods >= kResampleOverloadPeriods &&
+                mMaxResamplerTier > AudioResamplerPolyphase::TIER_FAST) {
+            mMaxResamplerTier--;
+            mNumTierChanges++;
+            mResampleLoadPeriods = 0;
+            LOGW("resampling uses %lld%% of the period, max resampler quality lowered to %s",
+                    (mResampleLoad * 100) / period,
+                    AudioResamplerPolyphase::tierName(mMaxResamplerTier));
+        }
+    } else if (mResampleLoad * 100 < period * kResampleLoadLow) {
+        if (mResampleLoadPeriods > 0) {
+            mResampleLoadPeriods = 0;
+        }
+        if (--mResampleLoadPeriods <= -kResampleRecoverPeriods &&
+                mMaxResamplerTier < AudioResamplerPolyphase::TIER_HIGH) {
+            mMaxResamplerTier++;
+            mNumTierChanges++;
+            mResampleLoadPeriods = 0;
+            LOGV("max resampler quality raised to %s",
+                    AudioResamplerPolyphase::tierName(mMaxResamplerTier));
+        }
+    } else {
+        mResampleLoadPeriods = 0;
+    }
+}
+
+// mixPeriod() mixes one period of the tracks configured by the last
+// prepareTracks() into out. With fast tracks, the period is left in mMixSums
+// for writeFastSubPeriods().
+void AudioFlinger::MixerThread::mixPeriod(int16_t* out, size_t size)
+{
+    if (!mMixerTracksReady) {
+        // only fast or silent tracks
+        if (mFastTracks.isEmpty()) {
+            memset(out, 0, size);
+        } else {
+            memset(mMixSums, 0, mFrameCount * 2 * sizeof(int32_t));
+        }
+        return;
+    }
+
+    nsecs_t period = seconds(mFrameCount) / mSampleRate;
+    size_t count = mMixedTracks.size();
+    if (mDirectPeriod) {
+        mixDirect();
+        if (mFastTracks.isEmpty()) {
+            AudioMixerPool::processOutput(mAudioFlinger->mDsp, &mDither, out, mMixSums,
+                    mFrameCount);
+        }
+        for (size_t i = 0; i < count; i++) {
+            const AudioMixerPool::Job& job = mDirectJobs[i];
+            Track* const track = mMixedTracks[i].get();
+            track->mCost.mix += job.mixTime;
+            track->mCost.ramp += job.rampTime;
+            track->mCost.played += period;
+        }
+        for (size_t i = 0; i < mPoolTracks.size(); i++) {
+            const AudioMixerPool::Job& job = mMixerPool->job(i);
+            Track* const track = mPoolTracks[i].get();
+            track->mCost.resample += job.mixTime;
+            track->mCost.ramp += job.rampTime;
+            track->mCost.played += period;
+        }
+    } else {
+        nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+        mAudioMixer->process(out);
+        nsecs_t cost = systemTime(SYSTEM_TIME_THREAD) - start;
+
+        // AudioMixer does not tell what each track costs: its time is shared
+        // equally by the tracks it mixed and reported as estimated
+        for (size_t i = 0; i < count; i++) {
+            Track* const track = mMixedTracks[i].get();
+            track->mCost.estimated += cost / count;
+            if (track->mCostRamp) {
+                track->mCost.ramp += cost / count;
+            } else if (track->mCostResampled) {
+                track->mCost.resample += cost / count;
+            } else {
+                track->mCost.mix += cost / count;
+            }
+            track->mCost.played += period;
+        }
+    }
+}
+
+// mixDirect() mixes the jobs queued by prepareTracks() into mMixSums with the
+// AudioMixerSimd kernels, while the worker pool mixes its own jobs. Once
+// through AudioMixerPool::processOutput(), the result is the one of AudioMixer
+// for the same tracks: 4.12 products of all the tracks summed in 32 bit, then
+// the AudioDSP chain and the dithering to 16 bit of AudioMixer::process().
+void AudioFlinger::MixerThread::mixDirect()
+{
+    if (mMixerPool != NULL) {
+        mMixerPool->start();
+    }
+    memset(mMixSums, 0, mFrameCount * 2 * sizeof(int32_t));
+    for (size_t i = 0; i < mNumDirectJobs; i++) {
+        AudioMixerPool::mixJob(mDirectJobs[i], mFrameCount, mMixSums, mMixTemp);
+    }
+    if (mMixerPool != NULL) {
+        mMixerPool->finish(mMixSums);
+    }
+    mNumDirectPeriods++;
+}
+
+// number of periods of a deep buffer batch, 1 when the mode is off
+int AudioFlinger::MixerThread::deepBufferPeriods() const
+{
+    if (mDeepBufferMs == 0) {
+        return 1;
+    }
+    size_t frames = ((size_t)mDeepBufferMs * mSampleRate) / 1000;
+    int periods = (frames + mFrameCount - 1) / mFrameCount;
+    return (periods > 1) ? periods : 1;
+}
+
+// deepBatchReady() returns true if all the active tracks tolerate the latency
+// of a deep buffer batch and have at least the given number of periods ready
+bool AudioFlinger::MixerThread::deepBatchReady(const SortedVector< wp<Track> >& activeTracks,
+        int periods)
+{
+    size_t count = activeTracks.size();
+    for (size_t i = 0; i < count; i++) {
+        sp<Track> t = activeTracks[i].promote();
+        if (t == 0) continue;
+        Track* const track = t.get();
+        audio_track_cblk_t* cblk = track->cblk();
+
+        // only music is played from a deep buffer
+        if (track->type() != AudioSystem::MUSIC || track->isFastTrack()) {
+            return false;
+        }
+        // a state change is handled by a normal period
+        if (track->isStopped() || track->isPausing() || track->isPaused() ||
+                track->isTerminated()) {
+            return false;
+        }
+        uint32_t needed = (uint32_t)(((uint64_t)mFrameCount * periods * cblk->sampleRate) /
+                mSampleRate) + kDeepBufferMargin;
+        if (cblk->framesReady() < needed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// skipTrack() consumes the frames the track would have mixed during the period
+// without reading them. Returns the number of frames consumed.
+size_t AudioFlinger::MixerThread::skipTrack(Track* track)
+{
+    audio_track_cblk_t* cblk = track->cblk();
+
+    uint64_t frames = (uint64_t)mFrameCount * cblk->sampleRate + track->mSkipRemainder;
+    track->mSkipRemainder = (uint32_t)(frames % mSampleRate);
+    frames /= mSampleRate;
+
+    size_t skipped = 0;
+    while (skipped < frames) {
+        AudioBufferProvider::Buffer buffer;
+        buffer.frameCount = frames - skipped;
+        track->getNextBuffer(&buffer);
+        if (buffer.raw == 0) {
+            break;
+        }
+        skipped += buffer.frameCount;
+        track->releaseBuffer(&buffer);
+    }
+    return skipped;
+}
+
+// writeFastSubPeriods() writes the period left in mMixSums by mixPeriod() in
+// mFastSubPeriods parts. The fast tracks are added to the sums of each part
+// right before its output stage and its write: their frames reach the HAL at
+// most one sub-period after the client wrote them, and their clients are woken
+// up once per sub-period. The output stage runs once per part, on all the
+// tracks.
+ssize_t AudioFlinger::MixerThread::writeFastSubPeriods(int16_t* buffer)
+{
+    size_t subFrames = mFrameCount / mFastSubPeriods;
+    if (subFrames == 0) {
+        subFrames = mFrameCount;
+    }
+    nsecs_t halLatency = milliseconds(mOutput->latency());
+    ssize_t written = 0;
+    size_t offset = 0;
+
+    while (offset < mFrameCount) {
+        // the last sub-period also takes the frames left by the division
+        size_t frames = mFrameCount - offset;
+        if (frames >= 2 * subFrames) {
+            frames = subFrames;
+        }
+        int16_t* block = buffer + offset * 2;
+        int32_t* sums = mMixSums + offset * 2;
+        size_t bytes = frames * mFrameSize;
+
+        mixFastTracks(sums, frames, systemTime());
+        AudioMixerPool::processOutput(mAudioFlinger->mDsp, &mDither, block, sums, frames);
+#ifdef LVMX
+        int audioOutputType = LifeVibes::getMixerType(mId, mType);
+        if (LifeVibes::audioOutputTypeIsLifeVibes(audioOutputType)) {
+           LifeVibes::process(audioOutputType, block, bytes);
+        }
+#endif
+        ssize_t ret = mOutput->write(block, bytes);
+        if (ret < 0) {
+            return ret;
+        }
+        written += ret;
+
+        if (mNumFastTaps != 0) {
+            // the HAL does not report when a frame leaves the DAC: assuming
+            // the write returns when the HAL has room for the block, its first
+            // frame leaves the DAC after the HAL latency minus the block itself
+            nsecs_t dac = systemTime() + halLatency - seconds(frames) / mSampleRate;
+            for (int i = 0; i < mNumFastTaps; i++) {
+                mFastLatencyEstimate.add(dac > mFastTaps[i] ? dac - mFastTaps[i] : 0);
+            }
+        }
+        offset += frames;
+    }
+    return written;
+}
+
+// mixFastTracks() adds the fast tracks to frameCount frames of the 4.12 sums of
+// the period, with the volume computed by the last prepareTracks() and no ramp
+// nor resampling.
+void AudioFlinger::MixerThread::mixFastTracks(int32_t* sums, size_t frameCount, nsecs_t now)
+{
+    mNumFastTaps = 0;
+
+    for (size_t i = 0; i < mFastTracks.size(); i++) {
+        Track* const track = mFastTracks[i].get();
+        size_t mixed = 0;
+        nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+
+        while (mixed < frameCount) {
+            AudioBufferProvider::Buffer buffer;
+            buffer.frameCount = frameCount - mixed;
+            track->getNextBuffer(&buffer);
+            if (buffer.raw == 0) {
+                break;
+            }
+            if (track->mFastVolume[0] == 0 && track->mFastVolume[1] == 0) {
+                // no ramp to complete here: silent frames are only consumed
+                mNumSkippedFrames += buffer.frameCount;
+            } else {
+                const int16_t* in = buffer.i16;
+                if (track->channelCount() == 1) {
+                    AudioMixerSimd::upmixMono16(mFastUpmixBuffer, in, buffer.frameCount);
+                    in = mFastUpmixBuffer;
+                }
+                AudioMixerSimd::volumeStereo16(sums + mixed * 2, in, buffer.frameCount,
+                        track->mFastVolume[0], track->mFastVolume[1]);
+            }
+            mixed += buffer.frameCount;
+            // steps the server and signals the client callback thread
+            track->releaseBuffer(&buffer);
+        }
+
+        track->mCost.mix += systemTime(SYSTEM_TIME_THREAD) - start;
+        track->mCost.played += seconds(mixed) / mSampleRate;
+
+        if (mixed != 0) {
+            if (track->mFastTapTime != 0 && mNumFastTaps < kMaxFastTracks) {
+                mFastTaps[mNumFastTaps++] = track->mFastTapTime;
+            }
+            track->mFastTapTime = 0;
+            track->mFastMixed = true;
+        }
+        if (mixed < frameCount) {
+            // the next frames of the track are written after now
+            if (track->mFastTapTime == 0 && !track->isStopped()) {
+                mNumFastUnderruns++;
+            }
+            track->mFastTapTime = now;
+        }
+    }
+}
+
 void AudioFlinger::MixerThread::getTracks(
         SortedVector < sp<Track> >& tracks,
         SortedVector < wp<Track> >& activeTracks,
@@ -1742,6 +3251,7 @@ void AudioFlinger::MixerThread::getTracks(
     size = activeTracks.size();
     for (size_t i = 0; i < size; i++) {
         mActiveTracks.remove(activeTracks[i]);
+        postTrackCommand(TrackCommandQueue::REMOVE, activeTracks[i].promote());
     }
 
     size = tracks.size();
@@ -1767,11 +3277,14 @@ void AudioFlinger::MixerThread::putTracks(
 
         t->mName = name;
         t->mThread = this;
+        t->mMixerState = Track::mixer_state_t();
+        allocateTrackBuffers_l(t.get());
         mTracks.add(t);
 
         int j = activeTracks.indexOf(t);
         if (j >= 0) {
             mActiveTracks.add(t);
+            postTrackCommand(TrackCommandQueue::ADD, t);
             // force buffer refilling and no ramp volume when the track is mixed for the first time
             t->mFillingUpStatus = Track::FS_FILLING;
         }
@@ -1781,20 +3294,91 @@ void AudioFlinger::MixerThread::putTracks(
 // getTrackName_l() must be called with ThreadBase::mLock held
 int AudioFlinger::MixerThread::getTrackName_l()
 {
-    return mAudioMixer->getTrackName();
+    // mLock serializes the allocations, the mixer thread can only free names
+    // in the meantime
+    for (;;) {
+        int32_t names = mTrackNames;
+        if (names == -1) {
+            return -1;
+        }
+        int n = __builtin_ctz(~(uint32_t)names);
+        if (android_atomic_cmpxchg(names, names | (1 << n), &mTrackNames) == 0) {
+            return AudioMixer::TRACK0 + n;
+        }
+    }
 }
 
 // deleteTrackName_l() must be called with ThreadBase::mLock held
 void AudioFlinger::MixerThread::deleteTrackName_l(int name)
 {
     LOGV("remove track (%d) and delete from mixer", name);
-    mAudioMixer->deleteTrackName(name);
+    uint32_t n = name - AudioMixer::TRACK0;
+    if (n >= AudioMixer::MAX_NUM_TRACKS) {
+        return;
+    }
+    // the mixer thread deletes the name from AudioMixer at its next period
+    // and only then makes it available again
+    android_atomic_or(1 << n, &mDeletedNames);
+    mWaitWorkCV.broadcast();
+}
+
+// consumes the standby policy keys from param, returns true if any was found
+static bool setStandbyPolicyParameters(StandbyPolicy& policy, AudioParameter& param,
+        status_t *status)
+{
+    bool found = false;
+    String8 value;
+    int intValue;
+
+    if (param.get(String8(kKeyStandbyPolicy), value) == NO_ERROR) {
+        int mode = -1;
+        if (value == "fixed") {
+            mode = StandbyPolicy::FIXED;
+        } else if (value == "adaptive") {
+            mode = StandbyPolicy::ADAPTIVE;
+        }
+        if (policy.setMode(mode) != NO_ERROR) {
+            *status = BAD_VALUE;
+        }
+        param.remove(String8(kKeyStandbyPolicy));
+        found = true;
+    }
+    if (param.getInt(String8(kKeyStandbyDelay), intValue) == NO_ERROR) {
+        if (policy.setDelay(milliseconds(intValue)) != NO_ERROR) {
+            *status = BAD_VALUE;
+        }
+        param.remove(String8(kKeyStandbyDelay));
+        found = true;
+    }
+    if (param.getInt(String8(kKeyStandbyDelayMin), intValue) == NO_ERROR) {
+        if (policy.setMinDelay(milliseconds(intValue)) != NO_ERROR) {
+            *status = BAD_VALUE;
+        }
+        param.remove(String8(kKeyStandbyDelayMin));
+        found = true;
+    }
+    if (param.getInt(String8(kKeyStandbyDelayMax), intValue) == NO_ERROR) {
+        if (policy.setMaxDelay(milliseconds(intValue)) != NO_ERROR) {
+            *status = BAD_VALUE;
+        }
+        param.remove(String8(kKeyStandbyDelayMax));
+        found = true;
+    }
+    if (param.getInt(String8(kKeyMaxPeriodRatio), intValue) == NO_ERROR) {
+        if (intValue < 0 || policy.setMaxPeriodRatio(intValue) != NO_ERROR) {
+            *status = BAD_VALUE;
+        }
+        param.remove(String8(kKeyMaxPeriodRatio));
+        found = true;
+    }
+    return found;
 }
 
 // checkForNewParameters_l() must be called with ThreadBase::mLock held
 bool AudioFlinger::MixerThread::checkForNewParameters_l()
 {
     bool reconfig = false;
+    bool policyChanged = false;
 
     while (!mNewParameters.isEmpty()) {
         status_t status = NO_ERROR;
@@ -1829,7 +3413,47 @@ bool AudioFlinger::MixerThread::checkForNewParameters_l()
                 reconfig = true;
             }
         }
-        if (status == NO_ERROR) {
+        // the standby policy and mixer pool keys are for this thread only,
+        // pass the others to the HAL
+        bool halParameters = true;
+        bool localParameters = setStandbyPolicyParameters(mStandbyPolicy, param, &status);
+        if (param.getInt(String8(kKeyMixerPoolThreshold), value) == NO_ERROR) {
+            mPoolThreshold = (value > 0) ? value : 0;
+            param.remove(String8(kKeyMixerPoolThreshold));
+            localParameters = true;
+        }
+        if (param.getInt(String8(kKeyDeepBuffer), value) == NO_ERROR) {
+            if (mType != MIXER) {
+                status = INVALID_OPERATION;
+            } else if (value < 0 || value > (int)kMaxDeepBufferMs) {
+                status = BAD_VALUE;
+            } else if ((uint32_t)value != mDeepBufferMs) {
+                mDeepBufferMs = value;
+                allocateDeepBuffer();
+                // the latency reported to the clients changed
+                sendConfigEvent_l(AudioSystem::OUTPUT_CONFIG_CHANGED);
+            }
+            param.remove(String8(kKeyDeepBuffer));
+            localParameters = true;
+        }
+        String8 quality;
+        if (param.get(String8(kKeyResamplerQuality), quality) == NO_ERROR) {
+            int tier = AudioResamplerPolyphase::tierFromString(quality.string());
+            if (tier < 0) {
+                status = BAD_VALUE;
+            } else {
+                mResamplerTier = tier;
+                AudioResamplerPolyphase::preloadTables(mSampleRate, tier);
+            }
+            param.remove(String8(kKeyResamplerQuality));
+            localParameters = true;
+        }
+        if (localParameters) {
+            policyChanged = true;
+            halParameters = (param.size() != 0);
+            keyValuePair = param.toString();
+        }
+        if (status == NO_ERROR && halParameters) {
             status = mOutput->setParameters(keyValuePair);
             if (!mStandby && status == INVALID_OPERATION) {
                mOutput->standby();
@@ -1841,26 +3465,30 @@ bool AudioFlinger::MixerThread::checkForNewParameters_l()
                 delete mAudioMixer;
                 readOutputParameters();
                 mAudioMixer = new AudioMixer(mFrameCount, mSampleRate, mAudioFlinger->mDsp);
+                // all the names are given again below to the new mixer
+                mTrackNames = 0;
+                mDeletedNames = 0;
+                allocateMixBuffers();
+                mStandbyPolicy.setPeriod(seconds(mFrameCount) / mSampleRate);
                 for (size_t i = 0; i < mTracks.size() ; i++) {
                     int name = getTrackName_l();
                     if (name < 0) break;
                     mTracks[i]->mName = name;
+                    // the new mixer knows nothing about this track
+                    mTracks[i]->mMixerState = Track::mixer_state_t();
                     // limit track sample rate to 2 x new output sample rate
                     if (mTracks[i]->mCblk->sampleRate > 2 * sampleRate()) {
                         mTracks[i]->mCblk->sampleRate = 2 * sampleRate();
                     }
+                    allocateTrackBuffers_l(mTracks[i].get());
                 }
                 sendConfigEvent_l(AudioSystem::OUTPUT_CONFIG_CHANGED);
             }
         }
 
-        mNewParameters.removeAt(0);
-
-        mParamStatus = status;
-        mParamCond.signal();
-        mWaitWorkCV.wait(mLock);
+        replyParameters_l(status);
     }
-    return reconfig;
+    return reconfig || policyChanged;
 }
 
 status_t AudioFlinger::MixerThread::dumpInternals(int fd, const Vector<String16>& args)
@@ -1871,12 +3499,70 @@ status_t AudioFlinger::MixerThread::dumpInternals(int fd, const Vector<String16>
 
     PlaybackThread::dumpInternals(fd, args);
 
-    snprintf(buffer, SIZE, "AudioMixer tracks: %08x\n", mAudioMixer->trackNames());
+    snprintf(buffer, SIZE, "AudioMixer tracks: %08x, deleted %08x\n", mTrackNames, mDeletedNames);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "AudioMixer kernels: %s, direct mix: %s, %u periods mixed directly\n",
+            AudioMixerSimd::implName(), mDirectMix ? "on" : "off", mNumDirectPeriods);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "Track commands: %d, deferred removals: %d, resyncs: %d\n",
+            mNumTrackCommands, mNumDeferredRemovals, mNumTrackResyncs);
+    result.append(buffer);
+    mStandbyPolicy.dump(result);
+    if (mMixerPool != NULL) {
+        snprintf(buffer, SIZE, "Mixer pool: %d workers, threshold %d tracks, %u periods, %u sleeps\n",
+                mMixerPool->numWorkers(), mPoolThreshold, mMixerPool->numPeriods(), mMixerPool->numSleeps());
+    } else {
+        snprintf(buffer, SIZE, "Mixer pool: off, threshold %d tracks\n", mPoolThreshold);
+    }
+    result.append(buffer);
+    snprintf(buffer, SIZE, "Resampler: default %s, max %s, %u tier changes\n",
+            AudioResamplerPolyphase::tierName(mResamplerTier),
+            AudioResamplerPolyphase::tierName(mMaxResamplerTier), mNumTierChanges);
+    result.append(buffer);
+    for (int i = 0; i < AudioResamplerPolyphase::NUM_TIERS; i++) {
+        if (mResampleFrames[i] == 0) continue;
+        snprintf(buffer, SIZE, "  %-8s %llu frames, %lld ns per 1000 frames\n",
+                AudioResamplerPolyphase::tierName(i), (unsigned long long)mResampleFrames[i],
+                (long long)((mResampleCpu[i] * 1000) / (nsecs_t)mResampleFrames[i]));
+        result.append(buffer);
+    }
+    if (mDeepBufferMs != 0) {
+        snprintf(buffer, SIZE, "Deep buffer: %u ms, %d periods per batch at most, %u batches, "
+                "%u periods\n",
+                mDeepBufferMs, deepBufferPeriods(), mNumDeepBatches, mNumDeepPeriods);
+    } else {
+        snprintf(buffer, SIZE, "Deep buffer: off\n");
+    }
+    result.append(buffer);
+    snprintf(buffer, SIZE, "Silent tracks skipped: %u, frames: %llu, periods not mixed: %u\n",
+            mNumSkippedTracks, (unsigned long long)mNumSkippedFrames, mNumSkippedMixes);
     result.append(buffer);
+    snprintf(buffer, SIZE, "Fast tracks: %u active, %d sub-periods of %d frames, %u underruns\n",
+            mNumFastTracks, mFastSubPeriods, mFrameCount / mFastSubPeriods, mNumFastUnderruns);
+    result.append(buffer);
+    if (mFastLatencyEstimate.count() != 0) {
+        // upper bound: a frame written after an underrun is only seen by the
+        // next sub-period
+        result.append("fast track tap to DAC latency (usecs), estimated from the "
+                "HAL latency, not measured:\n");
+        result.append("  stage        count     p50     p99     max\n");
+        mFastLatencyEstimate.dump(buffer, SIZE, "tap-est");
+        result.append(buffer);
+    }
     write(fd, result.string(), result.size());
     return NO_ERROR;
 }
 
+// in deep buffer mode, a frame can be mixed a whole batch before it is written
+uint32_t AudioFlinger::MixerThread::latency() const
+{
+    uint32_t latency = PlaybackThread::latency();
+    if (mDeepBufferMs != 0) {
+        latency += ((deepBufferPeriods() - 1) * mFrameCount * 1000) / mSampleRate;
+    }
+    return latency;
+}
+
 uint32_t AudioFlinger::MixerThread::activeSleepTimeUs()
 {
     return (uint32_t)(mOutput->latency() * 1000) / 2;
@@ -1884,7 +3570,8 @@ uint32_t AudioFlinger::MixerThread::activeSleepTimeUs()
 
 uint32_t AudioFlinger::MixerThread::idleSleepTimeUs()
 {
-    return (uint32_t)((mFrameCount * 1000) / mSampleRate) * 1000;
+    return mStandbyPolicy.idleSleepTimeUs((uint32_t)((mFrameCount * 1000) / mSampleRate) * 1000,
+                                          activeSleepTimeUs());
 }
 
 // ----------------------------------------------------------------------------
@@ -1926,6 +3613,7 @@ bool AudioFlinger::DirectOutputThread::threadLoop()
 
             Mutex::Autolock _l(mLock);
 
+            checkParameterTransaction_l();
             if (checkForNewParameters_l()) {
                 mixBufferSize = mFrameCount*mFrameSize;
                 activeSleepTime = activeSleepTimeUs();
@@ -1951,7 +3639,7 @@ bool AudioFlinger::DirectOutputThread::threadLoop()
                     if (exitPending()) break;
 
                     LOGV("DirectOutputThread %p TID %d going to sleep\n", this, gettid());
-                    mWaitWorkCV.wait(mLock);
+                    waitWork_l();
                     LOGV("DirectOutputThread %p TID %d waking up in active mode\n", this, gettid());
 
                     if (mMasterMute == false) {
@@ -2162,11 +3850,7 @@ bool AudioFlinger::DirectOutputThread::checkForNewParameters_l()
             }
         }
 
-        mNewParameters.removeAt(0);
-
-        mParamStatus = status;
-        mParamCond.signal();
-        mWaitWorkCV.wait(mLock);
+        replyParameters_l(status);
     }
     return reconfig;
 }
@@ -2196,9 +3880,15 @@ uint32_t AudioFlinger::DirectOutputThread::idleSleepTimeUs()
 // ----------------------------------------------------------------------------
 
 AudioFlinger::DuplicatingThread::DuplicatingThread(const sp<AudioFlinger>& audioFlinger, AudioFlinger::MixerThread* mainThread, int id)
-    :   MixerThread(audioFlinger, mainThread->getOutput(), id), mWaitTimeMs(UINT_MAX)
+    :   MixerThread(audioFlinger, mainThread->getOutput(), id), mWaitTimeMs(UINT_MAX),
+        mZeroCopy(true), mNumDirectWrites(0), mNumCopiedWrites(0)
 {
     mType = PlaybackThread::DUPLICATING;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.audio.dup_zero_copy", value, "1");
+    mZeroCopy = (atoi(value) != 0);
+
     addOutputTrack(mainThread);
 }
 
@@ -2222,13 +3912,19 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
     uint32_t activeSleepTime = activeSleepTimeUs();
     uint32_t idleSleepTime = idleSleepTimeUs();
     uint32_t sleepTime = idleSleepTime;
+    int16_t* directBuf = NULL;
 
     while (!exitPending())
     {
-        processConfigEvents();
+        checkLatencyReset();
+        nsecs_t periodStart = systemTime();
 
-        mixerStatus = MIXER_IDLE;
-        { // scope for the mLock
+        // see MixerThread::threadLoop(): mLock is only taken when a request is
+        // pending. addOutputTrack() and removeOutputTrack() also post a request
+        // so that outputTracks is refreshed from mOutputTracks.
+        checkParameterTransaction();
+        if (android_atomic_swap(0, &mPendingRequests) != 0) {
+            processConfigEvents();
 
             Mutex::Autolock _l(mLock);
 
@@ -2239,24 +3935,36 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
                 idleSleepTime = idleSleepTimeUs();
             }
 
-            const SortedVector< wp<Track> >& activeTracks = mActiveTracks;
-
+            outputTracks.clear();
             for (size_t i = 0; i < mOutputTracks.size(); i++) {
                 outputTracks.add(mOutputTracks[i]);
             }
+        }
 
-            // put audio hardware into standby after short delay
-            if UNLIKELY((!activeTracks.size() && systemTime() > standbyTime) ||
-                         mSuspended) {
-                if (!mStandby) {
-                    for (size_t i = 0; i < outputTracks.size(); i++) {
-                        outputTracks[i]->stop();
-                    }
-                    mStandby = true;
-                    mBytesWritten = 0;
+        processTrackCommands();
+
+        nsecs_t prepareStart = systemTime();
+        mConfigLatency.add(prepareStart - periodStart);
+
+        mixerStatus = MIXER_IDLE;
+        const SortedVector< wp<Track> >& activeTracks = mMixerTracks;
+
+        // put audio hardware into standby after short delay
+        if UNLIKELY((!activeTracks.size() && systemTime() > standbyTime) ||
+                     mSuspended) {
+            if (!mStandby) {
+                for (size_t i = 0; i < outputTracks.size(); i++) {
+                    outputTracks[i]->stop();
                 }
+                mStandby = true;
+                mBytesWritten = 0;
+            }
 
-                if (!activeTracks.size() && mConfigEvents.isEmpty()) {
+            if (!activeTracks.size()) {
+                Mutex::Autolock _l(mLock);
+
+                if (mTrackCommands.isEmpty() && !mTrackResync && mDeletedNames == 0 &&
+                        mConfigEvents.isEmpty() && mNewParameters.isEmpty()) {
                     // we're about to wait, flush the binder command buffer
                     IPCThreadState::self()->flushCommands();
                     outputTracks.clear();
@@ -2264,7 +3972,7 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
                     if (exitPending()) break;
 
                     LOGV("DuplicatingThread %p TID %d going to sleep\n", this, gettid());
-                    mWaitWorkCV.wait(mLock);
+                    waitWork_l();
                     LOGV("DuplicatingThread %p TID %d waking up\n", this, gettid());
                     if (mMasterMute == false) {
                         char value[PROPERTY_VALUE_MAX];
@@ -2275,19 +3983,31 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
                         }
                     }
 
-                    standbyTime = systemTime() + kStandbyTimeInNsecs;
+                    // reload the output tracks released above
+                    android_atomic_inc(&mPendingRequests);
+                    standbyTime = systemTime() + mStandbyPolicy.standbyDelay();
                     sleepTime = idleSleepTime;
                     continue;
                 }
             }
-
-            mixerStatus = prepareTracks_l(activeTracks, &tracksToRemove);
         }
 
+        mixerStatus = prepareTracks(activeTracks, &tracksToRemove);
+
+        nsecs_t mixStart = systemTime();
+        mPrepareLatency.add(mixStart - prepareStart);
+
         if (LIKELY(mixerStatus == MIXER_TRACKS_READY)) {
             // mix buffers...
             if (outputsReady(outputTracks)) {
-                mAudioMixer->process(curBuf);
+                // if the first output track has a full period of contiguous
+                // space, mix straight into it and copy from there to the others
+                directBuf = NULL;
+                if (mZeroCopy && outputTracks.size() != 0) {
+                    directBuf = outputTracks[0]->getDirectBuffer(mFrameCount);
+                }
+                mixPeriod(directBuf != NULL ? directBuf : curBuf, mixBufferSize);
+                mMixLatency.add(systemTime() - mixStart);
             } else {
                 memset(curBuf, 0, mixBufferSize);
             }
@@ -2317,10 +4037,21 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
         }
         // sleepTime == 0 means we must write to audio hardware
         if (sleepTime == 0) {
-            standbyTime = systemTime() + kStandbyTimeInNsecs;
-            for (size_t i = 0; i < outputTracks.size(); i++) {
-                outputTracks[i]->write(curBuf, writeFrames);
+            nsecs_t writeStart = systemTime();
+            standbyTime = writeStart + mStandbyPolicy.standbyDelay();
+            if (directBuf != NULL) {
+                outputTracks[0]->commitDirectBuffer(writeFrames);
+                for (size_t i = 1; i < outputTracks.size(); i++) {
+                    outputTracks[i]->write(directBuf, writeFrames);
+                }
+                mNumDirectWrites++;
+            } else {
+                for (size_t i = 0; i < outputTracks.size(); i++) {
+                    outputTracks[i]->write(curBuf, writeFrames);
+                }
+                mNumCopiedWrites++;
             }
+            mWriteLatency.add(systemTime() - writeStart);
             mStandby = false;
             mBytesWritten += mixBufferSize;
         } else {
@@ -2331,7 +4062,7 @@ bool AudioFlinger::DuplicatingThread::threadLoop()
         // since we can't guarantee the destructors won't acquire that
         // same lock.
         tracksToRemove.clear();
-        outputTracks.clear();
+        directBuf = NULL;
     }
 
     return false;
@@ -2351,6 +4082,7 @@ void AudioFlinger::DuplicatingThread::addOutputTrack(MixerThread *thread)
         mOutputTracks.add(outputTrack);
         LOGV("addOutputTrack() track %p, on thread %p", outputTrack, thread);
         updateWaitTime();
+        android_atomic_inc(&mPendingRequests);
     }
 }
 
@@ -2362,6 +4094,7 @@ void AudioFlinger::DuplicatingThread::removeOutputTrack(MixerThread *thread)
             mOutputTracks[i]->destroy();
             mOutputTracks.removeAt(i);
             updateWaitTime();
+            android_atomic_inc(&mPendingRequests);
             return;
         }
     }
@@ -2397,7 +4130,35 @@ bool AudioFlinger::DuplicatingThread::outputsReady(SortedVector< sp<OutputTrack>
             return false;
         }
     }
-    return true;
+    return true;
+}
+
+status_t AudioFlinger::DuplicatingThread::dumpInternals(int fd, const Vector<String16>& args)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    MixerThread::dumpInternals(fd, args);
+
+    snprintf(buffer, SIZE, "Output tracks: %d, zero copy: %d\n", mOutputTracks.size(), mZeroCopy);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "direct writes: %d, copied writes: %d\n", mNumDirectWrites, mNumCopiedWrites);
+    result.append(buffer);
+    uint64_t copiedFrames = 0;
+    for (size_t i = 0; i < mOutputTracks.size(); i++) {
+        copiedFrames += mOutputTracks[i]->copiedFrames();
+    }
+    snprintf(buffer, SIZE, "frames copied to the output tracks: %llu\n", copiedFrames);
+    result.append(buffer);
+    result.append("output track waits, wake up to resume latency (usecs):\n");
+    result.append("  stage        count     p50     p99     max\n");
+    for (size_t i = 0; i < mOutputTracks.size(); i++) {
+        mOutputTracks[i]->dumpWaits(buffer, SIZE);
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
 }
 
 uint32_t AudioFlinger::DuplicatingThread::activeSleepTimeUs()
@@ -2416,7 +4177,8 @@ AudioFlinger::ThreadBase::TrackBase::TrackBase(
             int channelCount,
             int frameCount,
             uint32_t flags,
-            const sp<IMemory>& sharedBuffer)
+            const sp<IMemory>& sharedBuffer,
+            const sp<IMemory>& cblkMemory)
     :   RefBase(),
         mThread(thread),
         mClient(client),
@@ -2437,7 +4199,8 @@ AudioFlinger::ThreadBase::TrackBase::TrackBase(
    }
 
    if (client != NULL) {
-        mCblkMemory = client->heap()->allocate(size);
+        // cblkMemory is the memory of a destroyed track of the same size
+        mCblkMemory = (cblkMemory != 0) ? cblkMemory : client->heap()->allocate(size);
         if (mCblkMemory != 0) {
             mCblk = static_cast<audio_track_cblk_t *>(mCblkMemory->pointer());
             if (mCblk) { // construct the shared structure in-place.
@@ -2459,7 +4222,7 @@ AudioFlinger::ThreadBase::TrackBase::TrackBase(
             }
         } else {
             LOGE("not enough memory for AudioTrack size=%u", size);
-            client->heap()->dump("AudioTrack");
+            client->heap()->dumpChunks("AudioTrack");
             return;
         }
    } else {
@@ -2568,10 +4331,18 @@ AudioFlinger::PlaybackThread::Track::Track(
             int format,
             int channelCount,
             int frameCount,
-            const sp<IMemory>& sharedBuffer)
-    :   TrackBase(thread, client, sampleRate, format, channelCount, frameCount, 0, sharedBuffer),
-    mMute(false), mSharedBuffer(sharedBuffer), mName(-1)
-{
+            uint32_t flags,
+            const sp<IMemory>& sharedBuffer,
+            const sp<IMemory>& cblkMemory)
+    :   TrackBase(thread, client, sampleRate, format, channelCount, frameCount, flags,
+            sharedBuffer, cblkMemory),
+    mMute(false), mSharedBuffer(sharedBuffer), mFlushPending(false), mName(-1),
+    mMixedDirect(false),
+    mSilentPeriods(0), mSkipRemainder(0), mCostRamp(false), mCostResampled(false),
+    mResampler(0), mResamplerInputRate(0), mFastTapTime(0), mFastMixed(false)
+{
+    mDirectVolume[0] = mDirectVolume[1] = 0;
+    mFastVolume[0] = mFastVolume[1] = 0;
     if (mCblk != NULL) {
         sp<ThreadBase> baseThread = thread.promote();
         if (baseThread != 0) {
@@ -2598,6 +4369,45 @@ AudioFlinger::PlaybackThread::Track::~Track()
     if (thread != 0) {
         Mutex::Autolock _l(thread->mLock);
         mState = TERMINATED;
+        ((PlaybackThread *)thread.get())->cacheTrackSlot_l(this);
+    }
+    if (mClient != 0) {
+        mClient->addTrackCost(mCost);
+    }
+    delete mResampler;
+    delete[] mResampled.mData;
+}
+
+// allocateResampler() allocates the resampler and the buffer used to mix the
+// track at outputRate, frameCount frames per period, and builds the filter
+// tables of the current track rate for every tier the mixer thread can lower
+// tier to, so that the mixer thread does not allocate memory for the track.
+// Only 16 bit tracks are resampled outside of AudioMixer.
+void AudioFlinger::PlaybackThread::Track::allocateResampler(size_t frameCount,
+        uint32_t outputRate, int tier)
+{
+    delete mResampler;
+    delete[] mResampled.mData;
+    mResampler = NULL;
+    mResampled.mData = NULL;
+    mResampled.mFrames = 0;
+    mResamplerInputRate = 0;
+    if (mCblk == NULL || format() != AudioSystem::PCM_16_BIT) {
+        return;
+    }
+
+    mResampler = new AudioResamplerPolyphase(channelCount(), outputRate, tier);
+    mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
+    mResampled.mData = new int16_t[frameCount * 2];
+    mResampled.mFrames = frameCount;
+
+    uint32_t sampleRate = mCblk->sampleRate;
+    if (AudioResamplerPolyphase::isSupported(sampleRate, outputRate)) {
+        mResampler->setSampleRate(sampleRate);
+        mResamplerInputRate = sampleRate;
+        for (int t = AudioResamplerPolyphase::TIER_FAST; t <= tier; t++) {
+            mResampler->setTier(t);
+        }
     }
 }
 
@@ -2615,7 +4425,7 @@ void AudioFlinger::PlaybackThread::Track::destroy()
     { // scope for mLock
         sp<ThreadBase> thread = mThread.promote();
         if (thread != 0) {
-            if (!isOutputTrack()) {
+            if (!isOutputTrack() && !thread->mAudioFlinger->mStandalone) {
                 if (mState == ACTIVE || mState == RESUMING) {
                     AudioSystem::stopOutput(thread->id(), (AudioSystem::stream_type)mStreamType);
                 }
@@ -2647,6 +4457,14 @@ void AudioFlinger::PlaybackThread::Track::dump(char* buffer, size_t size)
             mCblk->user);
 }
 
+void AudioFlinger::PlaybackThread::Track::dumpCost(char* buffer, size_t size)
+{
+    int n = snprintf(buffer, size, "  %5d %5d ",
+            mName - AudioMixer::TRACK0,
+            (mClient == NULL) ? getpid() : mClient->pid());
+    mCost.dump(buffer + n, size - n);
+}
+
 status_t AudioFlinger::PlaybackThread::Track::getNextBuffer(AudioBufferProvider::Buffer* buffer)
 {
      audio_track_cblk_t* cblk = this->cblk();
@@ -2688,6 +4506,31 @@ getNextBuffer_exit:
      return NOT_ENOUGH_DATA;
 }
 
+status_t AudioFlinger::PlaybackThread::Track::ResampledBuffer::getNextBuffer(
+        AudioBufferProvider::Buffer* buffer)
+{
+    size_t frames = mFrames - mPos;
+    if (frames == 0) {
+        buffer->raw = 0;
+        buffer->frameCount = 0;
+        return NOT_ENOUGH_DATA;
+    }
+    if (buffer->frameCount < frames) {
+        frames = buffer->frameCount;
+    }
+    buffer->i16 = mData + mPos * 2;
+    buffer->frameCount = frames;
+    return NO_ERROR;
+}
+
+void AudioFlinger::PlaybackThread::Track::ResampledBuffer::releaseBuffer(
+        AudioBufferProvider::Buffer* buffer)
+{
+    mPos += buffer->frameCount;
+    buffer->raw = 0;
+    buffer->frameCount = 0;
+}
+
 bool AudioFlinger::PlaybackThread::Track::isReady() const {
     if (mFillingUpStatus != FS_FILLING) return true;
 
@@ -2718,7 +4561,12 @@ status_t AudioFlinger::PlaybackThread::Track::start()
             LOGV("? => ACTIVE (%d) on thread %p", mName, this);
         }
 
-        if (!isOutputTrack() && state != ACTIVE && state != RESUMING) {
+        if (isFastTrack() && state != ACTIVE && state != RESUMING) {
+            // the tap to DAC latency is estimated from here
+            mFastTapTime = systemTime();
+        }
+        if (!isOutputTrack() && !thread->mAudioFlinger->mStandalone &&
+                state != ACTIVE && state != RESUMING) {
             thread->mLock.unlock();
             status = AudioSystem::startOutput(thread->id(), (AudioSystem::stream_type)mStreamType);
             thread->mLock.lock();
@@ -2751,7 +4599,8 @@ void AudioFlinger::PlaybackThread::Track::stop()
             }
             LOGV("(> STOPPED) => STOPPED (%d) on thread %p", mName, playbackThread);
         }
-        if (!isOutputTrack() && (state == ACTIVE || state == RESUMING)) {
+        if (!isOutputTrack() && !thread->mAudioFlinger->mStandalone &&
+                (state == ACTIVE || state == RESUMING)) {
             thread->mLock.unlock();
             AudioSystem::stopOutput(thread->id(), (AudioSystem::stream_type)mStreamType);
             thread->mLock.lock();
@@ -2768,7 +4617,7 @@ void AudioFlinger::PlaybackThread::Track::pause()
         if (mState == ACTIVE || mState == RESUMING) {
             mState = PAUSING;
             LOGV("ACTIVE/RESUMING => PAUSING (%d) on thread %p", mName, thread.get());
-            if (!isOutputTrack()) {
+            if (!isOutputTrack() && !thread->mAudioFlinger->mStandalone) {
                 thread->mLock.unlock();
                 AudioSystem::stopOutput(thread->id(), (AudioSystem::stream_type)mStreamType);
                 thread->mLock.lock();
@@ -2790,6 +4639,26 @@ void AudioFlinger::PlaybackThread::Track::flush()
         // STOPPED state
         mState = STOPPED;
 
+        PlaybackThread *playbackThread = (PlaybackThread *)thread.get();
+        if (playbackThread->mUseTrackCommands &&
+                playbackThread->mActiveTracks.indexOf(this) >= 0) {
+            // the mixer thread reads cblk->user and cblk->server without
+            // mLock: it resets the track itself when it removes it from the
+            // active tracks. Wait for it so that the client does not write
+            // before the reset.
+            mFlushPending = true;
+            nsecs_t deadline = systemTime() + kFlushResetTimeout;
+            while (mFlushPending) {
+                nsecs_t now = systemTime();
+                if (now >= deadline) {
+                    LOGW("flush(%d) not done by thread %p yet", mName, playbackThread);
+                    break;
+                }
+                playbackThread->mFlushCond.waitRelative(thread->mLock, deadline - now);
+            }
+            return;
+        }
+
         mCblk->lock.lock();
         // NOTE: reset() will reset cblk->user and cblk->server with
         // the risk that at the same time, the AudioMixer is trying to read
@@ -2840,7 +4709,7 @@ AudioFlinger::RecordThread::RecordTrack::RecordTrack(
             uint32_t flags)
     :   TrackBase(thread, client, sampleRate, format,
                   channelCount, frameCount, flags, 0),
-        mOverflow(false)
+        mOverflow(false), mConverter(0), mOverflows(0), mFramesLost(0), mOverflowStart(0)
 {
     if (mCblk != NULL) {
        LOGV("RecordTrack constructor, size %d", (int)mBufferEnd - (int)mBuffer);
@@ -2860,6 +4729,7 @@ AudioFlinger::RecordThread::RecordTrack::~RecordTrack()
     if (thread != 0) {
         AudioSystem::releaseInput(thread->id());
     }
+    delete mConverter;
 }
 
 status_t AudioFlinger::RecordThread::RecordTrack::getNextBuffer(AudioBufferProvider::Buffer* buffer)
@@ -2927,7 +4797,7 @@ void AudioFlinger::RecordThread::RecordTrack::stop()
 
 void AudioFlinger::RecordThread::RecordTrack::dump(char* buffer, size_t size)
 {
-    snprintf(buffer, size, "   %05d %03u %03u %04u %01d %05u  %08x %08x\n",
+    snprintf(buffer, size, "   %05d %03u %03u %04u %01d %05u  %08x %08x %4s %08u %08u\n",
             (mClient == NULL) ? getpid() : mClient->pid(),
             mFormat,
             mCblk->channels,
@@ -2935,7 +4805,198 @@ void AudioFlinger::RecordThread::RecordTrack::dump(char* buffer, size_t size)
             mState,
             mCblk->sampleRate,
             mCblk->server,
-            mCblk->user);
+            mCblk->user,
+            (mConverter != 0 && mConverter->isResampling()) ? "yes" : "no",
+            mOverflows,
+            mFramesLost);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioFlinger::RecordThread::RecordConverter::RecordConverter(
+            uint32_t inSampleRate,
+            int inChannelCount,
+            int inFormat,
+            size_t inFrameSize,
+            size_t inFrameCount,
+            uint32_t outSampleRate,
+            int outChannelCount,
+            int outFormat,
+            int resamplerTier)
+    :   mStatus(NO_ERROR), mInSampleRate(inSampleRate), mInChannelCount(inChannelCount),
+        mInFrameSize(inFrameSize), mOutSampleRate(outSampleRate), mOutChannelCount(outChannelCount),
+        mConvert(0), mResampler(0), mRsmpInBuffer(0), mRsmpInFrames(0), mRsmpInRead(0),
+        mRsmpInWrite(0), mRsmpInHeld(0), mRsmpOutBuffer(0)
+{
+    if (inSampleRate == outSampleRate && inChannelCount == outChannelCount &&
+            inFormat == outFormat) {
+        return;
+    }
+    // only 16 bit mono and stereo can be converted
+    if (inFormat != AudioSystem::PCM_16_BIT || outFormat != AudioSystem::PCM_16_BIT ||
+            inChannelCount > 2 || outChannelCount > 2) {
+        mStatus = BAD_VALUE;
+        return;
+    }
+    if (inSampleRate == outSampleRate) {
+        mConvert = AudioMixerSimd::channelConverter(inChannelCount, outChannelCount);
+        return;
+    }
+    // same limit as for the input configuration in checkForNewParameters_l()
+    if (inSampleRate > 2 * outSampleRate) {
+        mStatus = BAD_VALUE;
+        return;
+    }
+
+    mResampler = AudioResamplerPolyphase::create(16, inChannelCount, outSampleRate, resamplerTier);
+    if (mResampler == 0) {
+        mStatus = NO_MEMORY;
+        return;
+    }
+    mResampler->setSampleRate(inSampleRate);
+    mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
+    // room for the part of the previous period not consumed yet, a power of 2
+    // so that the ring positions can wrap
+    mRsmpInFrames = 1;
+    while (mRsmpInFrames < inFrameCount * 2 + kRecordResamplerMargin) {
+        mRsmpInFrames <<= 1;
+    }
+    mRsmpInBuffer = new int16_t[mRsmpInFrames * inChannelCount];
+    mRsmpOutBuffer = new int32_t[kRecordConvertBlockFrames * 2];
+}
+
+AudioFlinger::RecordThread::RecordConverter::~RecordConverter()
+{
+    delete mResampler;
+    delete[] mRsmpInBuffer;
+    delete[] mRsmpOutBuffer;
+}
+
+size_t AudioFlinger::RecordThread::RecordConverter::convert(RecordTrack* track,
+        const void* in, size_t frameCount)
+{
+    if (mResampler != 0) {
+        return resample(track, (const int16_t *)in, frameCount);
+    }
+    return copy(track, (const int8_t *)in, frameCount);
+}
+
+size_t AudioFlinger::RecordThread::RecordConverter::copy(RecordTrack* track,
+        const int8_t* in, size_t frameCount)
+{
+    AudioBufferProvider::Buffer buffer;
+
+    while (frameCount) {
+        buffer.frameCount = frameCount;
+        if (track->getNextBuffer(&buffer) != NO_ERROR) {
+            break;
+        }
+        if (mConvert == 0) {
+            memcpy(buffer.raw, in, buffer.frameCount * mInFrameSize);
+        } else {
+            mConvert(buffer.i16, (const int16_t *)in, buffer.frameCount);
+        }
+        in += buffer.frameCount * mInFrameSize;
+        frameCount -= buffer.frameCount;
+        track->releaseBuffer(&buffer);
+    }
+    return frameCount;
+}
+
+size_t AudioFlinger::RecordThread::RecordConverter::resample(RecordTrack* track,
+        const int16_t* in, size_t frameCount)
+{
+    size_t lost = 0;
+
+    if (mRsmpInWrite - mRsmpInRead + frameCount > mRsmpInFrames) {
+        lost = (frameCount * mOutSampleRate) / mInSampleRate;
+        frameCount = 0;
+    }
+    while (frameCount) {
+        size_t offset = mRsmpInWrite % mRsmpInFrames;
+        size_t frames = mRsmpInFrames - offset;
+        if (frames > frameCount) {
+            frames = frameCount;
+        }
+        memcpy(mRsmpInBuffer + offset * mInChannelCount, in, frames * mInFrameSize);
+        in += frames * mInChannelCount;
+        mRsmpInWrite += frames;
+        frameCount -= frames;
+    }
+
+    // only ask for the output frames the pending input can produce so that the
+    // resampler never runs out of input in the middle of a buffer. The frames
+    // held by the resampler may be partly consumed already and are not counted.
+    size_t available = mRsmpInWrite - mRsmpInRead - mRsmpInHeld;
+    if (available <= kRecordResamplerMargin) {
+        return lost;
+    }
+    size_t framesOut = ((available - kRecordResamplerMargin) * mOutSampleRate) / mInSampleRate;
+
+    AudioBufferProvider::Buffer buffer;
+    while (framesOut) {
+        buffer.frameCount = framesOut;
+        if (track->getNextBuffer(&buffer) != NO_ERROR) {
+            break;
+        }
+        int16_t *dst = buffer.i16;
+        size_t framesLeft = buffer.frameCount;
+        while (framesLeft) {
+            size_t frames = framesLeft;
+            if (frames > kRecordConvertBlockFrames) {
+                frames = kRecordConvertBlockFrames;
+            }
+            memset(mRsmpOutBuffer, 0, frames * 2 * sizeof(int32_t));
+            mResampler->resample(mRsmpOutBuffer, frames, this);
+            // the resampler always outputs stereo samples, clamped and
+            // converted to the track channel count in one pass
+            if (mOutChannelCount == 1) {
+                AudioMixerSimd::clampDownmixStereo16(dst, mRsmpOutBuffer, frames);
+            } else {
+                AudioMixerSimd::clampStereo16((int32_t *)dst, mRsmpOutBuffer, frames);
+            }
+            dst += frames * mOutChannelCount;
+            framesLeft -= frames;
+        }
+        framesOut -= buffer.frameCount;
+        track->releaseBuffer(&buffer);
+    }
+
+    if (framesOut) {
+        // the track is full: drop the input that was not handed to the
+        // resampler so that the client does not fall further behind
+        lost += framesOut;
+        mRsmpInWrite = mRsmpInRead + mRsmpInHeld;
+    }
+    return lost;
+}
+
+status_t AudioFlinger::RecordThread::RecordConverter::getNextBuffer(AudioBufferProvider::Buffer* buffer)
+{
+    size_t framesReady = mRsmpInWrite - mRsmpInRead;
+    size_t offset = mRsmpInRead % mRsmpInFrames;
+
+    if (framesReady == 0) {
+        buffer->raw = 0;
+        buffer->frameCount = 0;
+        return NOT_ENOUGH_DATA;
+    }
+    if (framesReady > mRsmpInFrames - offset) {
+        framesReady = mRsmpInFrames - offset;
+    }
+    if (buffer->frameCount > framesReady) {
+        buffer->frameCount = framesReady;
+    }
+    buffer->i16 = mRsmpInBuffer + offset * mInChannelCount;
+    mRsmpInHeld = buffer->frameCount;
+    return NO_ERROR;
+}
+
+void AudioFlinger::RecordThread::RecordConverter::releaseBuffer(AudioBufferProvider::Buffer* buffer)
+{
+    mRsmpInRead += buffer->frameCount;
+    mRsmpInHeld = 0;
+    buffer->frameCount = 0;
 }
 
 
@@ -2948,8 +5009,10 @@ AudioFlinger::PlaybackThread::OutputTrack::OutputTrack(
             int format,
             int channelCount,
             int frameCount)
-    :   Track(thread, NULL, AudioSystem::NUM_STREAM_TYPES, sampleRate, format, channelCount, frameCount, NULL),
-    mActive(false), mSourceThread(sourceThread)
+    :   Track(thread, NULL, AudioSystem::NUM_STREAM_TYPES, sampleRate, format, channelCount, frameCount, 0, NULL),
+    mBufferQueueMemory(NULL), mBufferQueueFrames(0), mBufferQueueHead(0), mBufferQueueCount(0),
+    mActive(false), mSourceThread(sourceThread), mServerSeq(0), mWaiters(0), mWakeTime(0),
+    mNumWaits(0), mNumWaitTimeouts(0), mCopiedFrames(0)
 {
 
     PlaybackThread *playbackThread = (PlaybackThread *)thread.unsafe_get();
@@ -2958,6 +5021,19 @@ AudioFlinger::PlaybackThread::OutputTrack::OutputTrack(
         mCblk->buffers = (char*)mCblk + sizeof(audio_track_cblk_t);
         mCblk->volume[0] = mCblk->volume[1] = 0x1000;
         mOutBuffer.frameCount = 0;
+
+        // a pending buffer holds at most one period of the source thread, or
+        // the whole track buffer when priming or draining the track
+        mBufferQueueFrames = sourceThread->frameCount();
+        if (mCblk->frameCount > mBufferQueueFrames) {
+            mBufferQueueFrames = mCblk->frameCount;
+        }
+        mBufferQueueMemory = new int16_t[kMaxOverFlowBuffers * mBufferQueueFrames * channelCount];
+        for (int i = 0; i < kMaxOverFlowBuffers; i++) {
+            mBufferQueue[i].mBuffer = mBufferQueueMemory + i * mBufferQueueFrames * channelCount;
+            mBufferQueue[i].frameCount = 0;
+            mBufferQueue[i].i16 = mBufferQueue[i].mBuffer;
+        }
         playbackThread->mTracks.add(this);
         LOGV("OutputTrack constructor mCblk %p, mBuffer %p, mCblk->buffers %p, mCblk->frameCount %d, mCblk->sampleRate %d, mCblk->channels %d mBufferEnd %p",
                 mCblk, mBuffer, mCblk->buffers, mCblk->frameCount, mCblk->sampleRate, mCblk->channels, mBufferEnd);
@@ -2969,6 +5045,26 @@ AudioFlinger::PlaybackThread::OutputTrack::OutputTrack(
 AudioFlinger::PlaybackThread::OutputTrack::~OutputTrack()
 {
     clearBufferQueue();
+    delete [] mBufferQueueMemory;
+}
+
+void AudioFlinger::PlaybackThread::OutputTrack::releaseBuffer(AudioBufferProvider::Buffer* buffer)
+{
+    Track::releaseBuffer(buffer);
+
+    // the futex is only touched while the source thread waits for room
+    android_atomic_inc(&mServerSeq);
+    if (mWaiters != 0) {
+        mWakeTime = systemTime();
+        futexWake(&mServerSeq, 1);
+    }
+}
+
+void AudioFlinger::PlaybackThread::OutputTrack::dumpWaits(char* buffer, size_t size) const
+{
+    int n = snprintf(buffer, size, "  output track %p: %u waits, %u timeouts\n",
+            this, mNumWaits, mNumWaitTimeouts);
+    mWakeLatency.dump(buffer + n, size - n, "wakeup");
 }
 
 status_t AudioFlinger::PlaybackThread::OutputTrack::start()
@@ -3008,14 +5104,10 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
         if (thread != 0) {
             MixerThread *mixerThread = (MixerThread *)thread.get();
             if (mCblk->frameCount > frames){
-                if (mBufferQueue.size() < kMaxOverFlowBuffers) {
-                    uint32_t startFrames = (mCblk->frameCount - frames);
-                    pInBuffer = new Buffer;
-                    pInBuffer->mBuffer = new int16_t[startFrames * channels];
-                    pInBuffer->frameCount = startFrames;
-                    pInBuffer->i16 = pInBuffer->mBuffer;
-                    memset(pInBuffer->raw, 0, startFrames * channels * sizeof(int16_t));
-                    mBufferQueue.add(pInBuffer);
+                uint32_t startFrames = (mCblk->frameCount - frames);
+                pInBuffer = queueBuffer(startFrames);
+                if (pInBuffer != NULL) {
+                    memset(pInBuffer->raw, 0, pInBuffer->frameCount * channels * sizeof(int16_t));
                 } else {
                     LOGW ("OutputTrack::write() %p no more buffers in queue", this);
                 }
@@ -3025,8 +5117,8 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
 
     while (waitTimeLeftMs) {
         // First write pending buffers, then new data
-        if (mBufferQueue.size()) {
-            pInBuffer = mBufferQueue.itemAt(0);
+        if (mBufferQueueCount) {
+            pInBuffer = &mBufferQueue[mBufferQueueHead];
         } else {
             pInBuffer = &inBuffer;
         }
@@ -3053,6 +5145,7 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
 
         uint32_t outFrames = pInBuffer->frameCount > mOutBuffer.frameCount ? mOutBuffer.frameCount : pInBuffer->frameCount;
         memcpy(mOutBuffer.raw, pInBuffer->raw, outFrames * channels * sizeof(int16_t));
+        mCopiedFrames += outFrames;
         mCblk->stepUser(outFrames);
         pInBuffer->frameCount -= outFrames;
         pInBuffer->i16 += outFrames * channels;
@@ -3060,29 +5153,24 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
         mOutBuffer.i16 += outFrames * channels;
 
         if (pInBuffer->frameCount == 0) {
-            if (mBufferQueue.size()) {
-                mBufferQueue.removeAt(0);
-                delete [] pInBuffer->mBuffer;
-                delete pInBuffer;
-                LOGV("OutputTrack::write() %p thread %p released overflow buffer %d", this, mThread.unsafe_get(), mBufferQueue.size());
+            if (mBufferQueueCount) {
+                dequeueBuffer();
+                LOGV("OutputTrack::write() %p thread %p released overflow buffer %d", this, mThread.unsafe_get(), mBufferQueueCount);
             } else {
                 break;
             }
         }
     }
 
-    // If we could not write all frames, allocate a buffer and queue it for next time.
+    // If we could not write all frames, queue them for next time.
     if (inBuffer.frameCount) {
         sp<ThreadBase> thread = mThread.promote();
         if (thread != 0 && !thread->standby()) {
-            if (mBufferQueue.size() < kMaxOverFlowBuffers) {
-                pInBuffer = new Buffer;
-                pInBuffer->mBuffer = new int16_t[inBuffer.frameCount * channels];
-                pInBuffer->frameCount = inBuffer.frameCount;
-                pInBuffer->i16 = pInBuffer->mBuffer;
-                memcpy(pInBuffer->raw, inBuffer.raw, inBuffer.frameCount * channels * sizeof(int16_t));
-                mBufferQueue.add(pInBuffer);
-                LOGV("OutputTrack::write() %p thread %p adding overflow buffer %d", this, mThread.unsafe_get(), mBufferQueue.size());
+            pInBuffer = queueBuffer(inBuffer.frameCount);
+            if (pInBuffer != NULL) {
+                memcpy(pInBuffer->raw, inBuffer.raw, pInBuffer->frameCount * channels * sizeof(int16_t));
+                mCopiedFrames += pInBuffer->frameCount;
+                LOGV("OutputTrack::write() %p thread %p adding overflow buffer %d", this, mThread.unsafe_get(), mBufferQueueCount);
             } else {
                 LOGW("OutputTrack::write() %p thread %p no more overflow buffers", mThread.unsafe_get(), this);
             }
@@ -3092,15 +5180,13 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
     // Calling write() with a 0 length buffer, means that no more data will be written:
     // If no more buffers are pending, fill output track buffer to make sure it is started
     // by output mixer.
-    if (frames == 0 && mBufferQueue.size() == 0) {
+    if (frames == 0 && mBufferQueueCount == 0) {
         if (mCblk->user < mCblk->frameCount) {
             frames = mCblk->frameCount - mCblk->user;
-            pInBuffer = new Buffer;
-            pInBuffer->mBuffer = new int16_t[frames * channels];
-            pInBuffer->frameCount = frames;
-            pInBuffer->i16 = pInBuffer->mBuffer;
-            memset(pInBuffer->raw, 0, frames * channels * sizeof(int16_t));
-            mBufferQueue.add(pInBuffer);
+            pInBuffer = queueBuffer(frames);
+            if (pInBuffer != NULL) {
+                memset(pInBuffer->raw, 0, pInBuffer->frameCount * channels * sizeof(int16_t));
+            }
         } else if (mActive) {
             stop();
         }
@@ -3112,32 +5198,44 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
 status_t AudioFlinger::PlaybackThread::OutputTrack::obtainBuffer(AudioBufferProvider::Buffer* buffer, uint32_t waitTimeMs)
 {
     int active;
-    status_t result;
     audio_track_cblk_t* cblk = mCblk;
     uint32_t framesReq = buffer->frameCount;
 
 //    LOGV("OutputTrack::obtainBuffer user %d, server %d", cblk->user, cblk->server);
     buffer->frameCount  = 0;
 
-    uint32_t framesAvail = cblk->framesAvailable();
-
+    // user is only written by this thread and server only grows, so the
+    // frames available are read without cblk->lock. mServerSeq is read first:
+    // if the server steps after framesAvailable_l(), the futex wait returns
+    // at once.
+    int32_t seq = mServerSeq;
+    uint32_t framesAvail = cblk->framesAvailable_l();
 
     if (framesAvail == 0) {
-        Mutex::Autolock _l(cblk->lock);
-        goto start_loop_here;
+        nsecs_t deadline = systemTime() + milliseconds(waitTimeMs);
         while (framesAvail == 0) {
             active = mActive;
             if (UNLIKELY(!active)) {
                 LOGV("Not active and NO_MORE_BUFFERS");
                 return AudioTrack::NO_MORE_BUFFERS;
             }
-            result = cblk->cv.waitRelative(cblk->lock, milliseconds(waitTimeMs));
-            if (result != NO_ERROR) {
+            nsecs_t waitStart = systemTime();
+            if (waitStart >= deadline) {
+                mNumWaitTimeouts++;
                 return AudioTrack::NO_MORE_BUFFERS;
             }
+            android_atomic_inc(&mWaiters);
+            futexWait(&mServerSeq, seq, deadline - waitStart);
+            android_atomic_dec(&mWaiters);
+            mNumWaits++;
+
             // read the server count again
-        start_loop_here:
+            seq = mServerSeq;
             framesAvail = cblk->framesAvailable_l();
+            nsecs_t wakeTime = mWakeTime;
+            if (framesAvail != 0 && wakeTime >= waitStart) {
+                mWakeLatency.add(systemTime() - wakeTime);
+            }
         }
     }
 
@@ -3162,17 +5260,125 @@ status_t AudioFlinger::PlaybackThread::OutputTrack::obtainBuffer(AudioBufferProv
 }
 
 
+// getDirectBuffer() returns the location of the next frames of the track buffer
+// if they can be written in place: the track is running, no data is pending and
+// the free space is contiguous. Otherwise it returns NULL and write() must be used.
+int16_t* AudioFlinger::PlaybackThread::OutputTrack::getDirectBuffer(uint32_t frames)
+{
+    audio_track_cblk_t* cblk = mCblk;
+
+    if (!mActive || mBufferQueueCount != 0 || mOutBuffer.frameCount != 0) {
+        return NULL;
+    }
+    if (cblk->framesAvailable_l() < frames) {
+        return NULL;
+    }
+    uint32_t u = cblk->user;
+    if (u + frames > cblk->userBase + cblk->frameCount) {
+        // the buffer wraps
+        return NULL;
+    }
+    return (int16_t *)cblk->buffer(u);
+}
+
+// commitDirectBuffer() makes the frames written in the buffer returned by
+// getDirectBuffer() available to the output mixer
+void AudioFlinger::PlaybackThread::OutputTrack::commitDirectBuffer(uint32_t frames)
+{
+    mCblk->stepUser(frames);
+}
+
 void AudioFlinger::PlaybackThread::OutputTrack::clearBufferQueue()
 {
-    size_t size = mBufferQueue.size();
-    Buffer *pBuffer;
+    mBufferQueueHead = 0;
+    mBufferQueueCount = 0;
+}
 
-    for (size_t i = 0; i < size; i++) {
-        pBuffer = mBufferQueue.itemAt(i);
-        delete [] pBuffer->mBuffer;
-        delete pBuffer;
+// queueBuffer() returns the next free slot of the pending buffer ring, set up to
+// receive the given number of frames, or NULL if all slots are in use
+AudioFlinger::PlaybackThread::OutputTrack::Buffer* AudioFlinger::PlaybackThread::OutputTrack::queueBuffer(uint32_t frames)
+{
+    if (mBufferQueueMemory == NULL || mBufferQueueCount >= kMaxOverFlowBuffers) {
+        return NULL;
+    }
+    if (frames > mBufferQueueFrames) {
+        LOGW("OutputTrack::queueBuffer() %p truncating %d frames to %d", this, frames, mBufferQueueFrames);
+        frames = mBufferQueueFrames;
+    }
+    Buffer *pBuffer = &mBufferQueue[(mBufferQueueHead + mBufferQueueCount) % kMaxOverFlowBuffers];
+    pBuffer->frameCount = frames;
+    pBuffer->i16 = pBuffer->mBuffer;
+    mBufferQueueCount++;
+    return pBuffer;
+}
+
+void AudioFlinger::PlaybackThread::OutputTrack::dequeueBuffer()
+{
+    mBufferQueueHead = (mBufferQueueHead + 1) % kMaxOverFlowBuffers;
+    mBufferQueueCount--;
+}
+
+// ----------------------------------------------------------------------------
+
+// Each slot carries a sequence number: a slot at position pos is free for a
+// producer when mSeq == pos and holds a command for the consumer when
+// mSeq == pos + 1. Producers claim a position by advancing mHead with a
+// compare and swap, then publish the slot by updating its sequence number.
+AudioFlinger::PlaybackThread::TrackCommandQueue::TrackCommandQueue()
+    :   mHead(0), mTail(0)
+{
+    for (int32_t i = 0; i < kSize; i++) {
+        mSlots[i].mSeq = i;
+        mSlots[i].mCommand = 0;
+    }
+}
+
+bool AudioFlinger::PlaybackThread::TrackCommandQueue::push(int command, const sp<Track>& track)
+{
+    Slot *slot;
+    int32_t pos;
+
+    for (;;) {
+        pos = mHead;
+        slot = &mSlots[pos & (kSize - 1)];
+        // acquire: the consumer released the track of the slot before
+        int32_t diff = (int32_t)((uint32_t)audioAcquireLoad(&slot->mSeq) - (uint32_t)pos);
+        if (diff == 0) {
+            if (android_atomic_cmpxchg(pos, pos + 1, &mHead) == 0) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the consumer has not released this slot yet: queue is full
+            return false;
+        }
+    }
+
+    slot->mCommand = command;
+    slot->mTrack = track;
+    // release: the command is visible to the consumer before the sequence
+    audioReleaseStore(pos + 1, &slot->mSeq);
+    return true;
+}
+
+bool AudioFlinger::PlaybackThread::TrackCommandQueue::pop(int *command, sp<Track> *track)
+{
+    Slot *slot = &mSlots[mTail & (kSize - 1)];
+    int32_t diff = (int32_t)((uint32_t)audioAcquireLoad(&slot->mSeq) - (uint32_t)(mTail + 1));
+    if (diff < 0) {
+        return false;
     }
-    mBufferQueue.clear();
+
+    *command = slot->mCommand;
+    *track = slot->mTrack;
+    slot->mTrack.clear();
+    audioReleaseStore(mTail + kSize, &slot->mSeq);
+    mTail++;
+    return true;
+}
+
+bool AudioFlinger::PlaybackThread::TrackCommandQueue::isEmpty() const
+{
+    return mSlots[mTail & (kSize - 1)].mSeq != mTail + 1;
 }
 
 // ----------------------------------------------------------------------------
@@ -3180,14 +5386,10 @@ void AudioFlinger::PlaybackThread::OutputTrack::clearBufferQueue()
 AudioFlinger::Client::Client(const sp<AudioFlinger>& audioFlinger, pid_t pid)
     :   RefBase(),
         mAudioFlinger(audioFlinger),
-#ifdef USE_ECLAIR_MEMORYDEALER
-        mMemoryDealer(new MemoryDealer(1024*1024)),
-#else
-        mMemoryDealer(new MemoryDealer(1024*1024, "AudioFlinger::Client")),
-#endif
+        mHeap(new AudioClientHeap("AudioFlinger::Client")),
         mPid(pid)
 {
-    // 1 MB of address space is good for 32 tracks, 8 buffers each, 4 KB/buffer
+    // the heap grows with the number of tracks of the client
 }
 
 // Client destructor must be called with AudioFlinger::mLock held
@@ -3196,9 +5398,21 @@ AudioFlinger::Client::~Client()
     mAudioFlinger->removeClient_l(mPid);
 }
 
-const sp<MemoryDealer>& AudioFlinger::Client::heap() const
+const sp<AudioClientHeap>& AudioFlinger::Client::heap() const
+{
+    return mHeap;
+}
+
+void AudioFlinger::Client::addTrackCost(const track_cost_t& cost)
+{
+    Mutex::Autolock _l(mCostLock);
+    mTrackCost.add(cost);
+}
+
+AudioFlinger::track_cost_t AudioFlinger::Client::trackCost() const
 {
-    return mMemoryDealer;
+    Mutex::Autolock _l(mCostLock);
+    return mTrackCost;
 }
 
 // ----------------------------------------------------------------------------
@@ -3354,8 +5568,10 @@ status_t AudioFlinger::RecordHandle::onTransact(
 
 AudioFlinger::RecordThread::RecordThread(const sp<AudioFlinger>& audioFlinger, AudioStreamInWrapper *input, uint32_t sampleRate, uint32_t channels, int id) :
     ThreadBase(audioFlinger, id),
-    mInput(input), mResampler(0), mRsmpOutBuffer(0), mRsmpInBuffer(0)
+    mInput(input), mRsmpInBuffer(0)
 {
+    AudioMixerSimd::init();
+    mResamplerTier = defaultResamplerTier();
     mReqChannelCount = AudioSystem::popCount(channels);
     mReqSampleRate = sampleRate;
     readInputParameters();
@@ -3366,10 +5582,6 @@ AudioFlinger::RecordThread::RecordThread(const sp<AudioFlinger>& audioFlinger, A
 AudioFlinger::RecordThread::~RecordThread()
 {
     delete[] mRsmpInBuffer;
-    if (mResampler != 0) {
-        delete mResampler;
-        delete[] mRsmpOutBuffer;
-    }
 }
 
 void AudioFlinger::RecordThread::onFirstRef()
@@ -3384,8 +5596,9 @@ void AudioFlinger::RecordThread::onFirstRef()
 
 bool AudioFlinger::RecordThread::threadLoop()
 {
-    AudioBufferProvider::Buffer buffer;
-    sp<RecordTrack> activeTrack;
+    SortedVector< sp<RecordTrack> > activeTracks;
+    // result of the last read, only used by this thread
+    ssize_t bytesRead = 0;
 
     // start recording
     while (!exitPending()) {
@@ -3394,8 +5607,9 @@ bool AudioFlinger::RecordThread::threadLoop()
 
         { // scope for mLock
             Mutex::Autolock _l(mLock);
+            checkParameterTransaction_l();
             checkForNewParameters_l();
-            if (mActiveTrack == 0 && mConfigEvents.isEmpty()) {
+            if (mActiveTracks.isEmpty() && mConfigEvents.isEmpty()) {
                 if (!mStandby) {
                     mInput->standby();
                     mStandby = true;
@@ -3405,190 +5619,188 @@ bool AudioFlinger::RecordThread::threadLoop()
 
                 LOGV("RecordThread: loop stopping");
                 // go to sleep
-                mWaitWorkCV.wait(mLock);
+                waitWork_l();
                 LOGV("RecordThread: loop starting");
                 continue;
             }
-            if (mActiveTrack != 0) {
-                if (mActiveTrack->mState == TrackBase::PAUSING) {
-                    if (!mStandby) {
-                        mInput->standby();
-                        mStandby = true;
-                    }
-                    mActiveTrack.clear();
-                    mStartStopCond.broadcast();
-                } else if (mActiveTrack->mState == TrackBase::RESUMING) {
-                    if (mReqChannelCount != mActiveTrack->channelCount()) {
-                        mActiveTrack.clear();
-                        mStartStopCond.broadcast();
-                    } else if (mBytesRead != 0) {
-                        // record start succeeds only if first read from audio input
-                        // succeeds
-                        if (mBytesRead > 0) {
-                            mActiveTrack->mState = TrackBase::ACTIVE;
-                        } else {
-                            mActiveTrack.clear();
-                        }
-                        mStartStopCond.broadcast();
-                    }
-                    mStandby = false;
-                }
+            if (!updateActiveTracks_l(bytesRead)) {
+                continue;
             }
+            activeTracks = mActiveTracks;
+        }
+
+        // the input is read once per period whatever the number of clients
+        bytesRead = mInput->read(mRsmpInBuffer, mInputBytes);
+        if (bytesRead < 0) {
+            LOGE("Error reading audio input");
+            // Force input into standby so that it tries to
+            // recover at next read attempt
+            mInput->standby();
+            usleep(5000);
+            activeTracks.clear();
+            continue;
         }
 
-        if (mActiveTrack != 0) {
-            if (mActiveTrack->mState != TrackBase::ACTIVE &&
-                mActiveTrack->mState != TrackBase::RESUMING) {
-                usleep(5000);
+        size_t frameCount = bytesRead / mFrameSize;
+        for (size_t i = 0; i < activeTracks.size(); i++) {
+            RecordTrack* track = activeTracks[i].get();
+            if (track->mState != TrackBase::ACTIVE &&
+                track->mState != TrackBase::RESUMING) {
                 continue;
             }
-            buffer.frameCount = mFrameCount;
-            if (LIKELY(mActiveTrack->getNextBuffer(&buffer) == NO_ERROR)) {
-                size_t framesOut = buffer.frameCount;
-                if (mResampler == 0) {
-                    // no resampling
-                    while (framesOut) {
-                        size_t framesIn = mFrameCount - mRsmpInIndex;
-                        if (framesIn) {
-                            int8_t *src = (int8_t *)mRsmpInBuffer + mRsmpInIndex * mFrameSize;
-                            int8_t *dst = buffer.i8 + (buffer.frameCount - framesOut) * mActiveTrack->mCblk->frameSize;
-                            if (framesIn > framesOut)
-                                framesIn = framesOut;
-                            mRsmpInIndex += framesIn;
-                            framesOut -= framesIn;
-                            if (mChannelCount == mReqChannelCount ||
-                                mFormat != AudioSystem::PCM_16_BIT) {
-                                memcpy(dst, src, framesIn * mFrameSize);
-                            } else {
-                                int16_t *src16 = (int16_t *)src;
-                                int16_t *dst16 = (int16_t *)dst;
-                                if (mChannelCount == 1) {
-                                    while (framesIn--) {
-                                        *dst16++ = *src16;
-                                        *dst16++ = *src16++;
-                                    }
-                                } else {
-                                    while (framesIn--) {
-                                        *dst16++ = (int16_t)(((int32_t)*src16 + (int32_t)*(src16 + 1)) >> 1);
-                                        src16 += 2;
-                                    }
-                                }
-                            }
-                        }
-                        if (framesOut && mFrameCount == mRsmpInIndex) {
-                            if (framesOut == mFrameCount &&
-                                (mChannelCount == mReqChannelCount || mFormat != AudioSystem::PCM_16_BIT)) {
-                                mBytesRead = mInput->read(buffer.raw, mInputBytes);
-                                framesOut = 0;
-                            } else {
-                                mBytesRead = mInput->read(mRsmpInBuffer, mInputBytes);
-                                mRsmpInIndex = 0;
-                            }
-                            if (mBytesRead < 0) {
-                                LOGE("Error reading audio input");
-                                if (mActiveTrack->mState == TrackBase::ACTIVE) {
-                                    // Force input into standby so that it tries to
-                                    // recover at next read attempt
-                                    mInput->standby();
-                                    usleep(5000);
-                                }
-                                mRsmpInIndex = mFrameCount;
-                                framesOut = 0;
-                                buffer.frameCount = 0;
-                            }
-                        }
-                    }
-                } else {
-                    // resampling
-
-                    memset(mRsmpOutBuffer, 0, framesOut * 2 * sizeof(int32_t));
-                    // alter output frame count as if we were expecting stereo samples
-                    if (mChannelCount == 1 && mReqChannelCount == 1) {
-                        framesOut >>= 1;
-                    }
-                    mResampler->resample(mRsmpOutBuffer, framesOut, this);
-                    // ditherAndClamp() works as long as all buffers returned by mActiveTrack->getNextBuffer()
-                    // are 32 bit aligned which should be always true.
-                    if (mChannelCount == 2 && mReqChannelCount == 1) {
-                        AudioMixer::ditherAndClamp(&dither, mRsmpOutBuffer, mRsmpOutBuffer, framesOut);
-                        // the resampler always outputs stereo samples: do post stereo to mono conversion
-                        int16_t *src = (int16_t *)mRsmpOutBuffer;
-                        int16_t *dst = buffer.i16;
-                        while (framesOut--) {
-                            *dst++ = (int16_t)(((int32_t)*src + (int32_t)*(src + 1)) >> 1);
-                            src += 2;
-                        }
-                    } else {
-                        AudioMixer::ditherAndClamp(&dither, (int32_t *)buffer.raw, mRsmpOutBuffer, framesOut);
-                    }
-
+            size_t lost = track->mConverter->convert(track, mRsmpInBuffer, frameCount);
+            if (lost == 0) {
+                if (track->mOverflowStart != 0) {
+                    mOverflowRecovery.add(systemTime() - track->mOverflowStart);
+                    track->mOverflowStart = 0;
                 }
-                mActiveTrack->releaseBuffer(&buffer);
-                mActiveTrack->overflow();
-            }
-            // client isn't retrieving buffers fast enough
-            else {
-                if (!mActiveTrack->setOverflow())
+                track->overflow();
+            } else {
+                // client isn't retrieving buffers fast enough: the other clients
+                // must not be delayed, drop what does not fit
+                if (track->mOverflowStart == 0) {
+                    track->mOverflowStart = systemTime();
+                }
+                track->mOverflows++;
+                track->mFramesLost += lost;
+                if (!track->setOverflow())
                     LOGW("RecordThread: buffer overflow");
-                // Release the processor for a while before asking for a new buffer.
-                // This will give the application more chance to read from the buffer and
-                // clear the overflow.
-                usleep(5000);
             }
         }
+        activeTracks.clear();
     }
 
     if (!mStandby) {
         mInput->standby();
     }
-    mActiveTrack.clear();
-
-    mStartStopCond.broadcast();
+    {
+        Mutex::Autolock _l(mLock);
+        mActiveTracks.clear();
+        mStartStopCond.broadcast();
+    }
 
     LOGV("RecordThread %p exiting", this);
     return false;
 }
 
+// updateActiveTracks_l() must be called with ThreadBase::mLock held. It applies
+// the start and stop requests and returns true if the input must be read.
+// bytesRead is the result of the last read of the input.
+bool AudioFlinger::RecordThread::updateActiveTracks_l(ssize_t bytesRead)
+{
+    bool changed = false;
+    bool ready = false;
+
+    for (size_t i = mActiveTracks.size(); i > 0; ) {
+        i--;
+        RecordTrack* track = mActiveTracks[i].get();
+        bool remove = false;
+        bool started = false;
+
+        if (track->mState == TrackBase::PAUSING) {
+            remove = true;
+        } else if (track->mConverter == 0 &&
+                (track->mState == TrackBase::RESUMING || track->mState == TrackBase::ACTIVE)) {
+            RecordConverter* converter = new RecordConverter(mSampleRate, mChannelCount,
+                    mFormat, mFrameSize, mFrameCount,
+                    track->mCblk->sampleRate, track->channelCount(), track->format(),
+                    track->resamplerTier(mResamplerTier));
+            if (converter->initCheck() == NO_ERROR) {
+                track->mConverter = converter;
+                started = true;
+                mStandby = false;
+            } else {
+                LOGW("RecordThread: cannot convert input to %d Hz, %d channels",
+                        track->mCblk->sampleRate, track->channelCount());
+                delete converter;
+                remove = true;
+            }
+        }
+        // record start succeeds only if first read from audio input succeeds.
+        // A track started here waits for the next read, the last one happened
+        // before its start.
+        if (!remove && !started && track->mState == TrackBase::RESUMING) {
+            if (bytesRead > 0) {
+                track->mState = TrackBase::ACTIVE;
+                changed = true;
+            } else if (bytesRead < 0) {
+                remove = true;
+            }
+            mStandby = false;
+        }
+
+        if (remove) {
+            delete track->mConverter;
+            track->mConverter = 0;
+            mActiveTracks.removeAt(i);
+            changed = true;
+        } else if (track->mState == TrackBase::ACTIVE ||
+                   track->mState == TrackBase::RESUMING) {
+            ready = true;
+        }
+    }
+
+    if (mActiveTracks.isEmpty() && !mStandby) {
+        mInput->standby();
+        mStandby = true;
+    }
+    if (changed) {
+        mStartStopCond.broadcast();
+    }
+    if (!ready && !mActiveTracks.isEmpty()) {
+        // a track is being started: start() signals mWaitWorkCV once it is
+        // resumed or removed
+        mWaitWorkCV.waitRelative(mLock, kRecordStartTimeout);
+    }
+    return ready;
+}
+
 status_t AudioFlinger::RecordThread::start(RecordThread::RecordTrack* recordTrack)
 {
     LOGV("RecordThread::start");
     sp <ThreadBase> strongMe = this;
     status_t status = NO_ERROR;
+    bool lastClient = false;
     {
         AutoMutex lock(&mLock);
-        if (mActiveTrack != 0) {
-            if (recordTrack != mActiveTrack.get()) {
-                status = -EBUSY;
-            } else if (mActiveTrack->mState == TrackBase::PAUSING) {
-                mActiveTrack->mState = TrackBase::ACTIVE;
+        if (mActiveTracks.indexOf(recordTrack) >= 0) {
+            if (recordTrack->mState == TrackBase::PAUSING) {
+                recordTrack->mState = TrackBase::ACTIVE;
             }
             return status;
         }
 
         recordTrack->mState = TrackBase::IDLE;
-        mActiveTrack = recordTrack;
-        mLock.unlock();
-        status_t status = AudioSystem::startInput(mId);
-        mLock.lock();
-        if (status != NO_ERROR) {
-            mActiveTrack.clear();
-            return status;
+        mActiveTracks.add(recordTrack);
+        // the input is started by the first client and shared with the next ones
+        if (mActiveTracks.size() == 1) {
+            mLock.unlock();
+            status_t status = AudioSystem::startInput(mId);
+            mLock.lock();
+            if (status != NO_ERROR) {
+                mActiveTracks.remove(recordTrack);
+                mWaitWorkCV.signal();
+                return status;
+            }
         }
-        mActiveTrack->mState = TrackBase::RESUMING;
-        mRsmpInIndex = mFrameCount;
-        mBytesRead = 0;
+        recordTrack->mState = TrackBase::RESUMING;
         // signal thread to start
         LOGV("Signal record thread");
         mWaitWorkCV.signal();
         // do not wait for mStartStopCond if exiting
         if (mExiting) {
-            mActiveTrack.clear();
+            mActiveTracks.remove(recordTrack);
+            lastClient = mActiveTracks.isEmpty();
             status = INVALID_OPERATION;
             goto startError;
         }
-        mStartStopCond.wait(mLock);
-        if (mActiveTrack == 0) {
+        while (recordTrack->mState == TrackBase::RESUMING &&
+               mActiveTracks.indexOf(recordTrack) >= 0) {
+            mStartStopCond.wait(mLock);
+        }
+        if (mActiveTracks.indexOf(recordTrack) < 0) {
             LOGV("Record failed to start");
+            lastClient = mActiveTracks.isEmpty();
             status = BAD_VALUE;
             goto startError;
         }
@@ -3596,7 +5808,9 @@ status_t AudioFlinger::RecordThread::start(RecordThread::RecordTrack* recordTrac
         return status;
     }
 startError:
-    AudioSystem::stopInput(mId);
+    if (lastClient) {
+        AudioSystem::stopInput(mId);
+    }
     return status;
 }
 
@@ -3605,15 +5819,19 @@ void AudioFlinger::RecordThread::stop(RecordThread::RecordTrack* recordTrack) {
     sp <ThreadBase> strongMe = this;
     {
         AutoMutex lock(&mLock);
-        if (mActiveTrack != 0 && recordTrack == mActiveTrack.get()) {
-            mActiveTrack->mState = TrackBase::PAUSING;
+        if (mActiveTracks.indexOf(recordTrack) >= 0) {
+            recordTrack->mState = TrackBase::PAUSING;
             // do not wait for mStartStopCond if exiting
             if (mExiting) {
                 return;
             }
-            mStartStopCond.wait(mLock);
-            // if we have been restarted, recordTrack == mActiveTrack.get() here
-            if (mActiveTrack == 0 || recordTrack != mActiveTrack.get()) {
+            while (recordTrack->mState == TrackBase::PAUSING &&
+                   mActiveTracks.indexOf(recordTrack) >= 0) {
+                mStartStopCond.wait(mLock);
+            }
+            // if we have been restarted, recordTrack is still active here.
+            // The input is stopped with the last client.
+            if (mActiveTracks.isEmpty()) {
                 mLock.unlock();
                 AudioSystem::stopInput(mId);
                 mLock.lock();
@@ -3633,22 +5851,29 @@ status_t AudioFlinger::RecordThread::dump(int fd, const Vector<String16>& args)
     snprintf(buffer, SIZE, "\nInput thread %p internals\n", this);
     result.append(buffer);
 
-    if (mActiveTrack != 0) {
-        result.append("Active Track:\n");
-        result.append("   Clien Fmt Chn Buf  S SRate  Serv     User\n");
-        mActiveTrack->dump(buffer, SIZE);
-        result.append(buffer);
+    mLock.lock();
+    SortedVector< sp<RecordTrack> > activeTracks = mActiveTracks;
+    mLock.unlock();
 
-        snprintf(buffer, SIZE, "In index: %d\n", mRsmpInIndex);
+    if (!activeTracks.isEmpty()) {
+        snprintf(buffer, SIZE, "Active Tracks: %d\n", activeTracks.size());
         result.append(buffer);
+        result.append("   Clien Fmt Chn Buf  S SRate  Serv     User     Rsmp Ovfl     Lost\n");
+        for (size_t i = 0; i < activeTracks.size(); i++) {
+            activeTracks[i]->dump(buffer, SIZE);
+            result.append(buffer);
+        }
+
         snprintf(buffer, SIZE, "In size: %d\n", mInputBytes);
         result.append(buffer);
-        snprintf(buffer, SIZE, "Resampling: %d\n", (mResampler != 0));
-        result.append(buffer);
         snprintf(buffer, SIZE, "Out channel count: %d\n", mReqChannelCount);
         result.append(buffer);
         snprintf(buffer, SIZE, "Out sample rate: %d\n", mReqSampleRate);
         result.append(buffer);
+        result.append("overflow recovery latency (usecs):\n");
+        result.append("  stage        count     p50     p99     max\n");
+        mOverflowRecovery.dump(buffer, SIZE, "recovery");
+        result.append(buffer);
 
 
     } else {
@@ -3661,50 +5886,6 @@ status_t AudioFlinger::RecordThread::dump(int fd, const Vector<String16>& args)
     return NO_ERROR;
 }
 
-status_t AudioFlinger::RecordThread::getNextBuffer(AudioBufferProvider::Buffer* buffer)
-{
-    size_t framesReq = buffer->frameCount;
-    size_t framesReady = mFrameCount - mRsmpInIndex;
-    int channelCount;
-
-    if (framesReady == 0) {
-        mBytesRead = mInput->read(mRsmpInBuffer, mInputBytes);
-        if (mBytesRead < 0) {
-            LOGE("RecordThread::getNextBuffer() Error reading audio input");
-            if (mActiveTrack->mState == TrackBase::ACTIVE) {
-                // Force input into standby so that it tries to
-                // recover at next read attempt
-                mInput->standby();
-                usleep(5000);
-            }
-            buffer->raw = 0;
-            buffer->frameCount = 0;
-            return NOT_ENOUGH_DATA;
-        }
-        mRsmpInIndex = 0;
-        framesReady = mFrameCount;
-    }
-
-    if (framesReq > framesReady) {
-        framesReq = framesReady;
-    }
-
-    if (mChannelCount == 1 && mReqChannelCount == 2) {
-        channelCount = 1;
-    } else {
-        channelCount = 2;
-    }
-    buffer->raw = mRsmpInBuffer + mRsmpInIndex * channelCount;
-    buffer->frameCount = framesReq;
-    return NO_ERROR;
-}
-
-void AudioFlinger::RecordThread::releaseBuffer(AudioBufferProvider::Buffer* buffer)
-{
-    mRsmpInIndex += buffer->frameCount;
-    buffer->frameCount = 0;
-}
-
 bool AudioFlinger::RecordThread::checkForNewParameters_l()
 {
     bool reconfig = false;
@@ -3734,7 +5915,7 @@ bool AudioFlinger::RecordThread::checkForNewParameters_l()
             // do not accept frame count changes if tracks are open as the track buffer
             // size depends on frame count and correct behavior would not be garantied
             // if frame count is changed after track creation
-            if (mActiveTrack != 0) {
+            if (!mActiveTracks.isEmpty()) {
                 status = INVALID_OPERATION;
             } else {
                 reconfig = true;
@@ -3760,11 +5941,7 @@ bool AudioFlinger::RecordThread::checkForNewParameters_l()
             }
         }
 
-        mNewParameters.removeAt(0);
-
-        mParamStatus = status;
-        mParamCond.signal();
-        mWaitWorkCV.wait(mLock);
+        replyParameters_l(status);
     }
     return reconfig;
 }
@@ -3799,10 +5976,7 @@ void AudioFlinger::RecordThread::audioConfigChanged(int event, int param) {
 
 void AudioFlinger::RecordThread::readInputParameters()
 {
-    if (mRsmpInBuffer) delete mRsmpInBuffer;
-    if (mRsmpOutBuffer) delete mRsmpOutBuffer;
-    if (mResampler) delete mResampler;
-    mResampler = 0;
+    delete[] mRsmpInBuffer;
 
     mSampleRate = mInput->sampleRate();
     mChannelCount = AudioSystem::popCount(mInput->channels());
@@ -3812,28 +5986,12 @@ void AudioFlinger::RecordThread::readInputParameters()
     mFrameCount = mInputBytes / mFrameSize;
     mRsmpInBuffer = new int16_t[mFrameCount * mChannelCount];
 
-    if (mSampleRate != mReqSampleRate && mChannelCount < 3 && mReqChannelCount < 3)
-    {
-        int channelCount;
-         // optmization: if mono to mono, use the resampler in stereo to stereo mode to avoid
-         // stereo to mono post process as the resampler always outputs stereo.
-        if (mChannelCount == 1 && mReqChannelCount == 2) {
-            channelCount = 1;
-        } else {
-            channelCount = 2;
-        }
-        mResampler = AudioResampler::create(16, channelCount, mReqSampleRate);
-        mResampler->setSampleRate(mSampleRate);
-        mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
-        mRsmpOutBuffer = new int32_t[mFrameCount * 2];
-
-        // optmization: if mono to mono, alter input frame count as if we were inputing stereo samples
-        if (mChannelCount == 1 && mReqChannelCount == 1) {
-            mFrameCount >>= 1;
-        }
-
+    // the converters depend on the input configuration: they are created again
+    // by the thread loop
+    for (size_t i = 0; i < mActiveTracks.size(); i++) {
+        delete mActiveTracks[i]->mConverter;
+        mActiveTracks[i]->mConverter = 0;
     }
-    mRsmpInIndex = mFrameCount;
 }
 
 unsigned int AudioFlinger::RecordThread::getInputFramesLost()
@@ -3890,7 +6048,14 @@ int AudioFlinger::openOutput(uint32_t *pDevices,
             thread = new DirectOutputThread(this, output, ++mNextThreadId);
             LOGV("openOutput() created direct output: ID %d thread %p", mNextThreadId, thread);
         } else {
-            thread = new MixerThread(this, output, ++mNextThreadId);
+            MixerThread *mixerThread = new MixerThread(this, output, ++mNextThreadId);
+            if (flags & kOutputFlagDeepBuffer) {
+                char value[PROPERTY_VALUE_MAX];
+                property_get("ro.audio.deep_buffer_ms", value, "200");
+                uint32_t ms = atoi(value);
+                mixerThread->setDeepBuffer((ms <= kMaxDeepBufferMs) ? ms : kDefaultDeepBufferMs);
+            }
+            thread = mixerThread;
             LOGV("openOutput() created mixer output: ID %d thread %p", mNextThreadId, thread);
 
 #ifdef LVMX
@@ -4169,4 +6334,8 @@ void AudioFlinger::instantiate() {
             String16("media.audio_flinger"), new AudioFlinger());
 }
 
+sp<AudioFlinger> AudioFlinger::createStandalone(AudioHardwareWrapper* hardware) {
+    return new AudioFlinger(hardware);
+}
+
 }; // namespace android
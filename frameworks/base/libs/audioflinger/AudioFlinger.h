@@ -40,10 +40,16 @@
 #include <utils/Vector.h>
 
 #include "AudioHardwareWrapper.h"
+#include "AudioClientHeap.h"
 
 #include "AudioBufferProvider.h"
 #include "AudioDSP.h"
 #include "AudioMixer.h"
+#include "AudioMixerPool.h"
+#include "AudioMixerSimd.h"
+#include "AudioResamplerPolyphase.h"
+#include "AudioSync.h"
+#include "StandbyPolicy.h"
 
 namespace android {
 
@@ -68,6 +74,12 @@ class AudioFlinger : public BnAudioFlinger, public IBinder::DeathRecipient
 public:
     static void instantiate();
 
+    // An AudioFlinger on the given hardware that is not published to the
+    // service manager, for the benchmarks in tests/. It does not notify the
+    // policy service of the playback tracks started and stopped and its dump()
+    // does not check the caller permission.
+    static sp<AudioFlinger> createStandalone(AudioHardwareWrapper* hardware);
+
     virtual     status_t    dump(int fd, const Vector<String16>& args);
 
     // IAudioFlinger interface
@@ -192,7 +204,7 @@ public:
                                 uint32_t flags);
 
 private:
-                            AudioFlinger();
+                            AudioFlinger(AudioHardwareWrapper* hardware = 0);
     virtual                 ~AudioFlinger();
 
 
@@ -201,24 +213,84 @@ private:
     status_t dumpClients(int fd, const Vector<String16>& args);
     status_t dumpInternals(int fd, const Vector<String16>& args);
 
+    // CPU time used by a mixer thread for a playback track, in thread time
+    // nanoseconds, and duration of the audio mixed for it
+    struct track_cost_t {
+        track_cost_t()
+            :   resample(0),
+                ramp(0),
+                mix(0),
+                estimated(0),
+                played(0)
+        {
+        }
+        void        add(const track_cost_t& cost) {
+            resample += cost.resample;
+            ramp += cost.ramp;
+            mix += cost.mix;
+            estimated += cost.estimated;
+            played += cost.played;
+        }
+        // prints the costs in usecs and their share of the played duration
+        void        dump(char* buffer, size_t size) const;
+
+        nsecs_t     resample;
+        nsecs_t     ramp;
+        nsecs_t     mix;
+        // part of the above that is an equal share of an AudioMixer period,
+        // the rest is measured for the track alone
+        nsecs_t     estimated;
+        nsecs_t     played;
+    };
+
     // --- Client ---
     class Client : public RefBase {
     public:
                             Client(const sp<AudioFlinger>& audioFlinger, pid_t pid);
         virtual             ~Client();
-        const sp<MemoryDealer>&     heap() const;
+        const sp<AudioClientHeap>&  heap() const;
         pid_t               pid() const { return mPid; }
         sp<AudioFlinger>    audioFlinger() { return mAudioFlinger; }
 
+        // cost of the tracks of the client already deleted
+        void                addTrackCost(const track_cost_t& cost);
+        track_cost_t        trackCost() const;
+
     private:
                             Client(const Client&);
                             Client& operator = (const Client&);
         sp<AudioFlinger>    mAudioFlinger;
-        sp<MemoryDealer>    mMemoryDealer;
+        sp<AudioClientHeap> mHeap;
         pid_t               mPid;
+        mutable Mutex       mCostLock;
+        track_cost_t        mTrackCost;
     };
 
 
+    // Fixed bucket histogram of durations, used to profile the playback thread
+    // loop. Buckets are half an octave wide (in microseconds) so that both short
+    // mix times and blocking writes are resolved without any allocation.
+    class LatencyHistogram {
+    public:
+                            LatencyHistogram() { reset(); }
+
+                void        add(nsecs_t duration);
+                void        reset();
+                uint32_t    count() const { return mCount; }
+                uint32_t    percentile(uint32_t percent) const;
+                void        dump(char* buffer, size_t size, const char* name) const;
+
+    private:
+        static  int         bucketIndex(uint32_t us);
+        static  uint32_t    bucketMax(int index);
+
+        static const int    kNumBuckets = 64;
+
+        uint32_t            mBuckets[kNumBuckets];
+        uint32_t            mCount;
+        uint32_t            mMax;
+    };
+
     class TrackHandle;
     class RecordHandle;
     class RecordThread;
@@ -254,6 +326,12 @@ private:
                 STEPSERVER_FAILED = 0x01, //  StepServer could not acquire cblk->lock mutex
                 SYSTEM_FLAGS_MASK = 0x0000ffffUL,
                 // The upper 16 bits are used for track-specific flags.
+                // Low latency playback track, see MixerThread::mixFastTracks()
+                FAST_TRACK = 0x00010000UL,
+                // Resampler quality requested by the client: 0 for the thread
+                // default, else AudioResamplerPolyphase::tier_t + 1
+                RESAMPLER_TIER_SHIFT = 28,
+                RESAMPLER_TIER_MASK = 0x30000000UL,
             };
 
                                 TrackBase(const wp<ThreadBase>& thread,
@@ -263,7 +341,8 @@ private:
                                         int channelCount,
                                         int frameCount,
                                         uint32_t flags,
-                                        const sp<IMemory>& sharedBuffer);
+                                        const sp<IMemory>& sharedBuffer,
+                                        const sp<IMemory>& cblkMemory = sp<IMemory>());
                                 ~TrackBase();
 
             virtual status_t    start() = 0;
@@ -293,6 +372,12 @@ private:
 
             int sampleRate() const;
 
+            // tier requested with the track flags, or defaultTier
+            int resamplerTier(int defaultTier) const {
+                int tier = (int)((mFlags & RESAMPLER_TIER_MASK) >> RESAMPLER_TIER_SHIFT);
+                return (tier != 0) ? tier - 1 : defaultTier;
+            }
+
             void* getBuffer(uint32_t offset, uint32_t frames) const;
 
             bool isStopped() const {
@@ -336,6 +421,14 @@ private:
                     void        exit();
         virtual     bool        checkForNewParameters_l() = 0;
         virtual     status_t    setParameters(const String8& keyValuePairs);
+                    // the parameters set between beginParameters() and commitParameters()
+                    // are merged and applied by one checkForNewParameters_l() pass.
+                    // beginParameters() returns the id of the transaction, and only the
+                    // requests carrying it are merged: the others wait for the commit.
+                    // A begin with the id of the open transaction nests in it, the
+                    // outermost commit applies it.
+                    int         beginParameters(int id);
+                    status_t    commitParameters(int id);
         virtual     String8     getParameters(const String8& keys) = 0;
         virtual     void        audioConfigChanged(int event, int param = 0) = 0;
                     void        sendConfigEvent(int event, int param = 0);
@@ -366,11 +459,52 @@ private:
                     uint32_t                mFrameSize;
                     Condition               mParamCond;
                     Vector<String8>         mNewParameters;
+                    // sequence number of each pending request, 0 when no client waits
+                    Vector<uint32_t>        mNewParametersSeq;
                     status_t                mParamStatus;
                     Vector<ConfigEvent *>   mConfigEvents;
                     bool                    mStandby;
                     int                     mId;
                     bool                    mExiting;
+                    // incremented with mLock held each time a parameter change or
+                    // config event is queued so that the thread loop can check
+                    // for pending requests without taking mLock
+                    volatile int32_t        mPendingRequests;
+                    // last sequence number queued and the one mParamStatus is for
+                    uint32_t                mParamSeq;
+                    uint32_t                mParamReplySeq;
+
+                    status_t                queueParameters_l(const String8& keyValuePairs);
+                    void                    replyParameters_l(status_t status);
+                    int                     beginParameters_l(int id);
+                    status_t                commitParameters_l(int id);
+                    void                    mergeParameters_l(const String8& keyValuePairs);
+                    String8                 endParameterTransaction_l();
+                    void                    expireParameters_l();
+                    void                    waitParameterTransaction_l(int id);
+                    void                    checkParameterTransaction_l();
+                    void                    checkParameterTransaction();
+                    void                    waitWork_l();
+
+                    // open parameter transaction: the merged key value pairs, number of
+                    // requests merged and how many of them could reconfigure the output
+                    int                     mParamTransactionDepth;
+                    int                     mLastParamTransactionId;
+                    int                     mParamTransactionId;
+                    nsecs_t                 mParamTransactionStart;
+                    AudioParameter          mParamTransaction;
+                    uint32_t                mParamTransactionRequests;
+                    uint32_t                mParamTransactionReconfigs;
+                    // signaled when the open transaction ends
+                    Condition               mParamTransactionCond;
+                    // set while a transaction is open, read by the thread loop without mLock
+                    volatile int32_t        mParamTransactionOpen;
+                    // id of the last expired transaction, its commit returns TIMED_OUT
+                    int                     mExpiredTransactionId;
+                    uint32_t                mNumParamTransactions;
+                    uint32_t                mNumMergedParams;
+                    uint32_t                mNumExpiredTransactions;
+                    uint32_t                mNumStandbyCyclesSaved;
     };
 
     // --- PlaybackThread ---
@@ -399,10 +533,15 @@ private:
                                         int format,
                                         int channelCount,
                                         int frameCount,
-                                        const sp<IMemory>& sharedBuffer);
+                                        uint32_t flags,
+                                        const sp<IMemory>& sharedBuffer,
+                                        const sp<IMemory>& cblkMemory = sp<IMemory>());
                                 ~Track();
 
                     void        dump(char* buffer, size_t size);
+                    void        dumpCost(char* buffer, size_t size);
+                    void        allocateResampler(size_t frameCount, uint32_t outputRate,
+                                        int tier);
             virtual status_t    start();
             virtual void        stop();
                     void        pause();
@@ -440,13 +579,21 @@ private:
                 return mState == PAUSED;
             }
             bool isReady() const;
-            void setPaused() { mState = PAUSED; }
+            // called by the mixer thread without mLock: do not overwrite a
+            // state change made by a binder thread in the meantime
+            void setPaused() {
+                audioAtomicCmpxchg(PAUSING, PAUSED, (volatile int32_t *)&mState);
+            }
             void reset();
 
             bool isOutputTrack() const {
                 return (mStreamType == AudioSystem::NUM_STREAM_TYPES);
             }
 
+            bool isFastTrack() const {
+                return (mFlags & FAST_TRACK) != 0;
+            }
+
             // we don't really need a lock for these
             float               mVolume[2];
             volatile bool       mMute;
@@ -456,8 +603,81 @@ private:
             int8_t              mRetryCount;
             sp<IMemory>         mSharedBuffer;
             bool                mResetDone;
+            // set by flush() while the track is active, the mixer thread then
+            // resets the track and signals mFlushCond
+            volatile bool       mFlushPending;
             int                 mStreamType;
             int                 mName;
+
+            // last configuration sent to AudioMixer for this track name, so that
+            // the mixer is only reconfigured when something actually changes.
+            // Only accessed by the mixer thread once the track is active.
+            struct mixer_state_t {
+                mixer_state_t()
+                    :   valid(false),
+                        enabled(false),
+                        provider(0),
+                        format(0),
+                        channelCount(0),
+                        sampleRate(0)
+                {
+                    volume[0] = volume[1] = 0;
+                }
+                bool        valid;
+                bool        enabled;
+                AudioBufferProvider* provider;
+                int         format;
+                int         channelCount;
+                uint32_t    sampleRate;
+                int16_t     volume[2];
+            };
+            mixer_state_t       mMixerState;
+            // consecutive periods at zero volume, up to 2: from the second
+            // one the track is consumed by MixerThread::skipTrack() instead
+            // of being mixed
+            uint8_t             mSilentPeriods;
+            // fraction of output frame left by skipTrack(), in 1 / mSampleRate
+            uint32_t            mSkipRemainder;
+
+            // CPU time used by the mixer thread for the track, and how
+            // AudioMixer mixes it during the current period
+            track_cost_t        mCost;
+            bool                mCostRamp;
+            bool                mCostResampled;
+
+            // volume of the last period when the track was mixed without
+            // AudioMixer, by the pool or by MixerThread::mixDirect()
+            int16_t             mDirectVolume[2];
+            bool                mMixedDirect;
+
+            // Period of the track converted to the output rate by mResampler,
+            // mixed by AudioMixer in place of the track.
+            class ResampledBuffer : public AudioBufferProvider {
+            public:
+                                    ResampledBuffer() : mData(0), mFrames(0), mPos(0) {}
+                virtual status_t    getNextBuffer(AudioBufferProvider::Buffer* buffer);
+                virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
+
+                int16_t*            mData;
+                size_t              mFrames;
+                size_t              mPos;
+            };
+
+            // state used when the track is resampled by the mixer thread, see
+            // MixerThread::resampleTrack(), or by the worker pool. Allocated by
+            // allocateResampler() before the track is mixed by the thread.
+            AudioResamplerPolyphase* mResampler;
+            uint32_t            mResamplerInputRate;
+            ResampledBuffer     mResampled;
+
+            // state used when the track is mixed by MixerThread::mixFastTracks()
+            int16_t             mFastVolume[2];
+            // earliest time the client can have written the next frames mixed:
+            // start() or the last sub-period the track had no frame. 0 while
+            // the track plays.
+            nsecs_t             mFastTapTime;
+            // frames were mixed since the last prepareTracks()
+            bool                mFastMixed;
         };  // end of Track
 
 
@@ -481,24 +701,84 @@ private:
             virtual status_t    start();
             virtual void        stop();
                     bool        write(int16_t* data, uint32_t frames);
-                    bool        bufferQueueEmpty() { return (mBufferQueue.size() == 0) ? true : false; }
+                    int16_t*    getDirectBuffer(uint32_t frames);
+                    void        commitDirectBuffer(uint32_t frames);
+                    bool        bufferQueueEmpty() { return (mBufferQueueCount == 0) ? true : false; }
                     bool        isActive() { return mActive; }
             wp<ThreadBase>&     thread()  { return mThread; }
+                    void        dumpWaits(char* buffer, size_t size) const;
+                    uint64_t    copiedFrames() const { return mCopiedFrames; }
 
         private:
 
+            // called by the output mixer thread: wakes up obtainBuffer()
+            virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
             status_t            obtainBuffer(AudioBufferProvider::Buffer* buffer, uint32_t waitTimeMs);
             void                clearBufferQueue();
+            Buffer*             queueBuffer(uint32_t frames);
+            void                dequeueBuffer();
 
-            // Maximum number of pending buffers allocated by OutputTrack::write()
+            // Maximum number of pending buffers queued by OutputTrack::write()
             static const uint8_t kMaxOverFlowBuffers = 10;
 
-            Vector < Buffer* >          mBufferQueue;
+            // Pending buffers are slots of a ring allocated once in the constructor
+            // so that write() never allocates memory on the playback path.
+            Buffer                      mBufferQueue[kMaxOverFlowBuffers];
+            int16_t*                    mBufferQueueMemory;
+            uint32_t                    mBufferQueueFrames; // size of one slot in frames
+            uint8_t                     mBufferQueueHead;
+            uint8_t                     mBufferQueueCount;
             AudioBufferProvider::Buffer mOutBuffer;
             bool                        mActive;
             DuplicatingThread*          mSourceThread;
+
+            // Futex word bumped each time the output mixer consumes frames.
+            // obtainBuffer() sleeps on it when the track is full, and is only
+            // woken up while it is registered in mWaiters. Both ends are
+            // AudioFlinger threads: client tracks still use the cblk condition.
+            volatile int32_t            mServerSeq;
+            volatile int32_t            mWaiters;
+            // time of the last wake up, and delay until obtainBuffer() resumed
+            nsecs_t                     mWakeTime;
+            LatencyHistogram            mWakeLatency;
+            uint32_t                    mNumWaits;
+            uint32_t                    mNumWaitTimeouts;
+            // frames copied by write() to the track buffer or to the queue
+            uint64_t                    mCopiedFrames;
         };  // end of OutputTrack
 
+        // Bounded lock-free queue used to hand active track list changes over
+        // from binder threads (producers) to the mixer thread (single consumer).
+        class TrackCommandQueue {
+        public:
+            enum command {
+                ADD,
+                REMOVE
+            };
+
+                                TrackCommandQueue();
+
+                    // returns false if the queue is full
+                    bool        push(int command, const sp<Track>& track);
+                    // must only be called by the consumer thread
+                    bool        pop(int *command, sp<Track> *track);
+                    bool        isEmpty() const;
+
+        private:
+            // must be a power of 2
+            static const int32_t kSize = 64;
+
+            struct Slot {
+                volatile int32_t    mSeq;
+                int                 mCommand;
+                sp<Track>           mTrack;
+            };
+
+            Slot                mSlots[kSize];
+            volatile int32_t    mHead;  // next slot claimed by a producer
+            int32_t             mTail;  // next slot read by the consumer
+        };  // end of TrackCommandQueue
+
         PlaybackThread (const sp<AudioFlinger>& audioFlinger, AudioStreamOutWrapper* output, int id);
         virtual             ~PlaybackThread();
 
@@ -531,6 +811,7 @@ private:
                                     int format,
                                     int channelCount,
                                     int frameCount,
+                                    uint32_t flags,
                                     const sp<IMemory>& sharedBuffer,
                                     status_t *status);
 
@@ -555,15 +836,73 @@ private:
         };
 
     protected:
+        // fast tracks accepted by one mixer thread, others play as normal tracks
+        static const int                kMaxFastTracks = 4;
+
         int                             mType;
         int16_t*                        mMixBuffer;
         int                             mSuspended;
         int                             mBytesWritten;
         bool                            mMasterMute;
         SortedVector< wp<Track> >       mActiveTracks;
+        // mActiveTracks is owned by binder threads and protected by mLock. When
+        // mUseTrackCommands is set, changes are also posted to mTrackCommands
+        // and the mixer thread applies them to its own copy, mMixerTracks.
+        bool                            mUseTrackCommands;
+        TrackCommandQueue               mTrackCommands;
+        SortedVector< wp<Track> >       mMixerTracks;
+        Condition                       mFlushCond;
+        volatile int32_t                mTrackResync;
+        int                             mNumTrackCommands;
+        int                             mNumDeferredRemovals;
+        int                             mNumTrackResyncs;
+
+        // per period profiling, updated by the playback thread only. A reset
+        // requested from dump() is applied by the thread at the next period.
+        LatencyHistogram                mConfigLatency;
+        LatencyHistogram                mPrepareLatency;
+        LatencyHistogram                mMixLatency;
+        LatencyHistogram                mWriteLatency;
+        // time from the first frame written by a fast track client after a
+        // start or an underrun to that frame leaving the DAC, estimated from
+        // the time the HAL write returns and the HAL latency
+        LatencyHistogram                mFastLatencyEstimate;
+        volatile int32_t                mResetLatency;
+
+        // control block and buffer of a recently destroyed track, given to the
+        // next track of the same client with the same frame count, format and
+        // channel count instead of a new allocation
+        struct track_slot_t {
+            AudioClientHeap*            heap;
+            sp<IMemory>                 memory;
+            int                         frameCount;
+            int                         format;
+            int                         channelCount;
+            nsecs_t                     time;
+        };
+        static const size_t             kMaxTrackSlots = 8;
+
+        // protected by mLock
+        Vector<track_slot_t>            mTrackSlots;
+        uint32_t                        mNumSlotHits;
+        uint32_t                        mNumSlotMisses;
+        uint32_t                        mNumSlotEvictions;
+        LatencyHistogram                mCreateLatency;
+
+                    void        checkLatencyReset();
+
+                    void        cacheTrackSlot_l(const Track* track);
+                    sp<IMemory> takeTrackSlot_l(const sp<Client>& client, int frameCount,
+                                        int format, int channelCount);
+                    void        expireTrackSlots_l(nsecs_t now);
+
+                    void        postTrackCommand(int command, const sp<Track>& track);
 
         virtual int             getTrackName_l() = 0;
         virtual void            deleteTrackName_l(int name) = 0;
+        // allocates what the thread needs to mix the track before it is added
+        // to mTracks
+        virtual void            allocateTrackBuffers_l(Track* track) {}
         virtual uint32_t        activeSleepTimeUs() = 0;
         virtual uint32_t        idleSleepTimeUs() = 0;
 
@@ -615,14 +954,104 @@ private:
         virtual     bool        checkForNewParameters_l();
         virtual     status_t    dumpInternals(int fd, const Vector<String16>& args);
 
+        virtual     uint32_t    latency() const;
+
+                    void        setDeepBuffer(uint32_t ms);
+
     protected:
-                    uint32_t    prepareTracks_l(const SortedVector< wp<Track> >& activeTracks, Vector< sp<Track> > *tracksToRemove);
+                    void        processTrackCommands();
+                    uint32_t    prepareTracks(const SortedVector< wp<Track> >& activeTracks, Vector< sp<Track> > *tracksToRemove);
+                    bool        queuePoolJob(Track* track, int16_t left, int16_t right, int param);
+                    bool        queueDirectJob(Track* track, AudioBufferProvider* provider,
+                                        int channelCount, int16_t left, int16_t right, int param);
+                    void        setJobVolume(Track* track, AudioMixerPool::Job* job,
+                                        int16_t left, int16_t right, int param);
+                    void        mixDirect();
+                    void        allocateMixBuffers();
+                    void        updateMixerPool();
+                    bool        resampleTrack(Track* track, bool restarted);
+                    void        updateResamplerLoad();
+                    ssize_t     writeFastSubPeriods(int16_t* buffer);
+                    void        mixFastTracks(int32_t* sums, size_t frameCount, nsecs_t now);
+                    size_t      skipTrack(Track* track);
+                    void        mixPeriod(int16_t* out, size_t size);
+                    int         deepBufferPeriods() const;
+                    void        allocateDeepBuffer();
+                    bool        deepBatchReady(const SortedVector< wp<Track> >& activeTracks, int periods);
         virtual     int         getTrackName_l();
         virtual     void        deleteTrackName_l(int name);
+        virtual     void        allocateTrackBuffers_l(Track* track);
         virtual     uint32_t    activeSleepTimeUs();
         virtual     uint32_t    idleSleepTimeUs();
 
         AudioMixer*                     mAudioMixer;
+        // AudioMixer track names in use, one bit per name. Only the mixer
+        // thread calls AudioMixer: getTrackName_l() takes a free bit here and
+        // deleteTrackName_l() sets the name in mDeletedNames, the mixer thread
+        // then resets the AudioMixer track and frees the name.
+        volatile int32_t                mTrackNames;
+        volatile int32_t                mDeletedNames;
+        StandbyPolicy                   mStandbyPolicy;
+        // optional worker threads mixing resampled tracks when more than
+        // mPoolThreshold tracks are active, 0 disables the pool. Only used in
+        // the periods mixed by mixDirect(), whose sums are not clamped yet.
+        AudioMixerPool*                 mMixerPool;
+        int                             mPoolThreshold;
+        // resampler tier of the tracks not asking for one, and highest tier
+        // used, lowered while resampling takes too much of the period
+        int                             mResamplerTier;
+        int                             mMaxResamplerTier;
+        int32_t*                        mResampleBuffer;
+        // thread CPU time spent resampling during the current period, and the
+        // number of consecutive periods above or below the load limits
+        nsecs_t                         mResampleLoad;
+        int                             mResampleLoadPeriods;
+        nsecs_t                         mResampleCpu[AudioResamplerPolyphase::NUM_TIERS];
+        uint64_t                        mResampleFrames[AudioResamplerPolyphase::NUM_TIERS];
+        uint32_t                        mNumTierChanges;
+        // fast tracks ready during the current period, only in the periods
+        // mixed by mixDirect(), and tracks mixed by AudioMixer or the pool
+        Vector< sp<Track> >             mFastTracks;
+        bool                            mMixerTracksReady;
+        // fast tracks are mixed and written mFastSubPeriods times per period
+        int                             mFastSubPeriods;
+        int16_t*                        mFastUpmixBuffer;
+        // tap times of the fast tracks starting in the sub-period being mixed
+        nsecs_t                         mFastTaps[kMaxFastTracks];
+        int                             mNumFastTaps;
+        uint32_t                        mNumFastTracks;
+        uint32_t                        mNumFastUnderruns;
+        // tracks consumed at zero volume instead of being mixed, their
+        // frames, and periods not mixed at all because of them
+        uint32_t                        mNumSkippedTracks;
+        uint64_t                        mNumSkippedFrames;
+        uint32_t                        mNumSkippedMixes;
+        // deep buffer mode: duration mixed and written at once while only
+        // latency tolerant tracks play, 0 when off
+        uint32_t                        mDeepBufferMs;
+        int16_t*                        mDeepBuffer;
+        size_t                          mDeepBufferFrames;
+        uint32_t                        mNumDeepBatches;
+        uint32_t                        mNumDeepPeriods;
+        // tracks mixed by AudioMixer and by the pool during the current
+        // period, their CPU time is accounted for by mixPeriod()
+        Vector< sp<Track> >             mMixedTracks;
+        Vector< sp<Track> >             mPoolTracks;
+        // when all the tracks of a period are 16 bit PCM that can be brought
+        // to the output rate by resampleTrack() or the pool, the mixer thread
+        // mixes them itself with the AudioMixerSimd kernels instead of
+        // AudioMixer. mDirectJobs[i] is then the job of mMixedTracks[i].
+        // ro.audio.direct_mix set to 0 has AudioMixer mix every period.
+        // mDither is the dither state of these periods, AudioMixer keeps its
+        // own.
+        bool                            mDirectMix;
+        bool                            mDirectPeriod;
+        AudioMixerPool::Job             mDirectJobs[AudioMixer::MAX_NUM_TRACKS];
+        size_t                          mNumDirectJobs;
+        int32_t*                        mMixSums;
+        int32_t*                        mMixTemp;
+        uint32_t                        mNumDirectPeriods;
+        dither_t                        mDither;
     };
 
     class DirectOutputThread : public PlaybackThread {
@@ -657,6 +1086,7 @@ private:
                     void        addOutputTrack(MixerThread* thread);
                     void        removeOutputTrack(MixerThread* thread);
                     uint32_t    waitTimeMs() { return mWaitTimeMs; }
+        virtual     status_t    dumpInternals(int fd, const Vector<String16>& args);
     protected:
         virtual     uint32_t    activeSleepTimeUs();
 
@@ -666,6 +1096,10 @@ private:
 
         SortedVector < sp<OutputTrack> >  mOutputTracks;
                     uint32_t    mWaitTimeMs;
+                    // mix directly into the first output track buffer when possible
+                    bool        mZeroCopy;
+                    int         mNumDirectWrites;
+                    int         mNumCopiedWrites;
     };
 
               PlaybackThread *checkPlaybackThread_l(int output) const;
@@ -701,10 +1135,65 @@ private:
 
 
     // record thread
-    class RecordThread : public ThreadBase, public AudioBufferProvider
+    class RecordThread : public ThreadBase
     {
     public:
 
+        class RecordTrack;
+
+        // Converts the periods read from the input to the sample rate and channel
+        // count of one record track. Each active track has its own converter so
+        // that clients with different configurations can share one input.
+        class RecordConverter : public AudioBufferProvider {
+        public:
+                                RecordConverter(uint32_t inSampleRate,
+                                        int inChannelCount,
+                                        int inFormat,
+                                        size_t inFrameSize,
+                                        size_t inFrameCount,
+                                        uint32_t outSampleRate,
+                                        int outChannelCount,
+                                        int outFormat,
+                                        int resamplerTier);
+                                ~RecordConverter();
+
+                    status_t    initCheck() const { return mStatus; }
+                    bool        isResampling() const { return mResampler != 0; }
+
+                    // writes frameCount input frames to the track buffer, returns the number
+                    // of track frames that did not fit
+                    size_t      convert(RecordTrack* track, const void* in, size_t frameCount);
+
+            // AudioBufferProvider interface used by the resampler
+            virtual status_t    getNextBuffer(AudioBufferProvider::Buffer* buffer);
+            virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
+
+        private:
+                                RecordConverter(const RecordConverter&);
+                                RecordConverter& operator = (const RecordConverter&);
+
+                    size_t      copy(RecordTrack* track, const int8_t* in, size_t frameCount);
+                    size_t      resample(RecordTrack* track, const int16_t* in, size_t frameCount);
+
+            status_t                    mStatus;
+            uint32_t                    mInSampleRate;
+            int                         mInChannelCount;
+            size_t                      mInFrameSize;
+            uint32_t                    mOutSampleRate;
+            int                         mOutChannelCount;
+            AudioMixerSimd::convert16_t mConvert;
+            AudioResampler*             mResampler;
+            // ring of the input frames not consumed yet by the resampler. Read and
+            // write positions are frame counts, the mRsmpInHeld frames after the
+            // read position are held by the resampler and must not be overwritten.
+            int16_t*                    mRsmpInBuffer;
+            size_t                      mRsmpInFrames;
+            size_t                      mRsmpInRead;
+            size_t                      mRsmpInWrite;
+            size_t                      mRsmpInHeld;
+            int32_t*                    mRsmpOutBuffer;
+        };
+
         // record track
         class RecordTrack : public TrackBase {
         public:
@@ -727,6 +1216,7 @@ private:
         private:
             friend class AudioFlinger;
             friend class RecordThread;
+            friend class RecordConverter;
 
                                 RecordTrack(const RecordTrack&);
                                 RecordTrack& operator = (const RecordTrack&);
@@ -734,6 +1224,13 @@ private:
             virtual status_t getNextBuffer(AudioBufferProvider::Buffer* buffer);
 
             bool                mOverflow;
+            // created by the record thread when the track becomes active
+            RecordConverter*    mConverter;
+            // periods that did not fit in the track buffer and frames dropped
+            uint32_t            mOverflows;
+            uint32_t            mFramesLost;
+            // time of the first period lost in the current overflow, 0 if none
+            nsecs_t             mOverflowStart;
         };
 
 
@@ -753,8 +1250,6 @@ private:
                 status_t    dump(int fd, const Vector<String16>& args);
                 AudioStreamInWrapper* getInput() { return mInput; }
 
-        virtual status_t    getNextBuffer(AudioBufferProvider::Buffer* buffer);
-        virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
         virtual bool        checkForNewParameters_l();
         virtual String8     getParameters(const String8& keys);
         virtual void        audioConfigChanged(int event, int param = 0);
@@ -763,18 +1258,21 @@ private:
 
     private:
                 RecordThread();
+                bool        updateActiveTracks_l(ssize_t bytesRead);
+
                 AudioStreamInWrapper                *mInput;
-                sp<RecordTrack>                     mActiveTrack;
+                // every started track gets each period read from the input
+                SortedVector< sp<RecordTrack> >     mActiveTracks;
                 Condition                           mStartStopCond;
-                AudioResampler                      *mResampler;
-                int32_t                             *mRsmpOutBuffer;
                 int16_t                             *mRsmpInBuffer;
-                size_t                              mRsmpInIndex;
                 size_t                              mInputBytes;
                 int                                 mReqChannelCount;
                 uint32_t                            mReqSampleRate;
-                ssize_t                             mBytesRead;
-                dither_t                            dither;
+                // resampler tier of the tracks not asking for one
+                int                                 mResamplerTier;
+                // time from the first period lost by a client to the next
+                // period it received
+                LatencyHistogram                    mOverflowRecovery;
     };
 
     class RecordHandle : public android::BnAudioRecord {
@@ -812,6 +1310,8 @@ private:
 
                 SortedVector< sp<IBinder> >         mNotificationClients;
                 int                                 mNextThreadId;
+                // created by createStandalone()
+                bool                                mStandalone;
 #ifdef HAVE_FM_RADIO
                 bool                                mFmOn;
 #endif
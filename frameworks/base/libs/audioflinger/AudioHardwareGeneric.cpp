@@ -20,14 +20,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sched.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 
 #define LOG_TAG "AudioHardware"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <cutils/properties.h>
 
 #include "AudioHardwareGeneric.h"
 #include <media/AudioRecord.h>
@@ -38,12 +42,87 @@ namespace android {
 
 static char const * const kAudioDeviceName = "/dev/eac";
 
+// poll() timeout of the non blocking mode: two periods of the stream, so that a
+// device late by less than a period loses nothing
+static int pollTimeoutMs(size_t period, size_t frameSize, uint32_t sampleRate)
+{
+    size_t bytesPerSecond = frameSize * sampleRate;
+    return (int)((2 * 1000 * period + bytesPerSecond - 1) / bytesPerSecond);
+}
+
+// pollTransfer() reads or writes bytes one period at a time and waits for the
+// device with poll(). If the device is not ready within timeoutMs, the transfer
+// stops so that a stalled device does not block the audio threads: the bytes
+// transferred are returned, or TIMED_OUT if there were none.
+static ssize_t pollTransfer(int fd, bool output, uint8_t* data, size_t bytes,
+        size_t period, int timeoutMs, generic_io_stats_t* stats)
+{
+    size_t done = 0;
+
+    while (done < bytes) {
+        size_t count = bytes - done;
+        if (count > period) {
+            count = period;
+        }
+        ssize_t n = output ? ::write(fd, data + done, count) : ::read(fd, data + done, count);
+        if (n > 0) {
+            done += n;
+            stats->transfers++;
+            continue;
+        }
+        if (n == 0) {
+            // end of a file or pipe backed device
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            status_t status = -errno;
+            return done ? (ssize_t)done : (ssize_t)status;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = output ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+        stats->polls++;
+        int ret = poll(&pfd, 1, timeoutMs);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0 || (pfd.revents & (POLLERR | POLLNVAL))) {
+            stats->timeouts++;
+            stats->lostBytes += bytes - done;
+            return done ? (ssize_t)done : (ssize_t)TIMED_OUT;
+        }
+    }
+    return done;
+}
+
+static void dumpStats(String8& result, const generic_io_stats_t& stats)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    snprintf(buffer, SIZE, "\ttransfers: %u polls: %u timeouts: %u lost bytes: %u\n",
+            stats.transfers, stats.polls, stats.timeouts, stats.lostBytes);
+    result.append(buffer);
+}
+
 // ----------------------------------------------------------------------------
 
-AudioHardwareGeneric::AudioHardwareGeneric()
-    : mOutput(0), mInput(0),  mFd(-1), mMicMute(false)
+AudioHardwareGeneric::AudioHardwareGeneric(const char* device, const char* io)
+    : mOutput(0), mInput(0),  mFd(-1), mMicMute(false), mPollIo(false),
+      mDeviceName(device != NULL ? device : kAudioDeviceName)
 {
-    mFd = ::open(kAudioDeviceName, O_RDWR);
+    // "blocking" or "poll"
+    char value[PROPERTY_VALUE_MAX];
+    if (io == NULL) {
+        property_get("ro.audio.generic_io", value, "blocking");
+        io = value;
+    }
+    mPollIo = strcmp(io, "poll") == 0;
+    mFd = ::open(mDeviceName.string(), mPollIo ? O_RDWR | O_NONBLOCK : O_RDWR);
 }
 
 AudioHardwareGeneric::~AudioHardwareGeneric()
@@ -56,7 +135,7 @@ AudioHardwareGeneric::~AudioHardwareGeneric()
 status_t AudioHardwareGeneric::initCheck()
 {
     if (mFd >= 0) {
-        if (::access(kAudioDeviceName, O_RDWR) == NO_ERROR)
+        if (::access(mDeviceName.string(), O_RDWR) == NO_ERROR)
             return NO_ERROR;
     }
     return NO_INIT;
@@ -162,7 +241,10 @@ status_t AudioHardwareGeneric::dumpInternals(int fd, const Vector<String16>& arg
     char buffer[SIZE];
     String8 result;
     result.append("AudioHardwareGeneric::dumpInternals\n");
-    snprintf(buffer, SIZE, "\tmFd: %d mMicMute: %s\n",  mFd, mMicMute? "true": "false");
+    snprintf(buffer, SIZE, "\tdevice: %s mFd: %d mMicMute: %s\n", mDeviceName.string(), mFd,
+            mMicMute? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tI/O mode: %s\n", mPollIo ? "poll" : "blocking");
     result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
@@ -214,6 +296,11 @@ AudioStreamOutGeneric::~AudioStreamOutGeneric()
 ssize_t AudioStreamOutGeneric::write(const void* buffer, size_t bytes)
 {
     Mutex::Autolock _l(mLock);
+    if (mAudioHardware->pollIo()) {
+        return pollTransfer(mFd, true, (uint8_t *)buffer, bytes, bufferSize(),
+                pollTimeoutMs(bufferSize(), channelCount() * sizeof(int16_t), sampleRate()),
+                &mStats);
+    }
     return ssize_t(::write(mFd, buffer, bytes));
 }
 
@@ -242,6 +329,7 @@ status_t AudioStreamOutGeneric::dump(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
     result.append(buffer);
+    dumpStats(result, mStats);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -262,8 +350,7 @@ status_t AudioStreamInGeneric::set(
         uint32_t rate,
         AudioSystem::audio_in_acoustics acoustics)
 {
-    // FIXME: remove logging
-    LOGD("AudioStreamInGeneric::set(%p, %d, %d, %d, %u)", hw, fd, format, channels, rate);
+    LOGV("AudioStreamInGeneric::set(%p, %d, %d, %d, %u)", hw, fd, format, channels, rate);
     // check values
     if ((format != AudioSystem::PCM_16_BIT) ||
             (channels != channelCount()) ||
@@ -279,21 +366,26 @@ status_t AudioStreamInGeneric::set(
 
 AudioStreamInGeneric::~AudioStreamInGeneric()
 {
-    // FIXME: remove logging
-    LOGD("AudioStreamInGeneric destructor");
+    LOGV("AudioStreamInGeneric destructor");
     if (mAudioHardware)
         mAudioHardware->closeInputStream(this);
 }
 
 ssize_t AudioStreamInGeneric::read(void* buffer, ssize_t bytes)
 {
-    // FIXME: remove logging
-    LOGD("AudioStreamInGeneric::read(%p, %d) from fd %d", buffer, bytes, mFd);
     AutoMutex lock(mLock);
     if (mFd < 0) {
         LOGE("Attempt to read from unopened device");
         return NO_INIT;
     }
+    if (bytes <= 0) {
+        return 0;
+    }
+    if (mAudioHardware->pollIo()) {
+        return pollTransfer(mFd, false, (uint8_t *)buffer, bytes, bufferSize(),
+                pollTimeoutMs(bufferSize(), channelCount() * sizeof(int16_t), sampleRate()),
+                &mStats);
+    }
     return ::read(mFd, buffer, bytes);
 }
 
@@ -316,6 +408,7 @@ status_t AudioStreamInGeneric::dump(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
     result.append(buffer);
+    dumpStats(result, mStats);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
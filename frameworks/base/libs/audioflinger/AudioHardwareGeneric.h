@@ -22,6 +22,7 @@
 #include <sys/types.h>
 
 #include <utils/threads.h>
+#include <utils/String8.h>
 
 #include <hardware_legacy/AudioHardwareBase.h>
 
@@ -31,6 +32,16 @@ namespace android {
 
 class AudioHardwareGeneric;
 
+// counters of the poll driven I/O mode
+struct generic_io_stats_t {
+                        generic_io_stats_t()
+                            : transfers(0), polls(0), timeouts(0), lostBytes(0) {}
+    uint32_t            transfers;
+    uint32_t            polls;
+    uint32_t            timeouts;
+    uint32_t            lostBytes;
+};
+
 class AudioStreamOutGeneric : public AudioStreamOut {
 public:
                         AudioStreamOutGeneric() : mAudioHardware(0), mFd(-1) {}
@@ -58,6 +69,7 @@ private:
     AudioHardwareGeneric *mAudioHardware;
     Mutex   mLock;
     int     mFd;
+    generic_io_stats_t mStats;
 };
 
 class AudioStreamInGeneric : public AudioStreamIn {
@@ -86,13 +98,17 @@ private:
     AudioHardwareGeneric *mAudioHardware;
     Mutex   mLock;
     int     mFd;
+    generic_io_stats_t mStats;
 };
 
 
 class AudioHardwareGeneric : public AudioHardwareBase
 {
 public:
-                        AudioHardwareGeneric();
+                        // device replaces /dev/eac, io "blocking" or "poll" replaces
+                        // the ro.audio.generic_io property
+                        AudioHardwareGeneric(const char* device = NULL,
+                                const char* io = NULL);
     virtual             ~AudioHardwareGeneric();
     virtual status_t    initCheck();
     virtual status_t    setVoiceVolume(float volume);
@@ -133,6 +149,10 @@ public:
 
             void            closeOutputStream(AudioStreamOutGeneric* out);
             void            closeInputStream(AudioStreamInGeneric* in);
+
+            // true if the device is non blocking and the streams wait for it with
+            // poll(), transferring one period at a time
+            bool            pollIo() const { return mPollIo; }
 protected:
     /** added for IS01 */
     virtual status_t        forcedRouting(int, unsigned int, unsigned int) { return NO_ERROR; }
@@ -150,6 +170,8 @@ private:
     AudioStreamInGeneric    *mInput;
     int                     mFd;
     bool                    mMicMute;
+    bool                    mPollIo;
+    String8                 mDeviceName;
 };
 
 // ----------------------------------------------------------------------------
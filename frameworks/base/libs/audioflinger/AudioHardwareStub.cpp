@@ -15,11 +15,19 @@
 ** limitations under the License.
 */
 
+#define LOG_TAG "AudioHardwareStub"
+//#define LOG_NDEBUG 0
+
 #include <stdint.h>
 #include <sys/types.h>
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <cutils/properties.h>
+#include <utils/Log.h>
 #include <utils/String8.h>
 
 #include "AudioHardwareStub.h"
@@ -29,7 +37,9 @@ namespace android {
 
 // ----------------------------------------------------------------------------
 
-AudioHardwareStub::AudioHardwareStub() : mMicMute(false)
+AudioHardwareStub::AudioHardwareStub(const char* sink)
+    :   mMicMute(false), mSink(sink != NULL ? sink : ""), mSinkSet(sink != NULL),
+        mNumOutputs(0)
 {
 }
 
@@ -45,7 +55,23 @@ status_t AudioHardwareStub::initCheck()
 AudioStreamOut* AudioHardwareStub::openOutputStream(
         int format, int channelCount, uint32_t sampleRate, status_t *status)
 {
-    AudioStreamOutStub* out = new AudioStreamOutStub();
+    // audio.stub.sink selects where the output goes: empty for a timed sink,
+    // "null" to discard the data or a file path, both without blocking. A %d
+    // in the path is replaced by the number of outputs opened before.
+    char sink[PROPERTY_VALUE_MAX];
+    if (mSinkSet) {
+        snprintf(sink, sizeof(sink), "%s", mSink.string());
+    } else {
+        property_get("audio.stub.sink", sink, "");
+    }
+    char* number = strstr(sink, "%d");
+    if (number != NULL) {
+        char suffix[PROPERTY_VALUE_MAX];
+        snprintf(suffix, sizeof(suffix), "%s", number + 2);
+        snprintf(number, sizeof(sink) - (number - sink), "%d%s", mNumOutputs, suffix);
+    }
+    mNumOutputs++;
+    AudioStreamOutStub* out = new AudioStreamOutStub(sink);
     status_t lStatus = out->set(format, channelCount, sampleRate);
     if (status) {
         *status = lStatus;
@@ -107,6 +133,33 @@ status_t AudioHardwareStub::dump(int fd, const Vector<String16>& args)
 
 // ----------------------------------------------------------------------------
 
+AudioStreamOutStub::AudioStreamOutStub(const char* sink)
+    :   mSink(SINK_TIMED), mFd(-1), mWrites(0), mShortWrites(0), mFramesWritten(0),
+        mCpuTime(0), mWallTime(0), mLastWrite(0)
+{
+    if (sink == NULL || sink[0] == 0) {
+        return;
+    }
+    if (strcmp(sink, "null") == 0) {
+        mSink = SINK_NULL;
+        return;
+    }
+    mFd = ::open(sink, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+    if (mFd < 0) {
+        LOGE("could not open stub sink %s: %s, discarding output", sink, strerror(errno));
+        mSink = SINK_NULL;
+    } else {
+        mSink = SINK_FILE;
+    }
+}
+
+AudioStreamOutStub::~AudioStreamOutStub()
+{
+    if (mFd >= 0) {
+        ::close(mFd);
+    }
+}
+
 status_t AudioStreamOutStub::set(int format, int channels, uint32_t rate)
 {
     // fix up defaults
@@ -123,13 +176,39 @@ status_t AudioStreamOutStub::set(int format, int channels, uint32_t rate)
 
 ssize_t AudioStreamOutStub::write(const void* buffer, size_t bytes)
 {
-    // fake timing for audio output
-    usleep(bytes * 1000000 / sizeof(int16_t) / channelCount() / sampleRate());
+    // the calling thread CPU time between two writes is the cost of producing
+    // one buffer, which gives the frames mixed per CPU second
+    nsecs_t now = systemTime();
+    nsecs_t cpuTime = systemTime(SYSTEM_TIME_THREAD);
+    if (mLastWrite != 0) {
+        mWallTime += now - mLastWrite;
+    }
+    mLastWrite = now;
+
+    switch (mSink) {
+    case SINK_TIMED:
+        // fake timing for audio output
+        usleep(bytes * 1000000 / sizeof(int16_t) / channelCount() / sampleRate());
+        break;
+    case SINK_FILE:
+        if (::write(mFd, buffer, bytes) != (ssize_t)bytes) {
+            mShortWrites++;
+        }
+        break;
+    case SINK_NULL:
+    default:
+        break;
+    }
+
+    mWrites++;
+    mFramesWritten += bytes / (sizeof(int16_t) * channelCount());
+    mCpuTime = cpuTime;
     return bytes;
 }
 
 status_t AudioStreamOutStub::standby()
 {
+    mLastWrite = 0;
     return NO_ERROR;
 }
 
@@ -138,12 +217,32 @@ status_t AudioStreamOutStub::dump(int fd, const Vector<String16>& args)
     const size_t SIZE = 256;
     char buffer[SIZE];
     String8 result;
+    static const char* sinkNames[] = { "timed", "null", "file" };
     snprintf(buffer, SIZE, "AudioStreamOutStub::dump\n");
+    result.append(buffer);
     snprintf(buffer, SIZE, "\tsample rate: %d\n", sampleRate());
+    result.append(buffer);
     snprintf(buffer, SIZE, "\tbuffer size: %d\n", bufferSize());
+    result.append(buffer);
     snprintf(buffer, SIZE, "\tchannel count: %d\n", channelCount());
+    result.append(buffer);
     snprintf(buffer, SIZE, "\tformat: %d\n", format());
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tsink: %s\n", sinkNames[mSink]);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\twrites: %u (%u short), frames: %llu\n",
+            mWrites, mShortWrites, mFramesWritten);
+    result.append(buffer);
+    if (mCpuTime > 0) {
+        snprintf(buffer, SIZE, "\twriter thread: %llu frames per CPU second\n",
+                mFramesWritten * 1000000000ULL / mCpuTime);
+        result.append(buffer);
+    }
+    if (mWallTime > 0) {
+        snprintf(buffer, SIZE, "\twall clock: %llu frames per second\n",
+                mFramesWritten * 1000000000ULL / mWallTime);
+        result.append(buffer);
+    }
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -21,6 +21,9 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
 #include <hardware_legacy/AudioHardwareBase.h>
 
 namespace android {
@@ -29,6 +32,17 @@ namespace android {
 
 class AudioStreamOutStub : public AudioStreamOut {
 public:
+    // SINK_TIMED sleeps for the duration of each buffer like a real device,
+    // SINK_NULL and SINK_FILE never block so that AudioFlinger threads run at
+    // full speed, e.g. to measure mixer throughput on a host without audio
+    enum sink_type {
+        SINK_TIMED,
+        SINK_NULL,
+        SINK_FILE
+    };
+
+                        AudioStreamOutStub(const char* sink = 0);
+    virtual             ~AudioStreamOutStub();
     virtual status_t    set(int format, int channelCount, uint32_t sampleRate);
     virtual uint32_t    sampleRate() const { return 44100; }
     virtual size_t      bufferSize() const { return 4096; }
@@ -40,6 +54,17 @@ public:
     virtual status_t    standby();
     virtual status_t    dump(int fd, const Vector<String16>& args);
     virtual status_t    Open();
+
+private:
+    int                 mSink;
+    int                 mFd;
+    // write statistics since the stream was opened, mWallTime excludes standby
+    uint32_t            mWrites;
+    uint32_t            mShortWrites;
+    uint64_t            mFramesWritten;
+    nsecs_t             mCpuTime;
+    nsecs_t             mWallTime;
+    nsecs_t             mLastWrite;
 };
 
 class AudioStreamInStub : public AudioStreamIn {
@@ -58,7 +83,8 @@ public:
 class AudioHardwareStub : public  AudioHardwareBase
 {
 public:
-                        AudioHardwareStub();
+                        // sink overrides the audio.stub.sink property when not NULL
+                        AudioHardwareStub(const char* sink = NULL);
     virtual             ~AudioHardwareStub();
     virtual status_t    initCheck();
     virtual status_t    setVoiceVolume(float volume);
@@ -108,6 +134,9 @@ protected:
 
             bool        mMicMute;
 private:
+            String8     mSink;
+            bool        mSinkSet;
+            int         mNumOutputs;
     status_t            dumpInternals(int fd, const Vector<String16>& args);
 };
 
@@ -162,6 +162,8 @@ AudioStreamOutWrapper::AudioStreamOutWrapper(AudioHardwareInterface *intf, Audio
 AudioStreamOutWrapper::~AudioStreamOutWrapper()
 {
 	LOGV("delete AudioStreamOutWrapper()");
+	if (mTap != 0)
+		mTap->close();
 	delete hw;
 }
 
@@ -219,6 +221,8 @@ ssize_t AudioStreamOutWrapper::write(const void* buffer, size_t bytes)
 {
 	ssize_t s = hw->write(buffer, bytes);
         LOGV("AudioStreamOutWrapper::write(%p, %d) = %d", buffer, bytes, (int)s);
+	if (mTap != 0 && s > 0)
+		mTap->write(buffer, s);
 	return s;
 }
 
@@ -233,6 +237,12 @@ status_t AudioStreamOutWrapper::dump(int fd, const Vector<String16>& args)
 {
 	status_t s = hw->dump(fd, args);
         LOGV("AudioStreamOutWrapper::dump(%d, args) = %d", fd, s);
+	Mutex::Autolock _l(mTapLock);
+	if (mTap != 0) {
+		String8 result;
+		mTap->dump(result);
+		::write(fd, result.string(), result.size());
+	}
 	return s;
 }
 
@@ -253,6 +263,15 @@ status_t AudioStreamOutWrapper::setParameters(const String8& keyValuePairs)
 		param.remove(key);
 	}
 
+	String8 value;
+	key = String8(AudioStreamTap::keyTap);
+	if (param.get(key, value) == NO_ERROR) {
+		Mutex::Autolock _l(mTapLock);
+		status = AudioStreamTap::setParameter(&mTap, value, "out", sampleRate(),
+				outputChannelsToChannelCount(channels()), format());
+		param.remove(key);
+	}
+
 	if (param.size()) {
 		status = BAD_VALUE;
 	}
@@ -294,6 +313,8 @@ AudioStreamInWrapper::AudioStreamInWrapper(AudioHardwareInterface *intf, AudioSt
 AudioStreamInWrapper::~AudioStreamInWrapper()
 {
 	LOGV("delete AudioStreamInWrapper()");
+	if (mTap != 0)
+		mTap->close();
 	delete hw;
 }
 
@@ -335,6 +356,8 @@ ssize_t AudioStreamInWrapper::read(void* buffer, ssize_t bytes)
 {
 	ssize_t s = hw->read(buffer, bytes);
         LOGV("AudioStreamInWrapper::read(%p, %d) = %d", buffer, (int)bytes, (int)s);
+	if (mTap != 0 && s > 0)
+		mTap->write(buffer, s);
 	return s;
 }
 
@@ -342,6 +365,12 @@ status_t AudioStreamInWrapper::dump(int fd, const Vector<String16>& args)
 {
 	status_t s = hw->dump(fd, args);
 	LOGV("AudioStreamInWrapper::dump(%d, args) = %d", fd, s);
+	Mutex::Autolock _l(mTapLock);
+	if (mTap != 0) {
+		String8 result;
+		mTap->dump(result);
+		::write(fd, result.string(), result.size());
+	}
 	return s;
 }
 
@@ -374,6 +403,15 @@ status_t AudioStreamInWrapper::setParameters(const String8& keyValuePairs)
 		param.remove(key);
 	}
 
+	String8 value;
+	key = String8(AudioStreamTap::keyTap);
+	if (param.get(key, value) == NO_ERROR) {
+		Mutex::Autolock _l(mTapLock);
+		status = AudioStreamTap::setParameter(&mTap, value, "in", sampleRate(),
+				inputChannelsToChannelCount(channels()), format());
+		param.remove(key);
+	}
+
 	if (param.size()) {
 		status = BAD_VALUE;
 	}
@@ -676,6 +714,12 @@ AudioHardwareWrapper* AudioHardwareWrapper::create()
 		LOGV("Using stubbed audio hardware. No sound will be produced.");
 		delete intf->mHardware;
 		intf->mHardware = new AudioHardwareStub();
+	} else if (property_get("ro.audio.stub_hal", value, "0") && !strcmp(value, "1")) {
+		// run AudioFlinger without a device, e.g. to profile the mixer with
+		// audio.stub.sink set to "null" or a file path
+		LOGW("ro.audio.stub_hal set, using stubbed audio hardware.");
+		delete intf->mHardware;
+		intf->mHardware = new AudioHardwareStub();
 	}
 
 #ifdef DUMP_FLINGER_OUT
@@ -684,13 +728,26 @@ AudioHardwareWrapper* AudioHardwareWrapper::create()
 	// will record buffers in a file (after sending them to hardware) for testing purpose.
 	// This feature is enabled by defining symbol DUMP_FLINGER_OUT.
 	// The output file is FLINGER_DUMP_NAME. Pause are not recorded in the file.
+	// The PCM of a stream can also be saved at runtime, without rebuilding,
+	// with the AudioStreamTap::keyTap parameter of the output or input.
 
 	// replace interface
 	intf->mHardware = new AudioDumpInterface(intf->mHardware);
+#else
+	// The PCM written to or read from a stream can be saved to a file at runtime
+	// with the AudioStreamTap::keyTap parameter of the output or input.
 #endif
 
 	return intf;
 }
 
+AudioHardwareWrapper* AudioHardwareWrapper::create(AudioHardwareInterface* hardware)
+{
+	LOGV("AudioHardwareWrapper::create(%p)", hardware);
+	AudioHardwareWrapper* intf = new AudioHardwareWrapper;
+	intf->mHardware = hardware;
+	return intf;
+}
+
 
 }; // namespace android
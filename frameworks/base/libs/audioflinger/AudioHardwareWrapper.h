@@ -30,6 +30,8 @@
 
 #include <hardware_legacy/AudioHardwareInterface.h>
 
+#include "AudioStreamTap.h"
+
 namespace android {
 
 // ----------------------------------------------------------------------------
@@ -111,6 +113,10 @@ private:
     AudioHardwareInterface *mHardware;
     AudioStreamOut *hw;
     uint32_t mDevices;
+    // copy of the written PCM, only changed by setParameters() which is called
+    // by the thread writing to the stream. mTapLock protects it against dump()
+    sp<AudioStreamTap> mTap;
+    mutable Mutex mTapLock;
 };
 
 /**
@@ -180,6 +186,9 @@ private:
     AudioStreamIn *hw;
     uint32_t mDevices;
     uint32_t mSampleRate;
+    // copy of the read PCM, see AudioStreamOutWrapper
+    sp<AudioStreamTap> mTap;
+    mutable Mutex mTapLock;
 };
 
 /**
@@ -260,6 +269,8 @@ public:
     status_t    setFmVolume(float volume) { return 0; }
 
     static AudioHardwareWrapper* create();
+    // wraps the given hardware, which is then owned by the wrapper
+    static AudioHardwareWrapper* create(AudioHardwareInterface* hardware);
 
     /** IS01 specific functions */
     status_t setStreamVolume(int stream, float volume);
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioMixerPool"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include <utils/Log.h>
+#include <utils/Atomic.h>
+
+#include "AudioMixer.h"
+#include "AudioMixerSimd.h"
+#include "AudioMixerPool.h"
+#include "AudioSync.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// number of polls of a shared counter before sleeping on it
+static const int kSpinCount = 1000;
+
+static const int16_t kUnityGain = 0x1000;
+
+// ----------------------------------------------------------------------------
+
+AudioMixerPool::AudioMixerPool(size_t frameCount, int numWorkers)
+    :   mStatus(NO_INIT), mFrameCount(frameCount), mNumWorkers(numWorkers),
+        mAccumulators(0), mTemp(0), mNumJobs(0),
+        mGeneration(0), mPending(0), mSleepers(0), mExit(0),
+        mNumPeriods(0), mNumSleeps(0)
+{
+    if (mNumWorkers > MAX_WORKERS) mNumWorkers = MAX_WORKERS;
+    if (mNumWorkers <= 0 || frameCount == 0) {
+        mNumWorkers = 0;
+        return;
+    }
+
+    mAccumulators = new int32_t[mNumWorkers * mFrameCount * 2];
+    mTemp = new int32_t[mNumWorkers * mFrameCount * 2];
+
+    for (int i = 0; i < mNumWorkers; i++) {
+        mWorkers[i] = new Worker(this, i);
+        status_t status = mWorkers[i]->run("AudioMixerWorker", ANDROID_PRIORITY_URGENT_AUDIO);
+        if (status != NO_ERROR) {
+            LOGE("could not start mixer worker %d: %d", i, status);
+            mWorkers[i].clear();
+            mNumWorkers = i;
+            break;
+        }
+    }
+    mStatus = (mNumWorkers != 0) ? NO_ERROR : NO_INIT;
+    LOGV("AudioMixerPool %p %d workers, %d frames", this, mNumWorkers, mFrameCount);
+}
+
+AudioMixerPool::~AudioMixerPool()
+{
+    android_atomic_or(1, &mExit);
+    android_atomic_inc(&mGeneration);
+    futexWake(&mGeneration, INT_MAX);
+    for (int i = 0; i < mNumWorkers; i++) {
+        mWorkers[i]->requestExitAndWait();
+        mWorkers[i].clear();
+    }
+    delete [] mAccumulators;
+    delete [] mTemp;
+}
+
+bool AudioMixerPool::addJob(const Job& job)
+{
+    if (mStatus != NO_ERROR || mNumJobs >= MAX_JOBS) {
+        return false;
+    }
+    mJobs[mNumJobs++] = job;
+    return true;
+}
+
+void AudioMixerPool::start()
+{
+    if (mNumJobs == 0) return;
+
+    mPending = mNumWorkers;
+    mNumPeriods++;
+    // the jobs are visible to the workers that see the new generation
+    audioMemoryBarrier();
+    android_atomic_inc(&mGeneration);
+    if (mSleepers != 0) {
+        futexWake(&mGeneration, INT_MAX);
+    }
+}
+
+void AudioMixerPool::finish(int32_t* sums)
+{
+    if (mNumJobs == 0) return;
+
+    int spins = kSpinCount;
+    int32_t pending;
+    while ((pending = audioAcquireLoad(&mPending)) != 0) {
+        if (spins > 0) {
+            spins--;
+            continue;
+        }
+        mNumSleeps++;
+        futexWait(&mPending, pending);
+    }
+
+    // only the workers that had jobs wrote their accumulator
+    size_t samples = mFrameCount * 2;
+    int workers = (mNumJobs < (size_t)mNumWorkers) ? mNumJobs : mNumWorkers;
+    for (int w = 0; w < workers; w++) {
+        const int32_t* acc = mAccumulators + w * samples;
+        for (size_t i = 0; i < samples; i++) {
+            sums[i] += acc[i];
+        }
+    }
+
+    mNumJobs = 0;
+}
+
+// runJobs() is called by worker index: it processes every mNumWorkers job
+// starting at index into the worker accumulator
+void AudioMixerPool::runJobs(int index)
+{
+    size_t samples = mFrameCount * 2;
+    int32_t* acc = mAccumulators + index * samples;
+    int32_t* temp = mTemp + index * samples;
+
+    memset(acc, 0, samples * sizeof(int32_t));
+    for (size_t j = index; j < mNumJobs; j += mNumWorkers) {
+        mixJob(mJobs[j], mFrameCount, acc, temp);
+    }
+}
+
+void AudioMixerPool::mixJob(Job& job, size_t frameCount, int32_t* acc, int32_t* temp)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    bool ramp = (job.volume[0] != job.prevVolume[0] || job.volume[1] != job.prevVolume[1]);
+    int32_t vl = job.prevVolume[0] << 16;
+    int32_t vr = job.prevVolume[1] << 16;
+    const int32_t vlInc = ((job.volume[0] - job.prevVolume[0]) << 16) / (int32_t)frameCount;
+    const int32_t vrInc = ((job.volume[1] - job.prevVolume[1]) << 16) / (int32_t)frameCount;
+    job.mixTime = 0;
+    job.rampTime = 0;
+
+    if (job.resampler == NULL) {
+        // same arithmetic as AudioMixer for a 16 bit track at the output rate
+        size_t mixed = 0;
+        while (mixed < frameCount) {
+            AudioBufferProvider::Buffer buffer;
+            buffer.frameCount = frameCount - mixed;
+            job.provider->getNextBuffer(&buffer);
+            if (buffer.raw == 0) {
+                break;
+            }
+            const int16_t* in = buffer.i16;
+            if (job.channelCount == 1) {
+                AudioMixerSimd::upmixMono16((int16_t *)temp, in, buffer.frameCount);
+                in = (const int16_t *)temp;
+            }
+            int32_t* out = acc + mixed * 2;
+            if (!ramp) {
+                AudioMixerSimd::volumeStereo16(out, in, buffer.frameCount,
+                        job.volume[0], job.volume[1]);
+            } else {
+                for (size_t i = 0; i < buffer.frameCount; i++) {
+                    out[0] += (vl >> 16) * (int32_t)in[0];
+                    out[1] += (vr >> 16) * (int32_t)in[1];
+                    vl += vlInc;
+                    vr += vrInc;
+                    in += 2;
+                    out += 2;
+                }
+            }
+            mixed += buffer.frameCount;
+            job.provider->releaseBuffer(&buffer);
+        }
+        if (ramp) {
+            job.rampTime = systemTime(SYSTEM_TIME_THREAD) - start;
+        } else {
+            job.mixTime = systemTime(SYSTEM_TIME_THREAD) - start;
+        }
+        return;
+    }
+
+    if (!ramp) {
+        job.resampler->setVolume(job.volume[0], job.volume[1]);
+        job.resampler->resample(acc, frameCount, job.provider);
+        job.mixTime = systemTime(SYSTEM_TIME_THREAD) - start;
+        return;
+    }
+
+    // resample at unity gain and ramp the volume over the period
+    memset(temp, 0, frameCount * 2 * sizeof(int32_t));
+    job.resampler->setVolume(kUnityGain, kUnityGain);
+    job.resampler->resample(temp, frameCount, job.provider);
+    nsecs_t resampled = systemTime(SYSTEM_TIME_THREAD);
+    job.mixTime = resampled - start;
+
+    for (size_t i = 0; i < frameCount; i++) {
+        acc[0] += (temp[0] >> 12) * (vl >> 16);
+        acc[1] += (temp[1] >> 12) * (vr >> 16);
+        vl += vlInc;
+        vr += vrInc;
+        acc += 2;
+        temp += 2;
+    }
+    job.rampTime = systemTime(SYSTEM_TIME_THREAD) - resampled;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioMixerPool::Worker::Worker(AudioMixerPool* pool, int index)
+    :   Thread(false), mPool(pool), mIndex(index), mGeneration(0)
+{
+}
+
+bool AudioMixerPool::Worker::threadLoop()
+{
+    // wait for the next period
+    int spins = kSpinCount;
+    while (audioAcquireLoad(&mPool->mGeneration) == mGeneration) {
+        if (spins > 0) {
+            spins--;
+            continue;
+        }
+        android_atomic_inc(&mPool->mSleepers);
+        futexWait(&mPool->mGeneration, mGeneration);
+        android_atomic_dec(&mPool->mSleepers);
+    }
+    mGeneration = mPool->mGeneration;
+
+    if (mPool->mExit) {
+        return false;
+    }
+
+    mPool->runJobs(mIndex);
+
+    // the accumulator is visible to finish() once it sees mPending drop
+    audioMemoryBarrier();
+    if (android_atomic_dec(&mPool->mPending) == 1) {
+        futexWake(&mPool->mPending, 1);
+    }
+    return true;
+}
+
+void AudioMixerPool::processOutput(AudioDSP& dsp, dither_t* dither, int16_t* out,
+        int32_t* sums, size_t frameCount)
+{
+    dsp.process(sums, frameCount);
+    AudioMixer::ditherAndClamp(dither, (int32_t *)out, sums, frameCount);
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_MIXER_POOL_H
+#define ANDROID_AUDIO_MIXER_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+#include "AudioBufferProvider.h"
+#include "AudioDSP.h"
+#include "AudioMixer.h"
+#include "AudioResampler.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Worker threads resampling and mixing a set of tracks in parallel with the
+ * mixer thread. Each period the mixer thread queues jobs, calls start(), mixes
+ * its other tracks into an int32 accumulator with mixJob() and then calls
+ * finish() which waits for the workers and adds their accumulators to it. The
+ * sum goes once through processOutput(), so the result does not depend on which
+ * thread mixed which track.
+ *
+ * Hand-off between the mixer thread and the workers spins for a short time and
+ * then sleeps on a futex, so that no Condition/Mutex is involved per period.
+ */
+class AudioMixerPool
+{
+public:
+    static const int MAX_WORKERS = 3;
+    static const int MAX_JOBS = 32;
+
+    struct Job {
+        AudioBufferProvider*    provider;
+        // NULL if the provider is at the output rate, channelCount is then
+        // the channel count of the provider
+        AudioResampler*         resampler;
+        int                     channelCount;
+        // volume at the end of the period, the volume is ramped from
+        // prevVolume when they differ
+        int16_t                 volume[2];
+        int16_t                 prevVolume[2];
+        // set by mixJob(): thread CPU time spent resampling and mixing at
+        // the final volume, and ramping the volume
+        nsecs_t                 mixTime;
+        nsecs_t                 rampTime;
+    };
+
+                        AudioMixerPool(size_t frameCount, int numWorkers);
+                        ~AudioMixerPool();
+
+            status_t    initCheck() const { return mStatus; }
+            size_t      frameCount() const { return mFrameCount; }
+            int         numWorkers() const { return mNumWorkers; }
+
+            // jobs can only be added between finish() and the next start()
+            bool        addJob(const Job& job);
+            size_t      numJobs() const { return mNumJobs; }
+            // jobs of the last period, valid from finish() to the next addJob()
+            const Job&  job(size_t index) const { return mJobs[index]; }
+
+            void        start();
+            // adds the jobs output to the stereo accumulator sums, in 4.12
+            void        finish(int32_t* sums);
+
+            uint32_t    numPeriods() const { return mNumPeriods; }
+            uint32_t    numSleeps() const { return mNumSleeps; }
+
+    // Mixes frameCount frames of job into the stereo accumulator acc, temp is
+    // a scratch buffer of frameCount stereo samples. Also used by the mixer
+    // thread for the tracks it mixes itself.
+    static  void        mixJob(Job& job, size_t frameCount, int32_t* acc, int32_t* temp);
+
+    // Output stage of AudioMixer::process() applied to frameCount frames of a
+    // stereo accumulator in 4.12: the AudioDSP chain, then ditherAndClamp()
+    // with the dither state of the output. The accumulator is overwritten.
+    static  void        processOutput(AudioDSP& dsp, dither_t* dither, int16_t* out,
+                                int32_t* sums, size_t frameCount);
+
+private:
+                        AudioMixerPool(const AudioMixerPool&);
+                        AudioMixerPool& operator = (const AudioMixerPool&);
+
+    class Worker : public Thread {
+    public:
+                        Worker(AudioMixerPool* pool, int index);
+        virtual bool    threadLoop();
+    private:
+        AudioMixerPool* mPool;
+        int             mIndex;
+        int32_t         mGeneration;
+    };
+
+            void        runJobs(int index);
+
+    status_t            mStatus;
+    size_t              mFrameCount;
+    int                 mNumWorkers;
+    sp<Worker>          mWorkers[MAX_WORKERS];
+    // one stereo accumulator and one scratch buffer per worker
+    int32_t*            mAccumulators;
+    int32_t*            mTemp;
+
+    Job                 mJobs[MAX_JOBS];
+    size_t              mNumJobs;
+
+    // bumped by start() to release the workers
+    volatile int32_t    mGeneration;
+    // number of workers that did not complete the current period
+    volatile int32_t    mPending;
+    // number of workers sleeping on mGeneration
+    volatile int32_t    mSleepers;
+    volatile int32_t    mExit;
+
+    uint32_t            mNumPeriods;
+    uint32_t            mNumSleeps;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_MIXER_POOL_H
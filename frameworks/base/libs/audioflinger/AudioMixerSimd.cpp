@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioMixerSimd"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <utils/Log.h>
+
+#include "AudioMixerSimd.h"
+
+#if defined(__ARM_HAVE_NEON) && defined(__ARM_NEON__)
+#define MIXER_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__)
+#define MIXER_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+int AudioMixerSimd::sImpl = AudioMixerSimd::IMPL_C;
+AudioMixerSimd::volume_stereo16_t AudioMixerSimd::sVolumeStereo16 = AudioMixerSimd::volumeStereo16_C;
+AudioMixerSimd::clamp_stereo16_t AudioMixerSimd::sClampStereo16 = AudioMixerSimd::clampStereo16_C;
+AudioMixerSimd::convert16_t AudioMixerSimd::sUpmixMono16 = AudioMixerSimd::upmixMono16_C;
+AudioMixerSimd::convert16_t AudioMixerSimd::sDownmixStereo16 = AudioMixerSimd::downmixStereo16_C;
+AudioMixerSimd::clamp_mono16_t AudioMixerSimd::sClampDownmixStereo16 =
+        AudioMixerSimd::clampDownmixStereo16_C;
+AudioMixerSimd::dot_product16_t AudioMixerSimd::sDotProduct16 = AudioMixerSimd::dotProduct16_C;
+
+static pthread_once_t sOnceControl = PTHREAD_ONCE_INIT;
+
+// ----------------------------------------------------------------------------
+
+void AudioMixerSimd::volumeStereo16_C(int32_t* out, const int16_t* in,
+        size_t frameCount, int16_t vl, int16_t vr)
+{
+    while (frameCount--) {
+        out[0] += in[0] * vl;
+        out[1] += in[1] * vr;
+        in += 2;
+        out += 2;
+    }
+}
+
+void AudioMixerSimd::clampStereo16_C(int32_t* out, const int32_t* sums, size_t frameCount)
+{
+    while (frameCount--) {
+        int32_t l = clamp16(sums[0] >> 12);
+        int32_t r = clamp16(sums[1] >> 12);
+        *out++ = (r<<16) | (l & 0xFFFF);
+        sums += 2;
+    }
+}
+
+void AudioMixerSimd::upmixMono16_C(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    while (frameCount--) {
+        *out++ = *in;
+        *out++ = *in++;
+    }
+}
+
+void AudioMixerSimd::downmixStereo16_C(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    while (frameCount--) {
+        *out++ = (int16_t)(((int32_t)in[0] + (int32_t)in[1]) >> 1);
+        in += 2;
+    }
+}
+
+void AudioMixerSimd::clampDownmixStereo16_C(int16_t* out, const int32_t* sums,
+        size_t frameCount)
+{
+    while (frameCount--) {
+        int32_t l = clamp16(sums[0] >> 12);
+        int32_t r = clamp16(sums[1] >> 12);
+        *out++ = (int16_t)((l + r) >> 1);
+        sums += 2;
+    }
+}
+
+int32_t AudioMixerSimd::dotProduct16_C(const int16_t* x, const int16_t* h, size_t count)
+{
+    int32_t sum = 0;
+    while (count--) {
+        sum += *x++ * *h++;
+    }
+    return sum;
+}
+
+// ----------------------------------------------------------------------------
+
+#ifdef MIXER_HAVE_NEON
+
+static void volumeStereo16_NEON(int32_t* out, const int16_t* in,
+        size_t frameCount, int16_t vl, int16_t vr)
+{
+    const int16_t volumes[4] = { vl, vr, vl, vr };
+    const int16x4_t v = vld1_s16(volumes);
+
+    // 4 frames (8 samples) per iteration
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        int16x8_t s = vld1q_s16(in);
+        int32x4_t a0 = vld1q_s32(out);
+        int32x4_t a1 = vld1q_s32(out + 4);
+        a0 = vmlal_s16(a0, vget_low_s16(s), v);
+        a1 = vmlal_s16(a1, vget_high_s16(s), v);
+        vst1q_s32(out, a0);
+        vst1q_s32(out + 4, a1);
+        in += 8;
+        out += 8;
+    }
+    AudioMixerSimd::volumeStereo16_C(out, in, frameCount & 3, vl, vr);
+}
+
+static void clampStereo16_NEON(int32_t* out, const int32_t* sums, size_t frameCount)
+{
+    // vqshrn is an arithmetic shift followed by a saturating narrow, which is
+    // exactly clamp16(x >> 12)
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        int32x4_t s0 = vld1q_s32(sums);
+        int32x4_t s1 = vld1q_s32(sums + 4);
+        int16x8_t d = vcombine_s16(vqshrn_n_s32(s0, 12), vqshrn_n_s32(s1, 12));
+        vst1q_s16((int16_t *)out, d);
+        sums += 8;
+        out += 4;
+    }
+    AudioMixerSimd::clampStereo16_C(out, sums, frameCount & 3);
+}
+
+static void upmixMono16_NEON(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    size_t blocks = frameCount >> 3;
+    while (blocks--) {
+        int16x8_t s = vld1q_s16(in);
+        int16x8x2_t d = vzipq_s16(s, s);
+        vst1q_s16(out, d.val[0]);
+        vst1q_s16(out + 8, d.val[1]);
+        in += 8;
+        out += 16;
+    }
+    AudioMixerSimd::upmixMono16_C(out, in, frameCount & 7);
+}
+
+static void downmixStereo16_NEON(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    // vhadd is (a + b) >> 1 computed without overflow
+    size_t blocks = frameCount >> 3;
+    while (blocks--) {
+        int16x8x2_t s = vld2q_s16(in);
+        vst1q_s16(out, vhaddq_s16(s.val[0], s.val[1]));
+        in += 16;
+        out += 8;
+    }
+    AudioMixerSimd::downmixStereo16_C(out, in, frameCount & 7);
+}
+
+static void clampDownmixStereo16_NEON(int16_t* out, const int32_t* sums, size_t frameCount)
+{
+    // vld2 splits the left and right sums, then the clamp of clampStereo16
+    // and the halved add of downmixStereo16
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        int32x4x2_t s = vld2q_s32(sums);
+        int16x4_t l = vqshrn_n_s32(s.val[0], 12);
+        int16x4_t r = vqshrn_n_s32(s.val[1], 12);
+        vst1_s16(out, vhadd_s16(l, r));
+        sums += 8;
+        out += 4;
+    }
+    AudioMixerSimd::clampDownmixStereo16_C(out, sums, frameCount & 3);
+}
+
+static int32_t dotProduct16_NEON(const int16_t* x, const int16_t* h, size_t count)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t blocks = count >> 3;
+    while (blocks--) {
+        int16x8_t s = vld1q_s16(x);
+        int16x8_t c = vld1q_s16(h);
+        acc = vmlal_s16(acc, vget_low_s16(s), vget_low_s16(c));
+        acc = vmlal_s16(acc, vget_high_s16(s), vget_high_s16(c));
+        x += 8;
+        h += 8;
+    }
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+}
+
+static bool cpuHasNeon()
+{
+    bool neon = false;
+    char line[512];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "Features", 8) == 0 && strstr(line, " neon") != NULL) {
+            neon = true;
+            break;
+        }
+    }
+    fclose(f);
+    return neon;
+}
+
+#endif // MIXER_HAVE_NEON
+
+// ----------------------------------------------------------------------------
+
+#ifdef MIXER_HAVE_SSE2
+
+static void volumeStereo16_SSE2(int32_t* out, const int16_t* in,
+        size_t frameCount, int16_t vl, int16_t vr)
+{
+    const __m128i v = _mm_set_epi16(vr, vl, vr, vl, vr, vl, vr, vl);
+
+    // 4 frames (8 samples) per iteration
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        __m128i s = _mm_loadu_si128((const __m128i *)in);
+        __m128i lo = _mm_mullo_epi16(s, v);
+        __m128i hi = _mm_mulhi_epi16(s, v);
+        __m128i a0 = _mm_loadu_si128((const __m128i *)out);
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(out + 4));
+        a0 = _mm_add_epi32(a0, _mm_unpacklo_epi16(lo, hi));
+        a1 = _mm_add_epi32(a1, _mm_unpackhi_epi16(lo, hi));
+        _mm_storeu_si128((__m128i *)out, a0);
+        _mm_storeu_si128((__m128i *)(out + 4), a1);
+        in += 8;
+        out += 8;
+    }
+    AudioMixerSimd::volumeStereo16_C(out, in, frameCount & 3, vl, vr);
+}
+
+static void clampStereo16_SSE2(int32_t* out, const int32_t* sums, size_t frameCount)
+{
+    // packs saturates to int16 which is exactly clamp16(x >> 12)
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        __m128i s0 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)sums), 12);
+        __m128i s1 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(sums + 4)), 12);
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(s0, s1));
+        sums += 8;
+        out += 4;
+    }
+    AudioMixerSimd::clampStereo16_C(out, sums, frameCount & 3);
+}
+
+static void upmixMono16_SSE2(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    size_t blocks = frameCount >> 3;
+    while (blocks--) {
+        __m128i s = _mm_loadu_si128((const __m128i *)in);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(s, s));
+        _mm_storeu_si128((__m128i *)(out + 8), _mm_unpackhi_epi16(s, s));
+        in += 8;
+        out += 16;
+    }
+    AudioMixerSimd::upmixMono16_C(out, in, frameCount & 7);
+}
+
+static void downmixStereo16_SSE2(int16_t* out, const int16_t* in, size_t frameCount)
+{
+    // madd with ones sums each frame to 32 bit, the halved sums always fit
+    // in 16 bit so packs does not saturate
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t blocks = frameCount >> 3;
+    while (blocks--) {
+        __m128i s0 = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)in), ones);
+        __m128i s1 = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(in + 8)), ones);
+        s0 = _mm_srai_epi32(s0, 1);
+        s1 = _mm_srai_epi32(s1, 1);
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(s0, s1));
+        in += 16;
+        out += 8;
+    }
+    AudioMixerSimd::downmixStereo16_C(out, in, frameCount & 7);
+}
+
+static void clampDownmixStereo16_SSE2(int16_t* out, const int32_t* sums, size_t frameCount)
+{
+    // the clamp of clampStereo16 followed by the frame sums of
+    // downmixStereo16, kept in registers
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t blocks = frameCount >> 2;
+    while (blocks--) {
+        __m128i s0 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)sums), 12);
+        __m128i s1 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(sums + 4)), 12);
+        __m128i m = _mm_srai_epi32(_mm_madd_epi16(_mm_packs_epi32(s0, s1), ones), 1);
+        _mm_storel_epi64((__m128i *)out, _mm_packs_epi32(m, m));
+        sums += 8;
+        out += 4;
+    }
+    AudioMixerSimd::clampDownmixStereo16_C(out, sums, frameCount & 3);
+}
+
+static int32_t dotProduct16_SSE2(const int16_t* x, const int16_t* h, size_t count)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t blocks = count >> 3;
+    while (blocks--) {
+        __m128i s = _mm_loadu_si128((const __m128i *)x);
+        __m128i c = _mm_loadu_si128((const __m128i *)h);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(s, c));
+        x += 8;
+        h += 8;
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+static bool cpuHasSse2()
+{
+#if defined(__x86_64__)
+    return true;
+#elif defined(__i386__)
+    uint32_t a, b, c, d;
+    // ebx is the PIC register, preserve it around cpuid
+    __asm__ __volatile__ (
+        "movl %%ebx, %%esi\n\t"
+        "cpuid\n\t"
+        "xchgl %%ebx, %%esi"
+        : "=a" (a), "=S" (b), "=c" (c), "=d" (d)
+        : "a" (1));
+    return (d & (1 << 26)) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // MIXER_HAVE_SSE2
+
+// ----------------------------------------------------------------------------
+
+void AudioMixerSimd::initOnce()
+{
+#ifdef MIXER_HAVE_NEON
+    if (cpuHasNeon()) {
+        sVolumeStereo16 = volumeStereo16_NEON;
+        sClampStereo16 = clampStereo16_NEON;
+        sUpmixMono16 = upmixMono16_NEON;
+        sDownmixStereo16 = downmixStereo16_NEON;
+        sClampDownmixStereo16 = clampDownmixStereo16_NEON;
+        sDotProduct16 = dotProduct16_NEON;
+        sImpl = IMPL_NEON;
+    }
+#endif
+#ifdef MIXER_HAVE_SSE2
+    if (cpuHasSse2()) {
+        sVolumeStereo16 = volumeStereo16_SSE2;
+        sClampStereo16 = clampStereo16_SSE2;
+        sUpmixMono16 = upmixMono16_SSE2;
+        sDownmixStereo16 = downmixStereo16_SSE2;
+        sClampDownmixStereo16 = clampDownmixStereo16_SSE2;
+        sDotProduct16 = dotProduct16_SSE2;
+        sImpl = IMPL_SSE2;
+    }
+#endif
+    LOGI("using %s mixer kernels", implName());
+}
+
+void AudioMixerSimd::init()
+{
+    pthread_once(&sOnceControl, initOnce);
+}
+
+AudioMixerSimd::convert16_t AudioMixerSimd::channelConverter(int inChannels, int outChannels)
+{
+    if (inChannels == outChannels) {
+        return NULL;
+    }
+    return (inChannels == 1) ? sUpmixMono16 : sDownmixStereo16;
+}
+
+int AudioMixerSimd::impl()
+{
+    return sImpl;
+}
+
+const char* AudioMixerSimd::implName()
+{
+    switch (sImpl) {
+    case IMPL_NEON:
+        return "neon";
+    case IMPL_SSE2:
+        return "sse2";
+    case IMPL_C:
+    default:
+        return "c";
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_MIXER_SIMD_H
+#define ANDROID_AUDIO_MIXER_SIMD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Vectorized versions of the AudioMixer inner loops. The implementation is
+ * selected once at runtime from the CPU features (NEON on ARM, SSE2 on x86
+ * host builds) and falls back to the portable C loops otherwise.
+ * Every variant produces exactly the same output as the C version.
+ */
+class AudioMixerSimd
+{
+public:
+    enum impl_type {
+        IMPL_C,
+        IMPL_NEON,
+        IMPL_SSE2
+    };
+
+    // 16 bit channel conversion, frameCount is the number of input frames
+    typedef void (*convert16_t)(int16_t* out, const int16_t* in, size_t frameCount);
+
+    // Picks the best implementation for this CPU. Safe to call several times.
+    static  void        init();
+
+    static  int         impl();
+    static  const char* implName();
+
+    // 16 bit stereo volume and accumulate (no ramp):
+    //   out[2n]   += in[2n]   * vl
+    //   out[2n+1] += in[2n+1] * vr
+    static inline void  volumeStereo16(int32_t* out, const int16_t* in,
+                                size_t frameCount, int16_t vl, int16_t vr) {
+        sVolumeStereo16(out, in, frameCount, vl, vr);
+    }
+
+    // Converts 4.12 stereo sums to 16 bit, saturating. Each output word holds
+    // one frame with the left sample in the low half.
+    static inline void  clampStereo16(int32_t* out, const int32_t* sums,
+                                size_t frameCount) {
+        sClampStereo16(out, sums, frameCount);
+    }
+
+    // Mono to stereo by duplicating each sample.
+    static inline void  upmixMono16(int16_t* out, const int16_t* in, size_t frameCount) {
+        sUpmixMono16(out, in, frameCount);
+    }
+
+    // Stereo to mono: out[n] = (in[2n] + in[2n+1]) >> 1
+    static inline void  downmixStereo16(int16_t* out, const int16_t* in, size_t frameCount) {
+        sDownmixStereo16(out, in, frameCount);
+    }
+
+    // clampStereo16() and downmixStereo16() in one pass: 4.12 stereo sums to
+    // 16 bit mono, same output as the two kernels one after the other
+    static inline void  clampDownmixStereo16(int16_t* out, const int32_t* sums,
+                                size_t frameCount) {
+        sClampDownmixStereo16(out, sums, frameCount);
+    }
+
+    // FIR inner product: sum of x[n] * h[n] for n < count, count being a
+    // multiple of 8
+    static inline int32_t dotProduct16(const int16_t* x, const int16_t* h, size_t count) {
+        return sDotProduct16(x, h, count);
+    }
+
+    // Returns the kernel converting inChannels to outChannels. Only mono and
+    // stereo are supported, any other input count is handled as stereo.
+    static  convert16_t channelConverter(int inChannels, int outChannels);
+
+    // Portable reference versions, also used for the tail of the vector loops.
+    static  void        volumeStereo16_C(int32_t* out, const int16_t* in,
+                                size_t frameCount, int16_t vl, int16_t vr);
+    static  void        clampStereo16_C(int32_t* out, const int32_t* sums,
+                                size_t frameCount);
+    static  void        upmixMono16_C(int16_t* out, const int16_t* in, size_t frameCount);
+    static  void        downmixStereo16_C(int16_t* out, const int16_t* in, size_t frameCount);
+    static  void        clampDownmixStereo16_C(int16_t* out, const int32_t* sums,
+                                size_t frameCount);
+    static  int32_t     dotProduct16_C(const int16_t* x, const int16_t* h, size_t count);
+
+    static inline int32_t clamp16(int32_t sample) {
+        if ((sample>>15) ^ (sample>>31))
+            sample = 0x7FFF ^ (sample>>31);
+        return sample;
+    }
+
+private:
+    typedef void (*volume_stereo16_t)(int32_t*, const int16_t*, size_t, int16_t, int16_t);
+    typedef void (*clamp_stereo16_t)(int32_t*, const int32_t*, size_t);
+    typedef void (*clamp_mono16_t)(int16_t*, const int32_t*, size_t);
+    typedef int32_t (*dot_product16_t)(const int16_t*, const int16_t*, size_t);
+
+    static  void        initOnce();
+
+    static  int                 sImpl;
+    static  volume_stereo16_t   sVolumeStereo16;
+    static  clamp_stereo16_t    sClampStereo16;
+    static  convert16_t         sUpmixMono16;
+    static  convert16_t         sDownmixStereo16;
+    static  clamp_mono16_t      sClampDownmixStereo16;
+    static  dot_product16_t     sDotProduct16;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_MIXER_SIMD_H
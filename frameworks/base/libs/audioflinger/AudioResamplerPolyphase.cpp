@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioResamplerPolyphase"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <utils/Log.h>
+#include <utils/threads.h>
+
+#include "AudioMixerSimd.h"
+#include "AudioResamplerPolyphase.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// filter length, cutoff as a fraction of the lowest Nyquist frequency and
+// Kaiser window beta of each tier
+static const int kTierTaps[AudioResamplerPolyphase::NUM_TIERS] = { 8, 16, 32 };
+static const double kTierCutoff[AudioResamplerPolyphase::NUM_TIERS] = { 0.80, 0.90, 0.95 };
+static const double kTierBeta[AudioResamplerPolyphase::NUM_TIERS] = { 4.0, 6.0, 8.0 };
+static const char* kTierNames[AudioResamplerPolyphase::NUM_TIERS] = { "fast", "default", "high" };
+
+// rates of the tables computed by preloadTables()
+static const int32_t kCommonRates[] = {
+    8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000
+};
+
+static const int kCoefShift = 14;
+
+static int32_t gcd(int32_t a, int32_t b)
+{
+    while (b != 0) {
+        int32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double y = x * x / 4.0;
+    for (int k = 1; k < 32; k++) {
+        term *= y / ((double)k * k);
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+static int fallbackQuality(int tier)
+{
+    switch (tier) {
+    case AudioResamplerPolyphase::TIER_FAST:
+        return AudioResampler::LOW_QUALITY;
+    case AudioResamplerPolyphase::TIER_HIGH:
+        return AudioResampler::HIGH_QUALITY;
+    default:
+        return AudioResampler::DEFAULT;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+Mutex AudioResamplerPolyphase::sTableLock;
+AudioResamplerPolyphase::table_t* AudioResamplerPolyphase::sTables[kMaxTables];
+int AudioResamplerPolyphase::sNumTables = 0;
+
+AudioResampler* AudioResamplerPolyphase::create(int bitDepth, int inChannelCount,
+        int32_t sampleRate, int tier)
+{
+    if (tier < 0 || tier >= NUM_TIERS) {
+        tier = TIER_DEFAULT;
+    }
+    if (bitDepth != 16 || inChannelCount < 1 || inChannelCount > 2) {
+        return AudioResampler::create(bitDepth, inChannelCount, sampleRate, fallbackQuality(tier));
+    }
+    return new AudioResamplerPolyphase(inChannelCount, sampleRate, tier);
+}
+
+void AudioResamplerPolyphase::reduce(int32_t inSampleRate, int32_t outSampleRate,
+        int32_t* L, int32_t* M)
+{
+    int32_t d = gcd(inSampleRate, outSampleRate);
+    *L = outSampleRate / d;
+    *M = inSampleRate / d;
+}
+
+bool AudioResamplerPolyphase::isSupported(int32_t inSampleRate, int32_t outSampleRate)
+{
+    if (inSampleRate <= 0 || outSampleRate <= 0 || inSampleRate > 2 * outSampleRate) {
+        return false;
+    }
+    int32_t L, M;
+    reduce(inSampleRate, outSampleRate, &L, &M);
+    return L <= MAX_PHASES;
+}
+
+void AudioResamplerPolyphase::preloadTables(int32_t outSampleRate, int tier)
+{
+    for (size_t i = 0; i < sizeof(kCommonRates) / sizeof(kCommonRates[0]); i++) {
+        int32_t inSampleRate = kCommonRates[i];
+        if (inSampleRate == outSampleRate || !isSupported(inSampleRate, outSampleRate)) {
+            continue;
+        }
+        int32_t L, M;
+        reduce(inSampleRate, outSampleRate, &L, &M);
+        getTable(L, M, tier);
+    }
+}
+
+int AudioResamplerPolyphase::tierFromString(const char* name)
+{
+    for (int i = 0; i < NUM_TIERS; i++) {
+        if (strcmp(name, kTierNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* AudioResamplerPolyphase::tierName(int tier)
+{
+    if (tier < 0 || tier >= NUM_TIERS) {
+        return "unknown";
+    }
+    return kTierNames[tier];
+}
+
+const AudioResamplerPolyphase::table_t* AudioResamplerPolyphase::getTable(int32_t L,
+        int32_t M, int tier)
+{
+    Mutex::Autolock _l(sTableLock);
+
+    for (int i = 0; i < sNumTables; i++) {
+        const table_t* table = sTables[i];
+        if (table->L == L && table->M == M && table->tier == tier) {
+            return table;
+        }
+    }
+    if (sNumTables >= kMaxTables) {
+        LOGW("no room for a %d/%d table", L, M);
+        return NULL;
+    }
+    table_t* table = createTable(L, M, tier);
+    sTables[sNumTables++] = table;
+    return table;
+}
+
+// The filter of phase p computes the output at input position n + p / L from
+// the frames n - taps/2 + 1 to n + taps/2. Each phase is normalized to a unity
+// DC gain after rounding.
+AudioResamplerPolyphase::table_t* AudioResamplerPolyphase::createTable(int32_t L,
+        int32_t M, int tier)
+{
+    table_t* table = new table_t;
+    const int taps = kTierTaps[tier];
+    const int half = taps / 2;
+    double fc = kTierCutoff[tier];
+    if (M > L) {
+        // downsampling: filter below the output Nyquist frequency
+        fc = fc * L / M;
+    }
+    const double beta = kTierBeta[tier];
+    const double i0beta = besselI0(beta);
+
+    table->L = L;
+    table->M = M;
+    table->tier = tier;
+    table->taps = taps;
+    table->coefs = new int16_t[L * taps];
+
+    double h[kMaxTaps];
+    for (int p = 0; p < L; p++) {
+        double sum = 0;
+        for (int k = 0; k < taps; k++) {
+            double d = (double)(k - half + 1) - (double)p / L;
+            double u = d / half;
+            double w = (u >= -1.0 && u <= 1.0) ? besselI0(beta * sqrt(1.0 - u * u)) / i0beta : 0;
+            double x = M_PI * fc * d;
+            double sinc = (x == 0) ? 1.0 : sin(x) / x;
+            h[k] = fc * sinc * w;
+            sum += h[k];
+        }
+        int16_t* coefs = table->coefs + p * taps;
+        int32_t total = 0;
+        int largest = 0;
+        for (int k = 0; k < taps; k++) {
+            coefs[k] = (int16_t)floor(h[k] / sum * (1 << kCoefShift) + 0.5);
+            total += coefs[k];
+            if (coefs[k] > coefs[largest]) {
+                largest = k;
+            }
+        }
+        coefs[largest] += (1 << kCoefShift) - total;
+    }
+    LOGV("table %d/%d %s, %d taps", L, M, tierName(tier), taps);
+    return table;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioResamplerPolyphase::AudioResamplerPolyphase(int inChannelCount, int32_t sampleRate, int tier)
+    :   AudioResampler(16, inChannelCount, sampleRate),
+        mTier(tier), mL(0), mM(0), mTable(0), mFallback(0),
+        mIndex(0), mFilled(0), mPhase(0)
+{
+    mHistory[0] = new int16_t[kHistoryFrames];
+    mHistory[1] = (inChannelCount == 2) ? new int16_t[kHistoryFrames] : mHistory[0];
+    init();
+    AudioResamplerPolyphase::setSampleRate(sampleRate);
+}
+
+AudioResamplerPolyphase::~AudioResamplerPolyphase()
+{
+    delete mFallback;
+    if (mHistory[1] != mHistory[0]) {
+        delete[] mHistory[1];
+    }
+    delete[] mHistory[0];
+}
+
+void AudioResamplerPolyphase::init()
+{
+    // kHalfTaps - 1 frames of silence before the first input frame
+    memset(mHistory[0], 0, kHistoryFrames * sizeof(int16_t));
+    if (mHistory[1] != mHistory[0]) {
+        memset(mHistory[1], 0, kHistoryFrames * sizeof(int16_t));
+    }
+    mIndex = kHalfTaps - 1;
+    mFilled = kHalfTaps - 1;
+    mPhase = 0;
+}
+
+void AudioResamplerPolyphase::setSampleRate(int32_t inSampleRate)
+{
+    AudioResampler::setSampleRate(inSampleRate);
+
+    int32_t L, M;
+    reduce(inSampleRate, mSampleRate, &L, &M);
+    if (L == mL && M == mM) {
+        return;
+    }
+    if (mL != 0) {
+        // keep the position within the current input frame
+        mPhase = (int32_t)(((int64_t)mPhase * L) / mL);
+    }
+    mL = L;
+    mM = M;
+    updateTable();
+}
+
+void AudioResamplerPolyphase::setVolume(int16_t left, int16_t right)
+{
+    AudioResampler::setVolume(left, right);
+    if (mFallback != 0) {
+        mFallback->setVolume(left, right);
+    }
+}
+
+void AudioResamplerPolyphase::setTier(int tier)
+{
+    if (tier < 0 || tier >= NUM_TIERS || tier == mTier) {
+        return;
+    }
+    mTier = tier;
+    updateTable();
+}
+
+void AudioResamplerPolyphase::updateTable()
+{
+    mTable = isSupported(mInSampleRate, mSampleRate) ? getTable(mL, mM, mTier) : NULL;
+    if (mTable != 0) {
+        // a buffer held by the fallback resampler is not released: the
+        // providers used here just return it again on the next request
+        delete mFallback;
+        mFallback = 0;
+        return;
+    }
+    if (mFallback == 0) {
+        mFallback = AudioResampler::create(16, mChannelCount, mSampleRate, fallbackQuality(mTier));
+        mFallback->setVolume(mVolume[0], mVolume[1]);
+    }
+    mFallback->setSampleRate(mInSampleRate);
+}
+
+// refill() reads at most frames input frames, returns false if the provider
+// has no data
+bool AudioResamplerPolyphase::refill(AudioBufferProvider* provider, size_t frames)
+{
+    if (mFilled + frames > kHistoryFrames) {
+        // drop the frames no filter can reach anymore
+        size_t first = mIndex - (kHalfTaps - 1);
+        size_t count = mFilled - first;
+        memmove(mHistory[0], mHistory[0] + first, count * sizeof(int16_t));
+        if (mHistory[1] != mHistory[0]) {
+            memmove(mHistory[1], mHistory[1] + first, count * sizeof(int16_t));
+        }
+        mIndex -= first;
+        mFilled -= first;
+    }
+    if (frames > kHistoryFrames - mFilled) {
+        frames = kHistoryFrames - mFilled;
+    }
+
+    AudioBufferProvider::Buffer buffer;
+    while (frames) {
+        buffer.frameCount = frames;
+        provider->getNextBuffer(&buffer);
+        if (buffer.raw == NULL || buffer.frameCount == 0) {
+            return false;
+        }
+        size_t count = buffer.frameCount;
+        if (mChannelCount == 1) {
+            memcpy(mHistory[0] + mFilled, buffer.i16, count * sizeof(int16_t));
+        } else {
+            const int16_t* in = buffer.i16;
+            int16_t* left = mHistory[0] + mFilled;
+            int16_t* right = mHistory[1] + mFilled;
+            for (size_t i = 0; i < count; i++) {
+                left[i] = in[0];
+                right[i] = in[1];
+                in += 2;
+            }
+        }
+        mFilled += count;
+        frames -= count;
+        provider->releaseBuffer(&buffer);
+    }
+    return true;
+}
+
+void AudioResamplerPolyphase::resample(int32_t* out, size_t outFrameCount,
+        AudioBufferProvider* provider)
+{
+    if (mFallback != 0) {
+        mFallback->resample(out, outFrameCount, provider);
+        return;
+    }
+
+    const int taps = mTable->taps;
+    const int16_t* coefs = mTable->coefs;
+    const int32_t vl = mVolume[0];
+    const int32_t vr = mVolume[1];
+
+    for (size_t n = 0; n < outFrameCount; n++) {
+        while (mIndex + kHalfTaps >= mFilled) {
+            // only read the input needed by the remaining output frames, so
+            // that the provider is not drained ahead of time
+            size_t last = mIndex + ((size_t)mPhase + (outFrameCount - n - 1) * mM) / mL;
+            if (!refill(provider, last + kHalfTaps + 1 - mFilled)) {
+                return;
+            }
+        }
+
+        const int16_t* h = coefs + mPhase * taps;
+        size_t start = mIndex - taps / 2 + 1;
+        int32_t l = AudioMixerSimd::dotProduct16(mHistory[0] + start, h, taps);
+        l = AudioMixerSimd::clamp16((l + (1 << (kCoefShift - 1))) >> kCoefShift);
+        int32_t r = l;
+        if (mHistory[1] != mHistory[0]) {
+            r = AudioMixerSimd::dotProduct16(mHistory[1] + start, h, taps);
+            r = AudioMixerSimd::clamp16((r + (1 << (kCoefShift - 1))) >> kCoefShift);
+        }
+        out[0] += l * vl;
+        out[1] += r * vr;
+        out += 2;
+
+        mPhase += mM;
+        if (mPhase >= mL) {
+            mIndex += mPhase / mL;
+            mPhase %= mL;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_RESAMPLER_POLYPHASE_H
+#define ANDROID_AUDIO_RESAMPLER_POLYPHASE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+#include "AudioBufferProvider.h"
+#include "AudioResampler.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Polyphase FIR resampler for 16 bit mono or stereo input.
+ *
+ * The output rate is in_rate * L / M with L and M reduced. One windowed sinc
+ * filter per phase (L phases) is computed once per ratio and quality tier and
+ * shared by all the resamplers, so that the usual 8k to 48k ratios cost a
+ * table lookup and one vectorized inner product per output sample.
+ * Ratios needing more than MAX_PHASES phases are handed to an AudioResampler
+ * of comparable quality.
+ *
+ * The tier can be changed between two calls to resample() without glitch: the
+ * input history is always kept for the longest filter.
+ */
+class AudioResamplerPolyphase : public AudioResampler
+{
+public:
+    enum tier_t {
+        TIER_FAST,
+        TIER_DEFAULT,
+        TIER_HIGH,
+        NUM_TIERS
+    };
+
+    static const int MAX_PHASES = 160;
+
+    // Returns a polyphase resampler, or an AudioResampler for other than 16
+    // bit input.
+    static  AudioResampler* create(int bitDepth, int inChannelCount,
+                                int32_t sampleRate, int tier);
+
+    // true if the conversion has a polyphase table
+    static  bool        isSupported(int32_t inSampleRate, int32_t outSampleRate);
+    // computes the tables converting the usual rates to outSampleRate, so that
+    // it is not done by the first track played at one of these rates
+    static  void        preloadTables(int32_t outSampleRate, int tier);
+
+    // "fast", "default" or "high", returns -1 if the name is unknown
+    static  int         tierFromString(const char* name);
+    static  const char* tierName(int tier);
+
+                        AudioResamplerPolyphase(int inChannelCount, int32_t sampleRate, int tier);
+    virtual             ~AudioResamplerPolyphase();
+
+    virtual void        init();
+    virtual void        setSampleRate(int32_t inSampleRate);
+    virtual void        setVolume(int16_t left, int16_t right);
+    virtual void        resample(int32_t* out, size_t outFrameCount,
+                                AudioBufferProvider* provider);
+
+            int         tier() const { return mTier; }
+            void        setTier(int tier);
+
+private:
+                        AudioResamplerPolyphase(const AudioResamplerPolyphase&);
+                        AudioResamplerPolyphase& operator = (const AudioResamplerPolyphase&);
+
+    struct table_t {
+        int32_t         L;
+        int32_t         M;
+        int             tier;
+        int             taps;
+        // taps coefficients for each of the L phases, in 2.14
+        int16_t*        coefs;
+    };
+
+    static  const table_t* getTable(int32_t L, int32_t M, int tier);
+    static  table_t*    createTable(int32_t L, int32_t M, int tier);
+    static  void        reduce(int32_t inSampleRate, int32_t outSampleRate,
+                                int32_t* L, int32_t* M);
+
+            void        updateTable();
+            bool        refill(AudioBufferProvider* provider, size_t frames);
+
+    // longest filter, and half of it: the number of input frames read ahead
+    static const int kMaxTaps = 32;
+    static const int kHalfTaps = kMaxTaps / 2;
+    // input frames read from the provider at most at a time
+    static const size_t kRefillFrames = 256;
+    static const size_t kHistoryFrames = kMaxTaps + kRefillFrames;
+    static const int kMaxTables = 64;
+
+    // tables are never freed, there is one per ratio and tier in use
+    static  Mutex       sTableLock;
+    static  table_t*    sTables[kMaxTables];
+    static  int         sNumTables;
+
+    int                 mTier;
+    int32_t             mL;
+    int32_t             mM;
+    const table_t*      mTable;
+    AudioResampler*     mFallback;
+
+    // planar input history, mIndex is the frame at or before the output
+    // position, mPhase / L the fractional part of the position
+    int16_t*            mHistory[2];
+    size_t              mIndex;
+    size_t              mFilled;
+    int32_t             mPhase;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_RESAMPLER_POLYPHASE_H
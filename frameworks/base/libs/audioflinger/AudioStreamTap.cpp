@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioStreamTap"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <utils/Log.h>
+#include <utils/Atomic.h>
+
+#include <media/AudioSystem.h>
+
+#include "AudioStreamTap.h"
+#include "AudioSync.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+const char* const AudioStreamTap::keyTap = "audio_tap";
+
+// default file name, %s is the stream name and %d a sequence number
+static const char* kDefaultTapPath = "/data/AudioTap_%s_%d.wav";
+// writer thread sleep when all the rings are empty
+static const nsecs_t kWriterSleep = milliseconds(20);
+// close() poll period while a write is in progress
+static const useconds_t kCloseWaitUs = 1000;
+
+static volatile int32_t sTapSequence = 0;
+
+static inline void putLE16(uint8_t* p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void putLE32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioStreamTap::AudioStreamTap(const char* path, uint32_t sampleRate,
+        int channelCount, int format)
+    :   mStatus(NO_INIT), mPath(path), mSampleRate(sampleRate),
+        mChannelCount(channelCount), mFormat(format), mRing(0),
+        mRear(0), mFront(0), mClosing(0), mWriting(0), mClosed(false), mPendingDrops(0),
+        mNumChunks(0), mNumDropped(0), mFd(-1), mDataOffset(0), mDataBytes(0)
+{
+    // only linear PCM can be saved as WAV
+    if ((format != AudioSystem::PCM_16_BIT && format != AudioSystem::PCM_8_BIT) ||
+            channelCount <= 0 || sampleRate == 0) {
+        mStatus = BAD_VALUE;
+        return;
+    }
+    mRing = new uint8_t[kRingSize];
+    mStatus = NO_ERROR;
+}
+
+AudioStreamTap::~AudioStreamTap()
+{
+    closeFile();
+    delete[] mRing;
+}
+
+void AudioStreamTap::copyToRing(uint32_t pos, const void* data, size_t bytes)
+{
+    size_t offset = pos & (kRingSize - 1);
+    size_t part = kRingSize - offset;
+    if (part > bytes) {
+        part = bytes;
+    }
+    memcpy(mRing + offset, data, part);
+    memcpy(mRing, (const uint8_t *)data + part, bytes - part);
+}
+
+void AudioStreamTap::copyFromRing(uint32_t pos, void* data, size_t bytes) const
+{
+    size_t offset = pos & (kRingSize - 1);
+    size_t part = kRingSize - offset;
+    if (part > bytes) {
+        part = bytes;
+    }
+    memcpy(data, mRing + offset, part);
+    memcpy((uint8_t *)data + part, mRing, bytes - part);
+}
+
+void AudioStreamTap::write(const void* buffer, size_t bytes)
+{
+    if (mStatus != NO_ERROR || bytes == 0) {
+        return;
+    }
+    // close() sets mClosing then reads mWriting, the opposite order here:
+    // either close() waits for this write or the write sees mClosing
+    android_atomic_inc(&mWriting);
+    audioMemoryBarrier();
+    if (!mClosing) {
+        queueChunk(buffer, bytes);
+    }
+    audioMemoryBarrier();
+    android_atomic_dec(&mWriting);
+}
+
+void AudioStreamTap::queueChunk(const void* buffer, size_t bytes)
+{
+    chunk_header_t header;
+    uint32_t rear = (uint32_t)mRear;
+    uint32_t used = rear - (uint32_t)audioAcquireLoad(&mFront);
+    size_t size = sizeof(header) + ((bytes + 7) & ~7);
+
+    if (kRingSize - used < size) {
+        // the writer thread is late: never wait for it
+        mPendingDrops += bytes;
+        android_atomic_inc(&mNumDropped);
+        return;
+    }
+
+    header.timestamp = systemTime();
+    header.bytes = bytes;
+    header.droppedBytes = mPendingDrops;
+    copyToRing(rear, &header, sizeof(header));
+    copyToRing(rear + sizeof(header), buffer, bytes);
+    mPendingDrops = 0;
+    android_atomic_inc(&mNumChunks);
+    // publish the chunk to the writer thread
+    audioReleaseStore(rear + size, &mRear);
+}
+
+void AudioStreamTap::close()
+{
+    android_atomic_or(1, &mClosing);
+    audioMemoryBarrier();
+    while (mWriting != 0) {
+        usleep(kCloseWaitUs);
+    }
+    Writer::close(this);
+}
+
+// drain() is called by the writer thread only
+bool AudioStreamTap::drain()
+{
+    uint32_t front = (uint32_t)mFront;
+    uint32_t rear = (uint32_t)audioAcquireLoad(&mRear);
+    bool written = false;
+
+    while (front != rear) {
+        chunk_header_t header;
+        copyFromRing(front, &header, sizeof(header));
+        if (mFd < 0 && openFile(header.timestamp) != NO_ERROR) {
+            // keep consuming so that the audio thread never sees a full ring
+            mStatus = INVALID_OPERATION;
+        }
+        if (mFd >= 0) {
+            writeSilence(header.droppedBytes);
+            uint32_t pos = front + sizeof(header);
+            size_t offset = pos & (kRingSize - 1);
+            size_t part = kRingSize - offset;
+            if (part > header.bytes) {
+                part = header.bytes;
+            }
+            writeFile(mRing + offset, part);
+            writeFile(mRing, header.bytes - part);
+        }
+        front += sizeof(header) + ((header.bytes + 7) & ~7);
+        audioReleaseStore(front, &mFront);
+        written = true;
+    }
+    return written;
+}
+
+status_t AudioStreamTap::openFile(nsecs_t start)
+{
+    mFd = ::open(mPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (mFd < 0) {
+        LOGE("cannot open %s: %s", mPath.string(), strerror(errno));
+        return INVALID_OPERATION;
+    }
+
+    // the LIST chunk holds the time of the first sample in the CLOCK_MONOTONIC
+    // timebase, as used by systemTime()
+    char comment[64];
+    snprintf(comment, sizeof(comment), "start_ns=%lld", (long long)start);
+    size_t commentSize = (strlen(comment) + 2) & ~1;
+
+    uint32_t bits = (mFormat == AudioSystem::PCM_16_BIT) ? 16 : 8;
+    uint32_t blockAlign = mChannelCount * bits / 8;
+    uint8_t header[128];
+    memset(header, 0, sizeof(header));
+    uint8_t* p = header;
+
+    memcpy(p, "RIFF", 4);
+    // RIFF size is set by closeFile()
+    memcpy(p + 8, "WAVE", 4);
+    p += 12;
+
+    memcpy(p, "fmt ", 4);
+    putLE32(p + 4, 16);
+    putLE16(p + 8, 1);
+    putLE16(p + 10, mChannelCount);
+    putLE32(p + 12, mSampleRate);
+    putLE32(p + 16, mSampleRate * blockAlign);
+    putLE16(p + 20, blockAlign);
+    putLE16(p + 22, bits);
+    p += 24;
+
+    memcpy(p, "LIST", 4);
+    putLE32(p + 4, 4 + 8 + commentSize);
+    memcpy(p + 8, "INFO", 4);
+    memcpy(p + 12, "ICMT", 4);
+    putLE32(p + 16, commentSize);
+    memcpy(p + 20, comment, strlen(comment));
+    p += 20 + commentSize;
+
+    memcpy(p, "data", 4);
+    p += 8;
+
+    mDataOffset = p - header;
+    writeFile(header, mDataOffset);
+    mDataBytes = 0;
+    LOGV("tap %s started at %lld", mPath.string(), (long long)start);
+    return NO_ERROR;
+}
+
+void AudioStreamTap::closeFile()
+{
+    if (mFd < 0) {
+        return;
+    }
+    // complete the RIFF and data chunk sizes
+    uint8_t size[4];
+    putLE32(size, mDataOffset - 8 + mDataBytes);
+    pwrite(mFd, size, 4, 4);
+    putLE32(size, mDataBytes);
+    pwrite(mFd, size, 4, mDataOffset - 4);
+    ::close(mFd);
+    mFd = -1;
+}
+
+void AudioStreamTap::writeFile(const void* data, size_t bytes)
+{
+    while (bytes != 0) {
+        ssize_t written = ::write(mFd, data, bytes);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGW("error writing %s: %s", mPath.string(), strerror(errno));
+            return;
+        }
+        data = (const uint8_t *)data + written;
+        bytes -= written;
+        mDataBytes += written;
+    }
+}
+
+void AudioStreamTap::writeSilence(size_t bytes)
+{
+    static const uint8_t zeros[4096] = { 0 };
+    uint8_t silence8[4096];
+
+    const uint8_t* silence = zeros;
+    if (mFormat == AudioSystem::PCM_8_BIT) {
+        // 8 bit PCM is unsigned
+        memset(silence8, 0x80, sizeof(silence8));
+        silence = silence8;
+    }
+    while (bytes != 0) {
+        size_t part = (bytes > sizeof(zeros)) ? sizeof(zeros) : bytes;
+        writeFile(silence, part);
+        bytes -= part;
+    }
+}
+
+void AudioStreamTap::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "tap %s: %d chunks, %d dropped, ring %u/%u bytes\n",
+            mPath.string(), mNumChunks, mNumDropped,
+            (uint32_t)mRear - (uint32_t)mFront, kRingSize);
+    result.append(buffer);
+}
+
+status_t AudioStreamTap::setParameter(sp<AudioStreamTap>* tap, const String8& value,
+        const char* name, uint32_t sampleRate, int channelCount, int format)
+{
+    if (*tap != 0) {
+        (*tap)->close();
+        tap->clear();
+    }
+    if (value == "0" || value.length() == 0) {
+        return NO_ERROR;
+    }
+
+    char path[PATH_MAX];
+    if (value == "1") {
+        snprintf(path, sizeof(path), kDefaultTapPath, name, android_atomic_inc(&sTapSequence));
+    } else {
+        strncpy(path, value.string(), sizeof(path) - 1);
+        path[sizeof(path) - 1] = 0;
+    }
+    sp<AudioStreamTap> newTap = new AudioStreamTap(path, sampleRate, channelCount, format);
+    if (newTap->initCheck() != NO_ERROR) {
+        return newTap->initCheck();
+    }
+    Writer::add(newTap);
+    *tap = newTap;
+    return NO_ERROR;
+}
+
+// ----------------------------------------------------------------------------
+
+Mutex AudioStreamTap::Writer::sLock;
+sp<AudioStreamTap::Writer> AudioStreamTap::Writer::sWriter;
+Vector< sp<AudioStreamTap> > AudioStreamTap::Writer::sTaps;
+
+AudioStreamTap::Writer::Writer()
+    :   Thread(false)
+{
+}
+
+void AudioStreamTap::Writer::add(const sp<AudioStreamTap>& tap)
+{
+    Mutex::Autolock _l(sLock);
+    sTaps.add(tap);
+    if (sWriter == 0) {
+        sWriter = new Writer();
+        sWriter->run("AudioTapWriter", ANDROID_PRIORITY_BACKGROUND);
+    }
+}
+
+// close() is called by AudioStreamTap::close() once no write is in progress
+void AudioStreamTap::Writer::close(AudioStreamTap* tap)
+{
+    Mutex::Autolock _l(sLock);
+    tap->mClosed = true;
+}
+
+bool AudioStreamTap::Writer::threadLoop()
+{
+    Vector< sp<AudioStreamTap> > taps;
+    Vector<bool> closed;
+    {
+        Mutex::Autolock _l(sLock);
+        if (sTaps.isEmpty()) {
+            // a new writer is started by the next add()
+            sWriter.clear();
+            return false;
+        }
+        taps = sTaps;
+        // no chunk is queued after mClosed is set, the drain below gets
+        // the last ones
+        for (size_t i = 0; i < taps.size(); i++) {
+            closed.add(taps[i]->mClosed);
+        }
+    }
+
+    bool written = false;
+    for (size_t i = 0; i < taps.size(); i++) {
+        sp<AudioStreamTap>& tap = taps.editItemAt(i);
+        if (tap->drain()) {
+            written = true;
+        }
+        if (closed[i]) {
+            tap->closeFile();
+            Mutex::Autolock _l(sLock);
+            for (size_t j = 0; j < sTaps.size(); j++) {
+                if (sTaps[j] == tap) {
+                    sTaps.removeAt(j);
+                    break;
+                }
+            }
+        }
+    }
+    if (!written) {
+        usleep(kWriterSleep / 1000);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_STREAM_TAP_H
+#define ANDROID_AUDIO_STREAM_TAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Copy of the PCM written to or read from a stream, saved to a WAV file.
+ *
+ * The audio thread only copies each buffer to a single producer single consumer
+ * ring and never blocks: when the ring is full the buffer is dropped and counted.
+ * A low priority thread shared by all taps empties the rings to the files.
+ * Dropped buffers are written as silence so that sample n of the file was
+ * played or captured at start + n / sampleRate, the start time being saved in
+ * the WAV header.
+ */
+class AudioStreamTap : public RefBase
+{
+public:
+    // parameter enabling the tap of a stream: "1" for a default file name, a
+    // path, or "0" to stop
+    static const char* const keyTap;
+
+                        AudioStreamTap(const char* path, uint32_t sampleRate,
+                                int channelCount, int format);
+    virtual             ~AudioStreamTap();
+
+            status_t    initCheck() const { return mStatus; }
+
+            // called by the audio thread
+            void        write(const void* buffer, size_t bytes);
+            // No more writes: waits for a write in progress on another thread,
+            // then hands the tap to the writer thread which completes the file.
+            void        close();
+
+            void        dump(String8& result) const;
+
+    // Handles keyTap for a stream: opens or closes *tap according to value.
+    // name is used in the default file name.
+    static  status_t    setParameter(sp<AudioStreamTap>* tap, const String8& value,
+                                const char* name, uint32_t sampleRate,
+                                int channelCount, int format);
+
+private:
+                        AudioStreamTap(const AudioStreamTap&);
+                        AudioStreamTap& operator = (const AudioStreamTap&);
+
+    struct chunk_header_t {
+        int64_t         timestamp;
+        uint32_t        bytes;
+        // bytes dropped before this chunk
+        uint32_t        droppedBytes;
+    };
+
+    // the writer thread shared by all taps
+    class Writer : public Thread {
+    public:
+                        Writer();
+        static  void    add(const sp<AudioStreamTap>& tap);
+        static  void    close(AudioStreamTap* tap);
+    private:
+        virtual bool    threadLoop();
+
+        static  Mutex                       sLock;
+        static  sp<Writer>                  sWriter;
+        static  Vector< sp<AudioStreamTap> > sTaps;
+    };
+
+            void        queueChunk(const void* buffer, size_t bytes);
+            void        copyToRing(uint32_t pos, const void* data, size_t bytes);
+            void        copyFromRing(uint32_t pos, void* data, size_t bytes) const;
+            // called by the writer thread, returns true if data was written
+            bool        drain();
+            status_t    openFile(nsecs_t start);
+            void        closeFile();
+            void        writeFile(const void* data, size_t bytes);
+            void        writeSilence(size_t bytes);
+
+    static const size_t kRingSize = 256 * 1024;
+
+    status_t            mStatus;
+    String8             mPath;
+    uint32_t            mSampleRate;
+    int                 mChannelCount;
+    int                 mFormat;
+
+    // producer position is mRear, consumer position is mFront, both in bytes
+    uint8_t*            mRing;
+    volatile int32_t    mRear;
+    volatile int32_t    mFront;
+    // set by close(), no write starts after it
+    volatile int32_t    mClosing;
+    // number of write() calls in progress
+    volatile int32_t    mWriting;
+    // set under Writer::sLock once no write is in progress
+    bool                mClosed;
+    // producer only
+    uint32_t            mPendingDrops;
+    volatile int32_t    mNumChunks;
+    volatile int32_t    mNumDropped;
+
+    // writer thread only
+    int                 mFd;
+    size_t              mDataOffset;
+    uint32_t            mDataBytes;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_STREAM_TAP_H
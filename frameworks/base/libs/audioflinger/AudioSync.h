@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_SYNC_H
+#define ANDROID_AUDIO_SYNC_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <utils/Atomic.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Ordering helpers for the data AudioFlinger threads hand over to each other
+ * without a lock. The android_atomic operations are atomic but do not order
+ * the memory accesses around them on SMP ARM: data published through an atomic
+ * word must be written before a release store of that word, and read after an
+ * acquire load of it.
+ */
+
+static inline void audioMemoryBarrier()
+{
+#if defined(__ARM_ARCH_7A__) || defined(__ARM_ARCH_7R__)
+    __asm__ __volatile__ ("dmb" : : : "memory");
+#elif defined(__ARM_ARCH_6__) || defined(__ARM_ARCH_6J__) || \
+        defined(__ARM_ARCH_6K__) || defined(__ARM_ARCH_6Z__) || defined(__ARM_ARCH_6ZK__)
+    // ARMv6 data memory barrier through CP15
+    __asm__ __volatile__ ("mcr p15, 0, %0, c7, c10, 5" : : "r" (0) : "memory");
+#elif defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("mfence" : : : "memory");
+#else
+    // uniprocessor: only keep the compiler from reordering
+    __asm__ __volatile__ ("" : : : "memory");
+#endif
+}
+
+// the accesses before the store are visible before the new value
+static inline void audioReleaseStore(int32_t value, volatile int32_t* addr)
+{
+    audioMemoryBarrier();
+    *addr = value;
+}
+
+// the accesses after the load see at least what was written before the
+// release store of the value loaded
+static inline int32_t audioAcquireLoad(volatile const int32_t* addr)
+{
+    int32_t value = *addr;
+    audioMemoryBarrier();
+    return value;
+}
+
+// android_atomic_cmpxchg() with acquire and release semantics, returns 0 if
+// the value was exchanged
+static inline int audioAtomicCmpxchg(int32_t oldValue, int32_t newValue,
+        volatile int32_t* addr)
+{
+    audioMemoryBarrier();
+    int status = android_atomic_cmpxchg(oldValue, newValue, addr);
+    audioMemoryBarrier();
+    return status;
+}
+
+// Sleeps while *addr is value, for at most timeout nanoseconds if timeout is
+// positive. Returns immediately if *addr changed, so the caller checks the
+// condition again in a loop.
+static inline void futexWait(volatile int32_t* addr, int32_t value, nsecs_t timeout = -1)
+{
+    if (timeout < 0) {
+        syscall(__NR_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000000000;
+    ts.tv_nsec = timeout % 1000000000;
+    syscall(__NR_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+// wakes up to count threads sleeping in futexWait() on addr
+static inline void futexWake(volatile int32_t* addr, int count)
+{
+    syscall(__NR_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_SYNC_H
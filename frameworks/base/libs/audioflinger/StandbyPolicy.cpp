@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "StandbyPolicy.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// default bounds of the adaptive delay
+static const nsecs_t kStandbyDelayMin = milliseconds(200);
+static const nsecs_t kStandbyDelayMax = seconds(10);
+// number of idle gaps observed before the adaptive policy leaves the default delay
+static const int kMinGaps = 4;
+
+// ----------------------------------------------------------------------------
+
+StandbyPolicy::StandbyPolicy(nsecs_t delay)
+    :   mMode(FIXED), mPeriod(0),
+        mFixedDelay(delay), mMinDelay(kStandbyDelayMin),
+        mMaxDelay(kStandbyDelayMax), mDelay(delay),
+        // FIXME: Relaxed timing because of a certain device that can't meet latency
+        // Should be reduced to 2x after the vendor fixes the driver issue
+        mMaxPeriodRatio(3),
+        mIdle(false), mIdleStart(0), mGapIndex(0), mGapCount(0),
+        mExitCost(0), mNumStandbyExits(0), mShortGaps(false)
+{
+    if (mMinDelay > delay) mMinDelay = delay;
+    if (mMaxDelay < delay) mMaxDelay = delay;
+    memset(mGaps, 0, sizeof(mGaps));
+}
+
+// when tracks usually come back within a few periods, poll at the active rate
+// while idle so that a new track does not wait a full period to start
+uint32_t StandbyPolicy::idleSleepTimeUs(uint32_t defaultUs, uint32_t activeUs) const
+{
+    if (mMode == ADAPTIVE && mShortGaps) {
+        return activeUs;
+    }
+    return defaultUs;
+}
+
+void StandbyPolicy::onIdle(nsecs_t now)
+{
+    if (!mIdle) {
+        mIdle = true;
+        mIdleStart = now;
+    }
+}
+
+void StandbyPolicy::onActive(nsecs_t now)
+{
+    if (mIdle) {
+        mIdle = false;
+        mGaps[mGapIndex] = now - mIdleStart;
+        mGapIndex = (mGapIndex + 1) % kNumGaps;
+        if (mGapCount < kNumGaps) mGapCount++;
+        update();
+    }
+}
+
+// writeDuration is the duration of the first write after leaving standby: what
+// exceeds one period is the cost of waking up the output
+void StandbyPolicy::onStandbyExit(nsecs_t writeDuration)
+{
+    nsecs_t cost = writeDuration - mPeriod;
+    if (cost < 0) cost = 0;
+    if (mNumStandbyExits == 0) {
+        mExitCost = cost;
+    } else {
+        mExitCost += (cost - mExitCost) / 4;
+    }
+    mNumStandbyExits++;
+    update();
+}
+
+status_t StandbyPolicy::setMode(int mode)
+{
+    if (mode != FIXED && mode != ADAPTIVE) {
+        return BAD_VALUE;
+    }
+    mMode = mode;
+    update();
+    return NO_ERROR;
+}
+
+// the bounds of the adaptive delay follow the default delay when it is set
+// outside of them
+status_t StandbyPolicy::setDelay(nsecs_t delay)
+{
+    if (delay <= 0) {
+        return BAD_VALUE;
+    }
+    mFixedDelay = delay;
+    if (mMinDelay > delay) mMinDelay = delay;
+    if (mMaxDelay < delay) mMaxDelay = delay;
+    update();
+    return NO_ERROR;
+}
+
+status_t StandbyPolicy::setMinDelay(nsecs_t delay)
+{
+    if (delay <= 0 || delay > mMaxDelay) {
+        return BAD_VALUE;
+    }
+    mMinDelay = delay;
+    update();
+    return NO_ERROR;
+}
+
+status_t StandbyPolicy::setMaxDelay(nsecs_t delay)
+{
+    if (delay <= 0 || delay < mMinDelay) {
+        return BAD_VALUE;
+    }
+    mMaxDelay = delay;
+    update();
+    return NO_ERROR;
+}
+
+status_t StandbyPolicy::setMaxPeriodRatio(uint32_t ratio)
+{
+    if (ratio < 2) {
+        return BAD_VALUE;
+    }
+    mMaxPeriodRatio = ratio;
+    return NO_ERROR;
+}
+
+nsecs_t StandbyPolicy::gapPercentile(uint32_t percent) const
+{
+    nsecs_t gaps[kNumGaps];
+    int count = mGapCount;
+
+    if (count == 0) return 0;
+    // insertion sort, the history is small
+    for (int i = 0; i < count; i++) {
+        nsecs_t gap = mGaps[i];
+        int j = i;
+        while (j > 0 && gaps[j - 1] > gap) {
+            gaps[j] = gaps[j - 1];
+            j--;
+        }
+        gaps[j] = gap;
+    }
+    int index = (count * percent + 99) / 100 - 1;
+    if (index < 0) index = 0;
+    return gaps[index];
+}
+
+void StandbyPolicy::update()
+{
+    mDelay = mFixedDelay;
+    mShortGaps = false;
+    if (mMode == FIXED || mGapCount < kMinGaps) {
+        return;
+    }
+
+    mShortGaps = gapPercentile(50) < 4 * mPeriod;
+
+    // stay out of standby long enough to bridge most gaps, as leaving standby
+    // is expensive until measured otherwise. The minimum delay is used when it
+    // is cheap, or when the gaps are so long that the output would mostly
+    // write silence.
+    nsecs_t target = gapPercentile(90) + mPeriod;
+    bool cheapExit = (mNumStandbyExits != 0 && mExitCost < mPeriod);
+    if (cheapExit || target > mMaxDelay || target < mMinDelay) {
+        mDelay = mMinDelay;
+    } else {
+        mDelay = target;
+    }
+}
+
+void StandbyPolicy::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "Standby policy: %s, delay %llu msecs (default %llu, min %llu, max %llu), max period ratio %u\n",
+            (mMode == ADAPTIVE) ? "adaptive" : "fixed", ns2ms(mDelay),
+            ns2ms(mFixedDelay), ns2ms(mMinDelay), ns2ms(mMaxDelay), mMaxPeriodRatio);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "  standby exits: %d, exit cost %llu usecs, idle gaps: %d, p50 %llu msecs, p90 %llu msecs, short gaps: %d\n",
+            mNumStandbyExits, ns2us(mExitCost), mGapCount,
+            ns2ms(gapPercentile(50)), ns2ms(gapPercentile(90)), mShortGaps);
+    result.append(buffer);
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_STANDBY_POLICY_H
+#define ANDROID_AUDIO_STANDBY_POLICY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Decides how long a mixer output stays out of standby once idle. In fixed
+ * mode the delay is the default one. In adaptive mode, once a few idle gaps
+ * between tracks were seen, the delay follows them and the observed cost of
+ * leaving standby, between a minimum and a maximum around the default: when
+ * leaving standby is expensive, gaps short enough to be covered are bridged by
+ * writing silence. When it is cheap, or when the gaps are too long to be
+ * bridged, the output enters standby after the minimum delay.
+ */
+class StandbyPolicy
+{
+public:
+    enum policy_mode {
+        FIXED,
+        ADAPTIVE
+    };
+
+                        StandbyPolicy(nsecs_t delay);
+
+            void        setPeriod(nsecs_t period) { mPeriod = period; }
+            nsecs_t     standbyDelay() const { return mDelay; }
+            uint32_t    idleSleepTimeUs(uint32_t defaultUs, uint32_t activeUs) const;
+            nsecs_t     maxPeriod() const { return mPeriod * mMaxPeriodRatio; }
+
+            // events reported by the playback thread
+            void        onIdle(nsecs_t now);
+            void        onActive(nsecs_t now);
+            void        onStandbyExit(nsecs_t writeDuration);
+
+            // configuration, a value out of range returns BAD_VALUE and
+            // changes nothing. The default delay is also the one of fixed mode.
+            status_t    setMode(int mode);
+            status_t    setDelay(nsecs_t delay);
+            status_t    setMinDelay(nsecs_t delay);
+            status_t    setMaxDelay(nsecs_t delay);
+            status_t    setMaxPeriodRatio(uint32_t ratio);
+
+            void        dump(String8& result) const;
+
+private:
+            void        update();
+            nsecs_t     gapPercentile(uint32_t percent) const;
+
+    static const int    kNumGaps = 16;
+
+    int                 mMode;
+    nsecs_t             mPeriod;
+    nsecs_t             mFixedDelay;
+    nsecs_t             mMinDelay;
+    nsecs_t             mMaxDelay;
+    nsecs_t             mDelay;
+    uint32_t            mMaxPeriodRatio;
+    // idle gaps between the last track stopping and the next one starting
+    bool                mIdle;
+    nsecs_t             mIdleStart;
+    nsecs_t             mGaps[kNumGaps];
+    int                 mGapIndex;
+    int                 mGapCount;
+    // smoothed extra latency of the first write after standby
+    nsecs_t             mExitCost;
+    int                 mNumStandbyExits;
+    bool                mShortGaps;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_STANDBY_POLICY_H
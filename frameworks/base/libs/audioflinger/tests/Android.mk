@@ -0,0 +1,182 @@
+LOCAL_PATH:= $(call my-dir)
+
+# Bit-exactness of the vectorized mixer kernels against the C versions.
+# Built for the device (NEON) and for the host (SSE2).
+simd_test_src_files := \
+    audiomixer_simd_test.cpp \
+    ../AudioMixerSimd.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(simd_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_SHARED_LIBRARIES := libcutils libutils
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+    LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+
+LOCAL_MODULE := audiomixer_simd_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(simd_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_CFLAGS += -msse2
+LOCAL_STATIC_LIBRARIES := libutils libcutils
+LOCAL_LDLIBS += -lpthread
+
+LOCAL_MODULE := audiomixer_simd_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Wake up latency of the OutputTrack futex handoff against the cblk condition.
+# Built for the device and for the host.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := cblk_handoff_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_SHARED_LIBRARIES := libcutils libutils
+
+LOCAL_MODULE := cblk_handoff_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := cblk_handoff_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := libutils libcutils
+LOCAL_LDLIBS += -lpthread
+
+LOCAL_MODULE := cblk_handoff_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Standby delay chosen by the adaptive policy for synthetic idle gaps and
+# standby exit costs. Built for the device and for the host.
+standby_test_src_files := \
+    standby_policy_test.cpp \
+    ../StandbyPolicy.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(standby_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_SHARED_LIBRARIES := libcutils libutils
+
+LOCAL_MODULE := standby_policy_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(standby_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := libutils libcutils
+LOCAL_LDLIBS += -lpthread
+
+LOCAL_MODULE := standby_policy_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Programs running a standalone AudioFlinger on the stub audio HAL, without
+# an audio device or a policy service. They run on the device and in
+# simulator builds, which are native host processes.
+audioflinger_test_shared_libraries := \
+    libaudioflinger \
+    libcutils \
+    libutils \
+    libbinder \
+    libmedia \
+    libhardware_legacy
+
+# AudioFlinger.h must see the configuration libaudioflinger was built with
+audioflinger_test_cflags :=
+audioflinger_test_c_includes := $(LOCAL_PATH)/..
+ifeq ($(BOARD_HAVE_BLUETOOTH),true)
+  audioflinger_test_cflags += -DWITH_BLUETOOTH -DWITH_A2DP
+endif
+ifeq ($(BOARD_HAVE_FM_RADIO),true)
+  audioflinger_test_cflags += -DHAVE_FM_RADIO
+endif
+ifeq ($(BOARD_USE_LVMX),true)
+  audioflinger_test_cflags += -DLVMX
+  audioflinger_test_c_includes += vendor/nxp
+endif
+
+audioflinger_test_ldlibs :=
+ifeq ($(TARGET_SIMULATOR),true)
+    ifeq ($(HOST_OS),linux)
+        audioflinger_test_ldlibs += -lrt -lpthread -lm
+    endif
+endif
+
+# MixerThread throughput and per-period timings
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := audioflinger_bench.cpp
+LOCAL_C_INCLUDES := $(audioflinger_test_c_includes)
+LOCAL_CFLAGS := $(audioflinger_test_cflags)
+LOCAL_SHARED_LIBRARIES := $(audioflinger_test_shared_libraries)
+LOCAL_STATIC_LIBRARIES := libaudiointerface
+LOCAL_LDLIBS := $(audioflinger_test_ldlibs)
+
+LOCAL_MODULE := audioflinger_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# DuplicatingThread output identity and copy volume
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := duplicating_test.cpp
+LOCAL_C_INCLUDES := $(audioflinger_test_c_includes)
+LOCAL_CFLAGS := $(audioflinger_test_cflags)
+LOCAL_SHARED_LIBRARIES := $(audioflinger_test_shared_libraries)
+LOCAL_STATIC_LIBRARIES := libaudiointerface
+LOCAL_LDLIBS := $(audioflinger_test_ldlibs)
+
+LOCAL_MODULE := duplicating_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# Periods mixed by MixerThread and by the worker pool outside AudioMixer
+# against AudioMixer::process() for the same tracks, AudioDSP and dithering
+# included
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := direct_mix_test.cpp
+LOCAL_C_INCLUDES := $(audioflinger_test_c_includes)
+LOCAL_CFLAGS := $(audioflinger_test_cflags)
+LOCAL_SHARED_LIBRARIES := $(audioflinger_test_shared_libraries)
+LOCAL_LDLIBS := $(audioflinger_test_ldlibs)
+
+LOCAL_MODULE := direct_mix_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# AudioHardwareGeneric on a fifo looping the output back to the input, in the
+# blocking and poll I/O modes
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := generic_loopback_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_SHARED_LIBRARIES := libcutils libutils libbinder libmedia libhardware_legacy
+LOCAL_STATIC_LIBRARIES := libaudiointerface
+LOCAL_LDLIBS := $(audioflinger_test_ldlibs)
+
+LOCAL_MODULE := generic_loopback_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives a MixerThread against the stub audio HAL without an audio device or
+// a policy service: looping static tracks are mixed as fast as the sink takes
+// them and the per-period timings of the thread are reported at the end.
+//
+// usage: audioflinger_bench [-n tracks] [-s seconds] [-o sink] [-m] [-r] [-S]
+//   -n  number of tracks, 8 by default, the largest count with -S
+//   -s  measured duration, 10 seconds by default
+//   -o  stub sink: "null" (default) discards the output, a path writes it
+//   -m  every other track is mono
+//   -r  the tracks cycle through sample rates other than the output rate
+//   -S  report the prepare and mix stages of the period for 1, 2, 4... tracks
+//       up to the -n count, each on a new output
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryDealer.h>
+#include <media/AudioSystem.h>
+#include <media/IAudioTrack.h>
+#include <private/media/AudioTrackShared.h>
+#include <utils/String16.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "AudioFlinger.h"
+#include "AudioHardwareStub.h"
+#include "AudioHardwareWrapper.h"
+
+using namespace android;
+
+// length of the looped buffer of each track
+static const size_t kTrackFrames = 4096;
+// the mixer is left to settle before the histograms are reset
+static const int kWarmupSeconds = 1;
+
+static const uint32_t kRates[] = { 44100, 48000, 22050, 32000, 11025 };
+
+struct bench_config_t {
+    int tracks;
+    int seconds;
+    const char* sink;
+    bool mono;
+    bool resample;
+    bool sweep;
+};
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-n tracks] [-s seconds] [-o sink] [-m] [-r] [-S]\n", name);
+}
+
+static void dump(const sp<AudioFlinger>& af, int fd, bool resetLatency)
+{
+    Vector<String16> args;
+    if (resetLatency) {
+        args.add(String16("--reset-latency"));
+    }
+    af->dump(fd, args);
+}
+
+// a looping static track playing a sine wave at full scale
+static sp<IAudioTrack> createTrack(const sp<AudioFlinger>& af, int output,
+        const sp<MemoryDealer>& dealer, uint32_t sampleRate, int channelCount,
+        int index)
+{
+    size_t frameSize = channelCount * sizeof(int16_t);
+    sp<IMemory> buffer = dealer->allocate(kTrackFrames * frameSize);
+    if (buffer == 0) {
+        return 0;
+    }
+    int16_t* samples = static_cast<int16_t*>(buffer->pointer());
+    double step = 2 * M_PI * (220.0 * (index + 1)) / sampleRate;
+    for (size_t i = 0; i < kTrackFrames; i++) {
+        int16_t sample = (int16_t)(32767 * sin(step * i));
+        for (int c = 0; c < channelCount; c++) {
+            samples[i * channelCount + c] = sample;
+        }
+    }
+
+    status_t status;
+    sp<IAudioTrack> track = af->createTrack(getpid(), AudioSystem::MUSIC, sampleRate,
+            AudioSystem::PCM_16_BIT, channelCount, kTrackFrames, 0, buffer, output,
+            &status);
+    if (track == 0) {
+        fprintf(stderr, "createTrack failed: %d\n", status);
+        return 0;
+    }
+
+    // what AudioTrack::set() and setLoop() do for a static track
+    audio_track_cblk_t* cblk = static_cast<audio_track_cblk_t*>(track->getCblk()->pointer());
+    cblk->buffers = buffer->pointer();
+    cblk->volumeLR = (0x1000 << 16) | 0x1000;
+    cblk->loopStart = 0;
+    cblk->loopEnd = kTrackFrames;
+    cblk->loopCount = -1;
+    cblk->stepUser(kTrackFrames);
+    return track;
+}
+
+// Plays the given number of tracks on a new output, dumps AudioFlinger to fd
+// after the measured duration and closes the output. Returns the process CPU
+// load in percent, or -1 on error.
+static int run(const sp<AudioFlinger>& af, const bench_config_t& config, int numTracks,
+        int fd)
+{
+    uint32_t devices = AudioSystem::DEVICE_OUT_SPEAKER;
+    uint32_t sampleRate = 44100;
+    uint32_t format = AudioSystem::PCM_16_BIT;
+    uint32_t channels = AudioSystem::CHANNEL_OUT_STEREO;
+    uint32_t latency = 0;
+    int output = af->openOutput(&devices, &sampleRate, &format, &channels, &latency, 0);
+    if (output == 0) {
+        fprintf(stderr, "openOutput failed\n");
+        return -1;
+    }
+
+    sp<MemoryDealer> dealer = new MemoryDealer(
+            numTracks * kTrackFrames * 2 * sizeof(int16_t) + 4096, "audioflinger_bench");
+    Vector< sp<IAudioTrack> > tracks;
+    for (int i = 0; i < numTracks; i++) {
+        uint32_t rate = config.resample ?
+                kRates[i % (sizeof(kRates) / sizeof(kRates[0]))] : sampleRate;
+        int channelCount = (config.mono && (i & 1)) ? 1 : 2;
+        sp<IAudioTrack> track = createTrack(af, output, dealer, rate, channelCount, i);
+        if (track == 0) {
+            af->closeOutput(output);
+            return -1;
+        }
+        track->start();
+        tracks.add(track);
+    }
+
+    sleep(kWarmupSeconds);
+    int nullFd = open("/dev/null", O_WRONLY);
+    dump(af, nullFd, true);
+    close(nullFd);
+
+    nsecs_t wallStart = systemTime();
+    nsecs_t cpuStart = systemTime(SYSTEM_TIME_PROCESS);
+    sleep(config.seconds);
+    nsecs_t cpuTime = systemTime(SYSTEM_TIME_PROCESS) - cpuStart;
+    nsecs_t wallTime = systemTime() - wallStart;
+
+    // the histograms and the stub sink statistics of the output
+    dump(af, fd, false);
+
+    for (size_t i = 0; i < tracks.size(); i++) {
+        tracks[i]->stop();
+    }
+    tracks.clear();
+    af->closeOutput(output);
+    return (int)(cpuTime * 100 / wallTime);
+}
+
+// finds the "  <stage> count p50 p99 max" line of the period latency table
+static bool findStage(FILE* dump, const char* stage, uint32_t* count, uint32_t* p50,
+        uint32_t* p99, uint32_t* max)
+{
+    char line[256];
+    char name[16];
+    rewind(dump);
+    while (fgets(line, sizeof(line), dump) != NULL) {
+        if (sscanf(line, " %15s %u %u %u %u", name, count, p50, p99, max) == 5 &&
+                strcmp(name, stage) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// prepare cost against the number of active tracks, one new output per step
+static int sweep(const sp<AudioFlinger>& af, const bench_config_t& config)
+{
+    printf("period latency (usecs) against track count:\n");
+    printf("  tracks  periods  prepare p50     p99     max   mix p50     p99  cpu\n");
+    for (int numTracks = 1; numTracks <= config.tracks; numTracks *= 2) {
+        FILE* dump = tmpfile();
+        if (dump == NULL) {
+            return 1;
+        }
+        int load = run(af, config, numTracks, fileno(dump));
+        fflush(dump);
+        uint32_t count, prepare50, prepare99, prepareMax, mixCount, mix50, mix99, mixMax;
+        if (load < 0 ||
+                !findStage(dump, "prepare", &count, &prepare50, &prepare99, &prepareMax) ||
+                !findStage(dump, "mix", &mixCount, &mix50, &mix99, &mixMax)) {
+            fclose(dump);
+            return 1;
+        }
+        fclose(dump);
+        printf("  %6d %8u  %11u %7u %7u %9u %7u %3d%%\n", numTracks, count,
+                prepare50, prepare99, prepareMax, mix50, mix99, load);
+        if (numTracks < config.tracks && numTracks * 2 > config.tracks) {
+            // always end with the requested count
+            numTracks = config.tracks / 2;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    bench_config_t config = { 8, 10, "null", false, false, false };
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:o:mrS")) != -1) {
+        switch (opt) {
+        case 'n':
+            config.tracks = atoi(optarg);
+            break;
+        case 's':
+            config.seconds = atoi(optarg);
+            break;
+        case 'o':
+            config.sink = optarg;
+            break;
+        case 'm':
+            config.mono = true;
+            break;
+        case 'r':
+            config.resample = true;
+            break;
+        case 'S':
+            config.sweep = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.tracks <= 0 || config.tracks > 32 || config.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sp<AudioFlinger> af = AudioFlinger::createStandalone(
+            AudioHardwareWrapper::create(new AudioHardwareStub(config.sink)));
+
+    printf("%s%d tracks (%s, %s) mixed to 44100 Hz stereo, sink %s, %d seconds%s\n",
+            config.sweep ? "1 to " : "", config.tracks,
+            config.mono ? "mono and stereo" : "stereo",
+            config.resample ? "resampled" : "at the output rate",
+            config.sink, config.seconds, config.sweep ? " each" : "");
+
+    if (config.sweep) {
+        return sweep(af, config);
+    }
+    int load = run(af, config, config.tracks, STDOUT_FILENO);
+    if (load < 0) {
+        return 1;
+    }
+    printf("process CPU load: %d%%\n", load);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the kernels selected by AudioMixerSimd::init() produce exactly
+// the output of the portable C versions, for all lengths up to a few vector
+// blocks, unaligned buffers and full scale or saturating inputs.
+//
+// usage: audiomixer_simd_test [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AudioMixerSimd.h"
+
+using namespace android;
+
+// the longest run tested, in frames, and the largest misalignment in samples
+static const size_t kMaxFrames = 67;
+static const size_t kMaxOffset = 3;
+static const size_t kBufferSamples = (kMaxFrames + kMaxOffset) * 2;
+
+static uint32_t sSeed = 1;
+static int sFailures = 0;
+
+static uint32_t nextRandom()
+{
+    sSeed = sSeed * 1103515245 + 12345;
+    return sSeed;
+}
+
+// samples are often at full scale so that the saturating paths are covered
+static int16_t randomSample()
+{
+    switch (nextRandom() % 8) {
+    case 0:
+        return 32767;
+    case 1:
+        return -32768;
+    default:
+        return (int16_t)(nextRandom() >> 16);
+    }
+}
+
+static void fillSamples(int16_t* buffer, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = randomSample();
+    }
+}
+
+static void fillSums(int32_t* buffer, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        // a mix of many full scale tracks, in 4.12
+        buffer[i] = (int32_t)nextRandom() >> (nextRandom() % 8);
+    }
+}
+
+static void check(const char* kernel, size_t frames, size_t offset,
+        const void* expected, const void* actual, size_t bytes)
+{
+    if (memcmp(expected, actual, bytes) != 0) {
+        printf("FAIL %s: %d frames at offset %d\n", kernel, (int)frames, (int)offset);
+        sFailures++;
+    }
+}
+
+static void testVolumeStereo16(size_t frames, size_t offset)
+{
+    int16_t in[kBufferSamples];
+    int32_t expected[kBufferSamples];
+    int32_t actual[kBufferSamples];
+    // unity gain is the most common volume, any int16 must work though
+    int16_t vl = (nextRandom() & 1) ? 0x1000 : randomSample();
+    int16_t vr = (nextRandom() & 1) ? 0x1000 : randomSample();
+
+    fillSamples(in, kBufferSamples);
+    fillSums(expected, kBufferSamples);
+    for (size_t i = 0; i < kBufferSamples; i++) {
+        expected[i] >>= 4;
+    }
+    memcpy(actual, expected, sizeof(actual));
+
+    AudioMixerSimd::volumeStereo16_C(expected + offset, in + offset, frames, vl, vr);
+    AudioMixerSimd::volumeStereo16(actual + offset, in + offset, frames, vl, vr);
+    check("volumeStereo16", frames, offset, expected, actual, sizeof(actual));
+}
+
+static void testClampStereo16(size_t frames, size_t offset)
+{
+    int32_t sums[kBufferSamples];
+    int32_t expected[kBufferSamples];
+    int32_t actual[kBufferSamples];
+
+    fillSums(sums, kBufferSamples);
+    memset(expected, 0x55, sizeof(expected));
+    memset(actual, 0x55, sizeof(actual));
+
+    AudioMixerSimd::clampStereo16_C(expected + offset, sums + offset, frames);
+    AudioMixerSimd::clampStereo16(actual + offset, sums + offset, frames);
+    check("clampStereo16", frames, offset, expected, actual, sizeof(actual));
+}
+
+static void testUpmixMono16(size_t frames, size_t offset)
+{
+    int16_t in[kBufferSamples];
+    int16_t expected[kBufferSamples * 2];
+    int16_t actual[kBufferSamples * 2];
+
+    fillSamples(in, kBufferSamples);
+    memset(expected, 0x55, sizeof(expected));
+    memset(actual, 0x55, sizeof(actual));
+
+    AudioMixerSimd::upmixMono16_C(expected + offset, in + offset, frames);
+    AudioMixerSimd::upmixMono16(actual + offset, in + offset, frames);
+    check("upmixMono16", frames, offset, expected, actual, sizeof(actual));
+}
+
+static void testDownmixStereo16(size_t frames, size_t offset)
+{
+    int16_t in[kBufferSamples];
+    int16_t expected[kBufferSamples];
+    int16_t actual[kBufferSamples];
+
+    fillSamples(in, kBufferSamples);
+    memset(expected, 0x55, sizeof(expected));
+    memset(actual, 0x55, sizeof(actual));
+
+    AudioMixerSimd::downmixStereo16_C(expected + offset, in + offset, frames);
+    AudioMixerSimd::downmixStereo16(actual + offset, in + offset, frames);
+    check("downmixStereo16", frames, offset, expected, actual, sizeof(actual));
+}
+
+// the fused kernel against the two passes it replaces
+static void testClampDownmixStereo16(size_t frames, size_t offset)
+{
+    int32_t sums[kBufferSamples];
+    int32_t clamped[kBufferSamples];
+    int16_t expected[kBufferSamples];
+    int16_t actual[kBufferSamples];
+    int16_t actualC[kBufferSamples];
+
+    fillSums(sums, kBufferSamples);
+    memset(expected, 0x55, sizeof(expected));
+    memset(actual, 0x55, sizeof(actual));
+    memset(actualC, 0x55, sizeof(actualC));
+
+    AudioMixerSimd::clampStereo16_C(clamped, sums + offset, frames);
+    AudioMixerSimd::downmixStereo16_C(expected + offset, (int16_t *)clamped, frames);
+    AudioMixerSimd::clampDownmixStereo16_C(actualC + offset, sums + offset, frames);
+    AudioMixerSimd::clampDownmixStereo16(actual + offset, sums + offset, frames);
+    check("clampDownmixStereo16_C", frames, offset, expected, actualC, sizeof(actualC));
+    check("clampDownmixStereo16", frames, offset, expected, actual, sizeof(actual));
+}
+
+static void testDotProduct16(size_t frames, size_t offset)
+{
+    int16_t x[kBufferSamples];
+    int16_t h[kBufferSamples];
+    // the FIR lengths are multiples of 8 and the coefficients are scaled so
+    // that the sum does not overflow
+    size_t count = (frames * 2) & ~7;
+
+    fillSamples(x, kBufferSamples);
+    for (size_t i = 0; i < kBufferSamples; i++) {
+        h[i] = (int16_t)(nextRandom() >> 16) >> 3;
+    }
+
+    int32_t expected = AudioMixerSimd::dotProduct16_C(x + offset, h + offset, count);
+    int32_t actual = AudioMixerSimd::dotProduct16(x + offset, h + offset, count);
+    check("dotProduct16", frames, offset, &expected, &actual, sizeof(actual));
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 100;
+
+    AudioMixerSimd::init();
+    printf("testing %s kernels against c, %d iterations\n",
+            AudioMixerSimd::implName(), iterations);
+    if (AudioMixerSimd::impl() == AudioMixerSimd::IMPL_C) {
+        printf("no vector unit, the c kernels are compared with themselves\n");
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        for (size_t frames = 0; frames <= kMaxFrames; frames++) {
+            for (size_t offset = 0; offset <= kMaxOffset; offset++) {
+                testVolumeStereo16(frames, offset);
+                testClampStereo16(frames, offset);
+                testUpmixMono16(frames, offset);
+                testDownmixStereo16(frames, offset);
+                testClampDownmixStereo16(frames, offset);
+                testDotProduct16(frames, offset);
+            }
+        }
+    }
+
+    if (sFailures != 0) {
+        printf("%d failures\n", sFailures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
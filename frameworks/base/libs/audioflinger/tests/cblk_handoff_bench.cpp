@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the two ways a full OutputTrack waits for the output mixer to
+// consume frames: the cblk condition used before, a mutex and a condition
+// variable with a timeout in milliseconds, and the futex word of
+// OutputTrack::obtainBuffer(), which the mixer only wakes while a writer is
+// registered.
+//
+// A writer thread waits for each step of the server position while the main
+// thread, standing for the output mixer, steps it once per period. Reported:
+//   - latency from the step to the writer resuming
+//   - cost of a step for the mixer, with and without a writer waiting
+// Fails if the futex protocol loses a wake up, i.e. a wait ends on its timeout.
+//
+// Only the OutputTrack handoff between the duplicating thread and an output
+// mixer uses the futex. The client AudioTrack::obtainBuffer() and the cblk
+// condition it waits on belong to libmedia, which is not converted: these
+// numbers do not apply to client wake ups.
+//
+// usage: cblk_handoff_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <utils/Atomic.h>
+#include <utils/Timers.h>
+#include <utils/threads.h>
+
+#include "AudioSync.h"
+
+using namespace android;
+
+// time between two steps, the writer is asleep when the step happens
+static const useconds_t kPeriodUs = 1000;
+// wait timeout of the writer: a wait ending on it lost a wake up
+static const uint32_t kWaitTimeMs = 100;
+// steps timed without a writer waiting
+static const int kIdleSteps = 100000;
+
+// the part of audio_track_cblk_t and OutputTrack used by each protocol
+struct handoff_t {
+    // cblk condition
+    Mutex               lock;
+    Condition           cv;
+    // OutputTrack futex word and registered writers
+    volatile int32_t    seq;
+    volatile int32_t    waiters;
+
+    volatile int32_t    server;
+    volatile nsecs_t    wakeTime;
+    bool                useFutex;
+    int                 iterations;
+    nsecs_t*            latencies;
+    int                 timeouts;
+};
+
+// the mixer side: steps the server position and wakes up the writer
+static void step(handoff_t* h)
+{
+    if (h->useFutex) {
+        h->wakeTime = systemTime();
+        audioReleaseStore(h->server + 1, &h->server);
+        android_atomic_inc(&h->seq);
+        audioMemoryBarrier();
+        if (h->waiters != 0) {
+            futexWake(&h->seq, 1);
+        }
+    } else {
+        Mutex::Autolock _l(h->lock);
+        h->server++;
+        h->wakeTime = systemTime();
+        h->cv.signal();
+    }
+}
+
+// the writer side: returns once server moved past last, false on timeout
+static bool waitStep(handoff_t* h, int32_t last)
+{
+    nsecs_t deadline = systemTime() + milliseconds(kWaitTimeMs);
+    if (h->useFutex) {
+        // seq is read before the position, see OutputTrack::obtainBuffer()
+        int32_t seq = audioAcquireLoad(&h->seq);
+        while (audioAcquireLoad(&h->server) == last) {
+            nsecs_t now = systemTime();
+            if (now >= deadline) {
+                return false;
+            }
+            android_atomic_inc(&h->waiters);
+            audioMemoryBarrier();
+            futexWait(&h->seq, seq, deadline - now);
+            android_atomic_dec(&h->waiters);
+            seq = audioAcquireLoad(&h->seq);
+        }
+        return true;
+    }
+    Mutex::Autolock _l(h->lock);
+    while (h->server == last) {
+        if (h->cv.waitRelative(h->lock, milliseconds(kWaitTimeMs)) != NO_ERROR) {
+            return h->server != last;
+        }
+    }
+    return true;
+}
+
+static void* writerThread(void* cookie)
+{
+    handoff_t* h = (handoff_t*)cookie;
+    int32_t last = 0;
+    for (int i = 0; i < h->iterations; i++) {
+        if (!waitStep(h, last)) {
+            h->timeouts++;
+        } else {
+            h->latencies[i] = systemTime() - h->wakeTime;
+        }
+        last = h->server;
+    }
+    return NULL;
+}
+
+static int compareLatency(const void* a, const void* b)
+{
+    nsecs_t x = *(const nsecs_t*)a;
+    nsecs_t y = *(const nsecs_t*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+// runs one protocol, returns the number of lost wake ups
+static int run(bool useFutex, int iterations)
+{
+    handoff_t* h = new handoff_t;
+    h->seq = 0;
+    h->waiters = 0;
+    h->server = 0;
+    h->wakeTime = 0;
+    h->useFutex = useFutex;
+    h->iterations = iterations;
+    h->latencies = new nsecs_t[iterations];
+    memset(h->latencies, 0, iterations * sizeof(nsecs_t));
+    h->timeouts = 0;
+
+    // step cost when nobody waits, the common case for the mixer
+    nsecs_t start = systemTime();
+    for (int i = 0; i < kIdleSteps; i++) {
+        step(h);
+    }
+    nsecs_t idleCost = (systemTime() - start) / kIdleSteps;
+    h->server = 0;
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, writerThread, h);
+    nsecs_t stepCost = 0;
+    for (int i = 0; i < iterations; i++) {
+        usleep(kPeriodUs);
+        nsecs_t t = systemTime();
+        step(h);
+        stepCost += systemTime() - t;
+    }
+    pthread_join(writer, NULL);
+
+    qsort(h->latencies, iterations, sizeof(nsecs_t), compareLatency);
+    printf("  %-10s %9d %7lld %7lld %7lld %9lld %9lld %8d\n",
+            useFutex ? "futex" : "condition", iterations,
+            (long long)ns2us(h->latencies[iterations / 2]),
+            (long long)ns2us(h->latencies[(iterations * 99) / 100]),
+            (long long)ns2us(h->latencies[iterations - 1]),
+            (long long)(stepCost / iterations), (long long)idleCost, h->timeouts);
+
+    int timeouts = h->timeouts;
+    delete[] h->latencies;
+    delete h;
+    return timeouts;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("step to resume latency (usecs) and mixer step cost (nsecs), "
+            "one step every %u usecs:\n", kPeriodUs);
+    printf("  protocol   handoffs     p50     p99     max   waiting      idle timeouts\n");
+    run(false, iterations);
+    int lost = run(true, iterations);
+    if (lost != 0) {
+        printf("FAIL %d wake ups lost by the futex protocol\n", lost);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Mixes the same tracks with AudioMixer::process() and the two ways MixerThread
+// mixes a direct period: AudioMixerPool::mixJob() into a 4.12 accumulator, and
+// half of the tracks mixed by the worker pool and added to it by finish(). The
+// accumulator then goes through AudioMixerPool::processOutput(). Each side has
+// its own AudioDSP with the same parameters. The tracks are loud enough to clip
+// and change volume during the test, and the three outputs must be identical.
+//
+// usage: direct_mix_test [dsp parameters]
+//   the parameters are passed to AudioDSP::setParameters() on both sides
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <media/AudioSystem.h>
+#include <utils/String8.h>
+
+#include "AudioBufferProvider.h"
+#include "AudioDSP.h"
+#include "AudioMixer.h"
+#include "AudioMixerPool.h"
+
+using namespace android;
+
+static const size_t kFrameCount = 1024;
+static const uint32_t kSampleRate = 44100;
+static const int kPeriods = 50;
+// the volumes change at this period, AudioMixer then ramps them
+static const int kRampPeriod = 20;
+static const int kPoolWorkers = 2;
+
+// the ways a period is mixed outside AudioMixer
+enum {
+    DIRECT,
+    POOLED,
+    NUM_PATHS
+};
+static const char* kPathNames[NUM_PATHS] = { "direct", "pooled" };
+
+struct TrackConfig {
+    int     channelCount;
+    int16_t volume[2];
+    int16_t rampVolume[2];
+    // largest number of frames returned by a getNextBuffer()
+    size_t  maxFrames;
+};
+
+static const TrackConfig kTracks[] = {
+    { 2, { 0x1000, 0x1000 }, { 0x0800, 0x1000 }, 4096 },
+    { 1, { 0x0c00, 0x0400 }, { 0x0c00, 0x0400 }, 160 },
+    { 2, { 0x1000, 0x0000 }, { 0x0200, 0x0e00 }, 333 },
+    { 1, { 0x0100, 0x0100 }, { 0x1000, 0x1000 }, 1024 },
+};
+static const size_t kNumTracks = sizeof(kTracks) / sizeof(kTracks[0]);
+
+// pseudo random full scale samples, the same sequence for a given seed
+class NoiseProvider : public AudioBufferProvider
+{
+public:
+    NoiseProvider(uint32_t seed, int channelCount, size_t maxFrames)
+        : mSeed(seed), mChannelCount(channelCount), mMaxFrames(maxFrames) {}
+
+    virtual status_t getNextBuffer(Buffer* buffer) {
+        size_t frames = buffer->frameCount;
+        if (frames > mMaxFrames) {
+            frames = mMaxFrames;
+        }
+        for (size_t i = 0; i < frames * mChannelCount; i++) {
+            mSeed = mSeed * 1103515245 + 12345;
+            mBuffer[i] = (int16_t)(mSeed >> 16);
+        }
+        buffer->i16 = mBuffer;
+        buffer->frameCount = frames;
+        return NO_ERROR;
+    }
+    virtual void releaseBuffer(Buffer* buffer) {
+        buffer->raw = 0;
+        buffer->frameCount = 0;
+    }
+
+private:
+    uint32_t    mSeed;
+    int         mChannelCount;
+    size_t      mMaxFrames;
+    int16_t     mBuffer[kFrameCount * 2];
+};
+
+int main(int argc, char** argv)
+{
+    String8 dspParameters(argc > 1 ? argv[1] : "");
+    AudioDSP mixerDsp;
+    AudioDSP dsp[NUM_PATHS];
+    if (dspParameters.length() != 0) {
+        mixerDsp.setParameters(dspParameters);
+        for (int p = 0; p < NUM_PATHS; p++) {
+            dsp[p].setParameters(dspParameters);
+        }
+    }
+
+    AudioMixerPool* pool = new AudioMixerPool(kFrameCount, kPoolWorkers);
+    if (pool->initCheck() != NO_ERROR) {
+        printf("FAIL cannot start the worker pool\n");
+        delete pool;
+        return 1;
+    }
+
+    AudioMixer* mixer = new AudioMixer(kFrameCount, kSampleRate, mixerDsp);
+    NoiseProvider* mixerTracks[kNumTracks];
+    NoiseProvider* tracks[NUM_PATHS][kNumTracks];
+    AudioMixerPool::Job jobs[NUM_PATHS][kNumTracks];
+    int names[kNumTracks];
+    for (size_t i = 0; i < kNumTracks; i++) {
+        const TrackConfig& config = kTracks[i];
+        mixerTracks[i] = new NoiseProvider(i + 1, config.channelCount, config.maxFrames);
+
+        names[i] = mixer->getTrackName();
+        mixer->setActiveTrack(names[i]);
+        mixer->setBufferProvider(mixerTracks[i]);
+        mixer->setParameter(AudioMixer::TRACK, AudioMixer::FORMAT, AudioSystem::PCM_16_BIT);
+        mixer->setParameter(AudioMixer::TRACK, AudioMixer::CHANNEL_COUNT, config.channelCount);
+        mixer->setParameter(AudioMixer::RESAMPLE, AudioMixer::SAMPLE_RATE, kSampleRate);
+        mixer->setParameter(AudioMixer::VOLUME, AudioMixer::VOLUME0, config.volume[0]);
+        mixer->setParameter(AudioMixer::VOLUME, AudioMixer::VOLUME1, config.volume[1]);
+        mixer->enable(AudioMixer::MIXING);
+
+        for (int p = 0; p < NUM_PATHS; p++) {
+            tracks[p][i] = new NoiseProvider(i + 1, config.channelCount, config.maxFrames);
+            AudioMixerPool::Job& job = jobs[p][i];
+            job.provider = tracks[p][i];
+            job.resampler = NULL;
+            job.channelCount = config.channelCount;
+            job.volume[0] = job.prevVolume[0] = config.volume[0];
+            job.volume[1] = job.prevVolume[1] = config.volume[1];
+        }
+    }
+
+    int16_t mixerOut[kFrameCount * 2];
+    int16_t out[kFrameCount * 2];
+    int32_t sums[kFrameCount * 2];
+    int32_t temp[kFrameCount * 2];
+    dither_t dither[NUM_PATHS];
+    memset(dither, 0, sizeof(dither));
+    int failures = 0;
+
+    for (int period = 0; period < kPeriods; period++) {
+        for (size_t i = 0; i < kNumTracks; i++) {
+            for (int p = 0; p < NUM_PATHS; p++) {
+                AudioMixerPool::Job& job = jobs[p][i];
+                job.prevVolume[0] = job.volume[0];
+                job.prevVolume[1] = job.volume[1];
+                if (period == kRampPeriod) {
+                    job.volume[0] = kTracks[i].rampVolume[0];
+                    job.volume[1] = kTracks[i].rampVolume[1];
+                }
+            }
+            if (period == kRampPeriod) {
+                mixer->setActiveTrack(names[i]);
+                mixer->setParameter(AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME0,
+                        kTracks[i].rampVolume[0]);
+                mixer->setParameter(AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME1,
+                        kTracks[i].rampVolume[1]);
+            }
+        }
+
+        mixer->process(mixerOut);
+
+        for (int p = 0; p < NUM_PATHS; p++) {
+            // the pool mixes the odd tracks while this thread mixes the others
+            size_t step = 1;
+            if (p == POOLED) {
+                for (size_t i = 1; i < kNumTracks; i += 2) {
+                    pool->addJob(jobs[p][i]);
+                }
+                pool->start();
+                step = 2;
+            }
+            memset(sums, 0, sizeof(sums));
+            for (size_t i = 0; i < kNumTracks; i += step) {
+                AudioMixerPool::mixJob(jobs[p][i], kFrameCount, sums, temp);
+            }
+            if (p == POOLED) {
+                pool->finish(sums);
+            }
+            AudioMixerPool::processOutput(dsp[p], &dither[p], out, sums, kFrameCount);
+
+            for (size_t i = 0; i < kFrameCount * 2; i++) {
+                if (mixerOut[i] != out[i]) {
+                    printf("FAIL %s period %d sample %u: AudioMixer %d, %s %d\n",
+                            kPathNames[p], period, (unsigned)i, mixerOut[i],
+                            kPathNames[p], out[i]);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+
+    delete mixer;
+    delete pool;
+    for (size_t i = 0; i < kNumTracks; i++) {
+        delete mixerTracks[i];
+        for (int p = 0; p < NUM_PATHS; p++) {
+            delete tracks[p][i];
+        }
+    }
+
+    if (failures != 0) {
+        printf("%d periods differ out of %d per path\n", failures, kPeriods);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Plays a track on a DuplicatingThread over two stub HAL outputs writing to
+// files, then checks that both outputs received the same audio and that the
+// zero-copy path copied fewer frames than mixing and copying to each output.
+//
+// usage: duplicating_test [directory]
+//   the output files are written to directory, /data/local/tmp by default
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryDealer.h>
+#include <media/AudioSystem.h>
+#include <media/IAudioTrack.h>
+#include <private/media/AudioTrackShared.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "AudioFlinger.h"
+#include "AudioHardwareStub.h"
+#include "AudioHardwareWrapper.h"
+
+using namespace android;
+
+static const size_t kTrackFrames = 4096;
+static const int kPlaySeconds = 2;
+// left to the output mixers to drain the output tracks after the stop
+static const useconds_t kDrainUs = 500000;
+
+static int openOutput(const sp<AudioFlinger>& af)
+{
+    uint32_t devices = AudioSystem::DEVICE_OUT_SPEAKER;
+    uint32_t sampleRate = 44100;
+    uint32_t format = AudioSystem::PCM_16_BIT;
+    uint32_t channels = AudioSystem::CHANNEL_OUT_STEREO;
+    uint32_t latency = 0;
+    return af->openOutput(&devices, &sampleRate, &format, &channels, &latency, 0);
+}
+
+// the non silent frames of a stereo 16 bit file: the output mixers insert
+// silence at different places while their output track is empty
+static bool readFrames(const char* path, Vector<uint32_t>* frames)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("FAIL cannot open %s\n", path);
+        return false;
+    }
+    uint32_t buffer[1024];
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (size_t i = 0; i < bytes / sizeof(uint32_t); i++) {
+            if (buffer[i] != 0) {
+                frames->add(buffer[i]);
+            }
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// the first line of the dump starting with key
+static bool findLine(FILE* dump, const char* key, char* line, size_t size)
+{
+    rewind(dump);
+    while (fgets(line, size, dump) != NULL) {
+        if (strncmp(line, key, strlen(key)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    const char* directory = (argc > 1) ? argv[1] : "/data/local/tmp";
+    String8 sink(directory);
+    sink.append("/duplicating_test_%d.raw");
+
+    sp<AudioFlinger> af = AudioFlinger::createStandalone(
+            AudioHardwareWrapper::create(new AudioHardwareStub(sink.string())));
+    int output1 = openOutput(af);
+    int output2 = openOutput(af);
+    int duplicated = (output1 != 0 && output2 != 0) ?
+            af->openDuplicateOutput(output1, output2) : 0;
+    if (duplicated == 0) {
+        printf("FAIL cannot open the outputs\n");
+        return 1;
+    }
+
+    // a looping static track, see audioflinger_bench
+    sp<MemoryDealer> dealer = new MemoryDealer(kTrackFrames * 4 + 4096, "duplicating_test");
+    sp<IMemory> buffer = dealer->allocate(kTrackFrames * 4);
+    int16_t* samples = static_cast<int16_t*>(buffer->pointer());
+    for (size_t i = 0; i < kTrackFrames; i++) {
+        samples[i * 2] = (int16_t)(16384 * sin(2 * M_PI * 441.0 * i / 44100));
+        samples[i * 2 + 1] = (int16_t)(16384 * sin(2 * M_PI * 661.5 * i / 44100));
+    }
+    status_t status;
+    sp<IAudioTrack> track = af->createTrack(getpid(), AudioSystem::MUSIC, 44100,
+            AudioSystem::PCM_16_BIT, 2, kTrackFrames, 0, buffer, duplicated, &status);
+    if (track == 0) {
+        printf("FAIL createTrack: %d\n", status);
+        return 1;
+    }
+    audio_track_cblk_t* cblk = static_cast<audio_track_cblk_t*>(track->getCblk()->pointer());
+    cblk->buffers = buffer->pointer();
+    cblk->volumeLR = (0x1000 << 16) | 0x1000;
+    cblk->loopStart = 0;
+    cblk->loopEnd = kTrackFrames;
+    cblk->loopCount = -1;
+    cblk->stepUser(kTrackFrames);
+
+    track->start();
+    sleep(kPlaySeconds);
+    track->stop();
+    usleep(kDrainUs);
+
+    FILE* dump = tmpfile();
+    Vector<String16> args;
+    af->dump(fileno(dump), args);
+    fflush(dump);
+
+    track.clear();
+    af->closeOutput(duplicated);
+    af->closeOutput(output2);
+    af->closeOutput(output1);
+
+    char line[256];
+    unsigned long long frameCount, directWrites, copiedWrites, copiedFrames;
+    bool found = findLine(dump, "Frame count:", line, sizeof(line)) &&
+            sscanf(line, "Frame count: %llu", &frameCount) == 1 &&
+            findLine(dump, "direct writes:", line, sizeof(line)) &&
+            sscanf(line, "direct writes: %llu, copied writes: %llu",
+                    &directWrites, &copiedWrites) == 2 &&
+            findLine(dump, "frames copied to the output tracks:", line, sizeof(line)) &&
+            sscanf(line, "frames copied to the output tracks: %llu", &copiedFrames) == 1;
+    fclose(dump);
+    if (!found) {
+        printf("FAIL DuplicatingThread dump not found\n");
+        return 1;
+    }
+
+    // mixing then copying copies each period to every output
+    int failures = 0;
+    unsigned long long copyPathFrames = (directWrites + copiedWrites) * frameCount * 2;
+    printf("%llu direct and %llu copied writes of %llu frames: %llu frames copied, "
+            "%llu with the copy path\n",
+            directWrites, copiedWrites, frameCount, copiedFrames, copyPathFrames);
+    if (directWrites == 0 || copiedFrames >= copyPathFrames) {
+        printf("FAIL the zero copy path did not reduce the copies\n");
+        failures++;
+    }
+
+    Vector<uint32_t> frames1;
+    Vector<uint32_t> frames2;
+    String8 path1(directory);
+    String8 path2(directory);
+    path1.append("/duplicating_test_0.raw");
+    path2.append("/duplicating_test_1.raw");
+    if (!readFrames(path1.string(), &frames1) || !readFrames(path2.string(), &frames2)) {
+        return 1;
+    }
+    if (frames1.size() == 0 || frames1.size() != frames2.size() ||
+            memcmp(frames1.array(), frames2.array(), frames1.size() * sizeof(uint32_t)) != 0) {
+        printf("FAIL the outputs differ: %d and %d frames\n",
+                (int)frames1.size(), (int)frames2.size());
+        failures++;
+    }
+
+    if (failures != 0) {
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs AudioHardwareGeneric on a fifo instead of /dev/eac: opened for reading
+// and writing, the fifo loops the output stream back to the input stream.
+// Checks in both I/O modes that the audio comes back unchanged, then in the
+// poll mode that a full or empty device loses data after the timeout derived
+// from the period, and that the loss is reported to the caller.
+//
+// usage: generic_loopback_test [directory]
+//   the fifo is created in directory, /data/local/tmp by default
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "AudioHardwareGeneric.h"
+
+using namespace android;
+
+static int sFailures = 0;
+
+static void fail(const char* mode, const char* what)
+{
+    printf("FAIL %s: %s\n", mode, what);
+    sFailures++;
+}
+
+static bool openStreams(AudioHardwareGeneric* hw, AudioStreamOutGeneric** out,
+        AudioStreamInGeneric** in)
+{
+    status_t status;
+    *out = static_cast<AudioStreamOutGeneric*>(
+            hw->openOutputStream(AudioSystem::PCM_16_BIT, 2, 44100, &status));
+    if (*out == NULL) {
+        return false;
+    }
+    *in = static_cast<AudioStreamInGeneric*>(hw->openInputStream(MIC_INPUT,
+            AudioSystem::PCM_16_BIT, 1, 8000, &status, (AudioSystem::audio_in_acoustics)0));
+    if (*in == NULL) {
+        delete *out;
+        return false;
+    }
+    return true;
+}
+
+// one output period written is read back as input periods
+static void testLoopback(const char* path, const char* mode)
+{
+    AudioHardwareGeneric* hw = new AudioHardwareGeneric(path, mode);
+    AudioStreamOutGeneric* out;
+    AudioStreamInGeneric* in;
+    if (hw->initCheck() != NO_ERROR || !openStreams(hw, &out, &in)) {
+        fail(mode, "cannot open the fifo");
+        delete hw;
+        return;
+    }
+
+    size_t bytes = out->bufferSize();
+    uint8_t* written = new uint8_t[bytes];
+    uint8_t* read = new uint8_t[bytes];
+    for (size_t i = 0; i < bytes; i++) {
+        written[i] = (uint8_t)(i * 7 + 1);
+    }
+    memset(read, 0, bytes);
+
+    if (out->write(written, bytes) != (ssize_t)bytes) {
+        fail(mode, "short write to an empty fifo");
+    } else if (in->read(read, bytes) != (ssize_t)bytes) {
+        fail(mode, "short read of the data written");
+    } else if (memcmp(written, read, bytes) != 0) {
+        fail(mode, "the data read differs from the data written");
+    }
+
+    delete[] written;
+    delete[] read;
+    delete in;
+    delete out;
+    delete hw;
+}
+
+// the "lost bytes" counter of the stream dump
+static unsigned lostBytes(AudioStreamOut* out, AudioStreamIn* in)
+{
+    FILE* dump = tmpfile();
+    Vector<String16> args;
+    if (out != NULL) {
+        out->dump(fileno(dump), args);
+    } else {
+        in->dump(fileno(dump), args);
+    }
+    fflush(dump);
+    rewind(dump);
+    char line[256];
+    unsigned lost = 0;
+    while (fgets(line, sizeof(line), dump) != NULL) {
+        const char* counter = strstr(line, "lost bytes: ");
+        if (counter != NULL) {
+            lost = strtoul(counter + strlen("lost bytes: "), NULL, 10);
+        }
+    }
+    fclose(dump);
+    return lost;
+}
+
+// the period of the stream at 16 bit, in milliseconds
+static nsecs_t periodMs(size_t bytes, int channelCount, uint32_t sampleRate)
+{
+    return (nsecs_t)bytes * 1000 / (channelCount * sizeof(int16_t) * sampleRate);
+}
+
+static void testDataLoss(const char* path)
+{
+    const char* mode = "poll";
+    AudioHardwareGeneric* hw = new AudioHardwareGeneric(path, mode);
+    AudioStreamOutGeneric* out;
+    AudioStreamInGeneric* in;
+    if (hw->initCheck() != NO_ERROR || !openStreams(hw, &out, &in)) {
+        fail(mode, "cannot open the fifo");
+        delete hw;
+        return;
+    }
+
+    // nothing to read: the read gives up after two input periods
+    size_t bytes = in->bufferSize();
+    uint8_t* buffer = new uint8_t[out->bufferSize()];
+    nsecs_t timeout = 2 * periodMs(bytes, in->channelCount(), in->sampleRate());
+    nsecs_t start = systemTime();
+    ssize_t ret = in->read(buffer, bytes);
+    nsecs_t elapsed = ns2ms(systemTime() - start);
+    printf("empty fifo: read returned %d after %lld ms, timeout %lld ms\n",
+            (int)ret, (long long)elapsed, (long long)timeout);
+    if (ret != TIMED_OUT) {
+        fail(mode, "a read of an empty device did not time out");
+    }
+    if (elapsed < timeout || elapsed > timeout + 200) {
+        fail(mode, "the read timeout is not two input periods");
+    }
+    if (lostBytes(NULL, in) != bytes) {
+        fail(mode, "the bytes not read are not counted as lost");
+    }
+
+    // fill the fifo: the write that does not fit is cut short or times out
+    bytes = out->bufferSize();
+    memset(buffer, 0x5a, bytes);
+    size_t total = 0;
+    int writes = 0;
+    for (; writes < 1024; writes++) {
+        ret = out->write(buffer, bytes);
+        if (ret != (ssize_t)bytes) {
+            break;
+        }
+        total += bytes;
+    }
+    printf("full fifo: write %d returned %d after %u bytes\n", writes, (int)ret,
+            (unsigned)total);
+    if (writes == 1024) {
+        fail(mode, "the fifo never filled up");
+    } else if (ret != TIMED_OUT && (ret <= 0 || ret >= (ssize_t)bytes)) {
+        fail(mode, "a write to a full device did not report the loss");
+    } else {
+        size_t lost = bytes - ((ret > 0) ? ret : 0);
+        if (lostBytes(out, NULL) != lost) {
+            fail(mode, "the bytes not written are not counted as lost");
+        }
+    }
+
+    delete[] buffer;
+    delete in;
+    delete out;
+    delete hw;
+}
+
+int main(int argc, char** argv)
+{
+    const char* directory = (argc > 1) ? argv[1] : "/data/local/tmp";
+    String8 path(directory);
+    path.appendFormat("/generic_loopback_test_%d", getpid());
+    unlink(path.string());
+    if (mkfifo(path.string(), 0600) != 0) {
+        printf("FAIL cannot create %s: %s\n", path.string(), strerror(errno));
+        return 1;
+    }
+
+    testLoopback(path.string(), "blocking");
+    testLoopback(path.string(), "poll");
+    testDataLoss(path.string());
+    unlink(path.string());
+
+    if (sFailures != 0) {
+        printf("%d failures\n", sFailures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives StandbyPolicy with synthetic playback patterns, the way MixerThread
+// reports them: tracks play, the output goes idle for a gap, and when the gap
+// outlasted the standby delay, the first write after it takes the period plus
+// the cost of leaving standby. Checks the delay chosen for each pattern, below
+// the default one included.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include "StandbyPolicy.h"
+
+using namespace android;
+
+static const nsecs_t kPeriod = milliseconds(20);
+static const nsecs_t kDefaultDelay = seconds(3);
+// bounds of the adaptive delay when not configured
+static const nsecs_t kMinDelay = milliseconds(200);
+static const nsecs_t kMaxDelay = seconds(10);
+static const uint32_t kIdleSleepUs = 20000;
+static const uint32_t kActiveSleepUs = 10000;
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what, nsecs_t delay)
+{
+    if (!ok) {
+        printf("FAIL %s: %s, delay %lld msecs\n", test, what, (long long)ns2ms(delay));
+        failures++;
+    }
+}
+
+// plays for a second then stays idle for each gap in turn, gaps cycles through
+// numGaps values
+static void play(StandbyPolicy& policy, nsecs_t& now, const nsecs_t* gaps, int numGaps,
+        int count, nsecs_t exitCost)
+{
+    for (int i = 0; i < count; i++) {
+        now += seconds(1);
+        policy.onIdle(now);
+        nsecs_t gap = gaps[i % numGaps];
+        bool standby = gap > policy.standbyDelay();
+        now += gap;
+        policy.onActive(now);
+        if (standby) {
+            policy.onStandbyExit(kPeriod + exitCost);
+        }
+    }
+}
+
+static StandbyPolicy* newPolicy(int mode)
+{
+    StandbyPolicy* policy = new StandbyPolicy(kDefaultDelay);
+    policy->setPeriod(kPeriod);
+    policy->setMode(mode);
+    return policy;
+}
+
+int main(int argc, char** argv)
+{
+    static const nsecs_t shortGaps[] = {
+        milliseconds(100), milliseconds(180), milliseconds(300), milliseconds(150)
+    };
+    static const nsecs_t mediumGaps[] = {
+        milliseconds(1000), milliseconds(1500), milliseconds(1200), milliseconds(1100)
+    };
+    static const nsecs_t longGaps[] = { seconds(20), seconds(30) };
+    static const nsecs_t briefGaps[] = { milliseconds(40), milliseconds(60) };
+    static const nsecs_t expensive = milliseconds(100);
+    static const nsecs_t cheap = 0;
+    StandbyPolicy* policy;
+    nsecs_t now = 0;
+    nsecs_t delay;
+
+    // the fixed mode keeps the default whatever the gaps
+    policy = newPolicy(StandbyPolicy::FIXED);
+    play(*policy, now, shortGaps, 4, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay == kDefaultDelay, "fixed", "not the default delay", delay);
+    check(policy->idleSleepTimeUs(kIdleSleepUs, kActiveSleepUs) == kIdleSleepUs,
+            "fixed", "idle sleep changed", delay);
+    delete policy;
+
+    // too few gaps seen to leave the default
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    play(*policy, now, shortGaps, 4, 3, expensive);
+    delay = policy->standbyDelay();
+    check(delay == kDefaultDelay, "few gaps", "not the default delay", delay);
+    delete policy;
+
+    // short gaps are bridged by a delay well below the default, the output
+    // never entered standby so the exit cost is still unknown
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    play(*policy, now, shortGaps, 4, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay < kDefaultDelay, "short gaps", "not below the default", delay);
+    check(delay >= milliseconds(300) + kPeriod, "short gaps", "gaps not bridged", delay);
+    delete policy;
+
+    // gaps longer than a low default delay, expensive exits: the delay rises
+    // above the default to bridge them
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    policy->setDelay(milliseconds(500));
+    play(*policy, now, mediumGaps, 4, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay >= milliseconds(1500) + kPeriod, "expensive exits", "gaps not bridged", delay);
+    check(delay <= kMaxDelay, "expensive exits", "above the maximum", delay);
+    delete policy;
+
+    // the same gaps with cheap exits: standby after the minimum delay
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    policy->setDelay(milliseconds(500));
+    play(*policy, now, mediumGaps, 4, 16, cheap);
+    delay = policy->standbyDelay();
+    check(delay == kMinDelay, "cheap exits", "not the minimum delay", delay);
+    delete policy;
+
+    // gaps too long to be bridged: standby after the minimum delay even when
+    // leaving it is expensive
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    play(*policy, now, longGaps, 2, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay == kMinDelay, "long gaps", "not the minimum delay", delay);
+    delete policy;
+
+    // gaps shorter than the minimum delay: the minimum is kept, and the idle
+    // output polls at the active rate
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    play(*policy, now, briefGaps, 2, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay == kMinDelay, "brief gaps", "not the minimum delay", delay);
+    check(policy->idleSleepTimeUs(kIdleSleepUs, kActiveSleepUs) == kActiveSleepUs,
+            "brief gaps", "idle sleep not at the active rate", delay);
+    delete policy;
+
+    // a configured minimum bounds the bridged delay
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    check(policy->setMinDelay(seconds(1)) == NO_ERROR, "minimum", "setMinDelay failed", 0);
+    play(*policy, now, shortGaps, 4, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay == seconds(1), "minimum", "not the configured minimum", delay);
+    delete policy;
+
+    // values out of range are refused and change nothing
+    policy = newPolicy(StandbyPolicy::ADAPTIVE);
+    check(policy->setMode(2) == BAD_VALUE, "setters", "mode accepted", 0);
+    check(policy->setDelay(0) == BAD_VALUE, "setters", "null delay accepted", 0);
+    check(policy->setMinDelay(0) == BAD_VALUE, "setters", "null minimum accepted", 0);
+    check(policy->setMinDelay(kMaxDelay + 1) == BAD_VALUE, "setters",
+            "minimum above the maximum accepted", 0);
+    check(policy->setMaxDelay(kMinDelay - 1) == BAD_VALUE, "setters",
+            "maximum below the minimum accepted", 0);
+    check(policy->setMaxPeriodRatio(1) == BAD_VALUE, "setters", "period ratio accepted", 0);
+    check(policy->maxPeriod() == 3 * kPeriod, "setters", "period ratio changed", 0);
+    play(*policy, now, shortGaps, 4, 16, expensive);
+    delay = policy->standbyDelay();
+    check(delay >= milliseconds(300) + kPeriod && delay < kDefaultDelay, "setters",
+            "bounds changed", delay);
+    delete policy;
+
+    if (failures != 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}